@@ -6,14 +6,28 @@
 #include <string>
 #include <set>
 #include <map>
+#include <mutex>
 
 namespace enlighten
 {
 namespace lib
 {
+class IEnlightenSettings;
+
 struct AwsConfig
 {
 	std::string hostName;
+
+	// Shared by every upload, in KB/s with 0 for unlimited. The schedule sets
+	// other rates for times of day, see BandwidthSchedule.
+	uint32_t uploadKilobytesPerSecond;
+	std::string uploadSchedule;
+
+	AwsConfig() : uploadKilobytesPerSecond(0) {}
+
+	// Takes the upload rate and schedule from the settings, keeping the
+	// current values for whichever aren't set
+	void readSettings(IEnlightenSettings* settings);
 };
 
 struct AwsAccessProfile
@@ -80,7 +94,9 @@ private:
 	bool _initialised;
 	AwsConfig _config;
 
+	// Requests are created and freed from every crunch worker
 	std::set<IAwsRequest*> _requests;
+	std::mutex _requestsMutex;
 
 	struct AwsPrivateProfile
 	{
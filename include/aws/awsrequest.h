@@ -86,6 +86,9 @@ public:
 	int32_t statusCode();
 
 private:
+	// Drives curl's callbacks in the unit tests, without a connection
+	friend class AwsRequestCallbacks;
+
 	AwsRequest(const AwsRequest&);
 	void operator=(const AwsRequest&);
 
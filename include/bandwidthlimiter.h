@@ -0,0 +1,84 @@
+#ifndef BANDWIDTH_LIMITER_H
+#define BANDWIDTH_LIMITER_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace enlighten
+{
+namespace lib
+{
+// Upload rates by time of day, written as comma separated windows of local
+// time with a rate in KB/s, where 0 means unlimited:
+//
+//     "09:00-18:00=128,23:00-07:00=0"
+//
+// Windows may wrap past midnight. The first window containing a time wins,
+// and outside them all the default rate applies.
+class BandwidthSchedule
+{
+public:
+	bool parse(const std::string& schedule);
+
+	bool empty() const;
+
+	// Bytes per second at a minute of the day, 0 being unlimited
+	uint64_t bytesPerSecondAt(uint32_t minuteOfDay, uint64_t defaultBytesPerSecond) const;
+
+private:
+	struct Window
+	{
+		uint32_t startMinute;
+		uint32_t endMinute;
+		uint64_t bytesPerSecond;
+	};
+
+	std::vector<Window> _windows;
+};
+
+// A token bucket shared by every upload in the process, so however many
+// requests are running at once they keep to one rate between them. Tokens
+// are bytes; the bucket holds a fraction of a second's worth, which caps how
+// far a burst can run ahead of the rate.
+class BandwidthLimiter
+{
+public:
+	BandwidthLimiter();
+
+	static BandwidthLimiter& get();
+
+	// 0 is unlimited
+	void setRate(uint64_t bytesPerSecond);
+	void setSchedule(const BandwidthSchedule& schedule, uint64_t defaultBytesPerSecond);
+
+	uint64_t currentRate();
+
+	// Takes up to wanted bytes' worth of tokens, waiting up to maxWaitMs for
+	// some to come in. Returns how many were granted, 0 if none came in time.
+	uint64_t take(uint64_t wanted, uint32_t maxWaitMs);
+
+private:
+	BandwidthLimiter(const BandwidthLimiter&);
+	BandwidthLimiter& operator=(const BandwidthLimiter&);
+
+	typedef std::chrono::steady_clock Clock;
+
+	void refill(Clock::time_point now);
+	void applySchedule(Clock::time_point now);
+
+	std::mutex _mutex;
+
+	BandwidthSchedule _schedule;
+	uint64_t _defaultBytesPerSecond;
+	Clock::time_point _scheduleCheckedAt;
+
+	uint64_t _bytesPerSecond;
+	double _tokens;
+	Clock::time_point _refilledAt;
+};
+} // lib
+} // enlighten
+#endif // BANDWIDTH_LIMITER_H
@@ -0,0 +1,86 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace enlighten
+{
+namespace lib
+{
+// A fixed capacity queue between threads. push blocks while the queue is full,
+// which is what holds a fast stage back to the pace of a slow one, and pop
+// blocks while it is empty. Once closed, pushes are refused and pops drain
+// whatever is left before failing.
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : _capacity(capacity > 0 ? capacity : 1), _closed(false)
+	{
+	}
+
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_notFull.wait(lock, [this]() { return _closed || _items.size() < _capacity; });
+
+		if (_closed)
+			return false;
+
+		_items.push_back(std::move(item));
+		_notEmpty.notify_one();
+
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_notEmpty.wait(lock, [this]() { return _closed || !_items.empty(); });
+
+		if (_items.empty())
+			return false;
+
+		item = std::move(_items.front());
+		_items.pop_front();
+		_notFull.notify_one();
+
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closed = true;
+
+		_notFull.notify_all();
+		_notEmpty.notify_all();
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _items.size();
+	}
+
+	size_t capacity() const { return _capacity; }
+
+private:
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+
+	const size_t _capacity;
+
+	std::deque<T> _items;
+	bool _closed;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _notFull;
+	std::condition_variable _notEmpty;
+};
+} // lib
+} // enlighten
+#endif // BOUNDED_QUEUE_H
@@ -2,16 +2,66 @@
 #define CACHED_PREVIEWS_H
 
 #include "previewentry.h"
+#include "cachedpreviewsindex.h"
+#include "sqlitestatement.h"
+#include "syncaction.h"
+#include <map>
 #include <set>
+#include <vector>
 
 struct sqlite3;
-struct sqlite3_stmt;
 
 namespace enlighten
 {
 namespace lib
 {
 class IEnlightenSettings;
+
+// Walks the cached uuids in ascending order, each uuid once. The digest is
+// empty for previews cached before digests were recorded.
+class ICachedUuidCursor
+{
+public:
+	virtual ~ICachedUuidCursor() {}
+
+	virtual bool next(uuid_t& uuid, std::string& digest) = 0;
+};
+
+// A completed upload or removal, as recorded by applyUpdates
+struct CachedPreviewUpdate
+{
+	uuid_t uuid;
+	SyncAction action;
+	std::string digest;
+};
+
+// How far a journalled job has got. Jobs are journalled as soon as they're
+// diffed and marked done in the same transaction that caches their result.
+// Jobs which run out of retries are dead lettered and left alone until
+// they're requeued, or until they're diffed again under a new digest.
+enum SyncJobState
+{
+	SyncJobState_Pending,
+	SyncJobState_InFlight,
+	SyncJobState_Done,
+	SyncJobState_Failed,
+	SyncJobState_DeadLettered
+};
+
+struct SyncJob
+{
+	uuid_t uuid;
+	SyncAction action;
+	SyncJobState state;
+	uint32_t retries;
+
+	// The preview's digest when it was journalled, the cached one for removals
+	std::string digest;
+
+	// Not to be tried before this, in milliseconds since the epoch
+	int64_t retryAt;
+};
+
 class ICachedPreviews
 {
 public:
@@ -20,8 +70,12 @@ public:
 	virtual uint32_t numberOfCachedPreviews() const = 0;
 
 	virtual bool generateProxy(std::set<uuid_t>& entries) const = 0;
+	virtual ICachedUuidCursor* createOrderedCursor() const = 0;
 	virtual bool isInCache(const uuid_t& uuid) const = 0;
-	virtual bool markAsCached(const uuid_t& uuid) = 0;
+	virtual bool digestForUuid(const uuid_t& uuid, std::string& digest) const = 0;
+	virtual bool markAsCached(const uuid_t& uuid, const std::string& digest) = 0;
+	virtual bool removeFromCache(const uuid_t& uuid) = 0;
+	virtual bool applyUpdates(const std::vector<CachedPreviewUpdate>& updates) = 0;
 };
 
 class CachedPreviews : public ICachedPreviews
@@ -35,18 +89,73 @@ public:
 	uint32_t numberOfCachedPreviews() const;
 
 	bool generateProxy(std::set<uuid_t>& entries) const;
+	ICachedUuidCursor* createOrderedCursor() const;
 	bool isInCache(const uuid_t& uuid) const;
-	bool markAsCached(const uuid_t& uuid);
+	bool digestForUuid(const uuid_t& uuid, std::string& digest) const;
+	bool markAsCached(const uuid_t& uuid, const std::string& digest);
+	bool removeFromCache(const uuid_t& uuid);
+	bool applyUpdates(const std::vector<CachedPreviewUpdate>& updates);
+
+	// The job journal, which lets a synchronizer pick up where it stopped
+	bool journalJobs(const std::map<uuid_t, SyncAction>& jobs,
+		const std::map<uuid_t, std::string>& digests = std::map<uuid_t, std::string>());
+	bool markJobInFlight(const uuid_t& uuid);
+	bool markJobFailed(const uuid_t& uuid, int64_t retryAt);
+	bool markJobDeadLettered(const uuid_t& uuid);
+	bool deferJob(const uuid_t& uuid, int64_t retryAt);
+	bool jobForUuid(const uuid_t& uuid, SyncJob& job) const;
+	bool unfinishedJobs(std::vector<SyncJob>& jobs) const;
+	bool dueJobs(int64_t now, std::vector<SyncJob>& jobs) const;
+	bool deadLetteredJobs(std::vector<SyncJob>& jobs) const;
+	bool earliestRetry(int64_t& retryAt) const;
+	bool requeueDeadLetteredJobs();
+	bool purgeFinishedJobs();
 
 	static std::string databaseFileName();
 
 private:
-	bool createCachedPreviewsDatabase(const std::string& filePath);
+	typedef bool (CachedPreviews::*MigrationStep)();
+
+	// Upgrades the schema from version - 1 to version
+	struct Migration
+	{
+		int version;
+		MigrationStep step;
+	};
+
+	static const Migration kMigrations[];
+	static const int kSchemaVersion;
+
+	bool configureConnection();
+	int schemaVersion() const;
+	bool migrateSchema();
+	bool loadIndex();
+	bool migrateToDigestColumn();
+	bool migrateToUuidPrimaryKey();
+	bool migrateToJobJournal();
+	bool migrateToJobRetryTimes();
+	bool migrateToJobDigests();
+	bool addDigestColumnIfMissing();
+	bool executeUpdate(SqliteStatement& statement, const uuid_t& uuid,
+		const std::string* digest = nullptr);
+	bool updateJobState(SqliteStatement& statement, const uuid_t& uuid, SyncJobState state,
+		const int64_t* retryAt = nullptr);
+	bool selectJobs(SqliteStatement& statement, std::vector<SyncJob>& jobs) const;
 	bool executeAndCheckQuery(const char* query, int expectedResult) const;
 
 private:
 	sqlite3* _sqliteDatabase;
 	IEnlightenSettings* _settings;
+	CachedPreviewsIndex _index;
+
+	// Prepared once the schema is current and reused for every write
+	SqliteStatement _insertStatement;
+	SqliteStatement _deleteStatement;
+	SqliteStatement _journalStatement;
+	SqliteStatement _journalResetStatement;
+	SqliteStatement _jobStateStatement;
+	SqliteStatement _jobFailedStatement;
+	SqliteStatement _jobDeferredStatement;
 };
 } // lib
 } // enlighten
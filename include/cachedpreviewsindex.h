@@ -0,0 +1,51 @@
+#ifndef CACHED_PREVIEWS_INDEX_H
+#define CACHED_PREVIEWS_INDEX_H
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "uuid.h"
+
+namespace enlighten
+{
+namespace lib
+{
+// An in-memory copy of the cached uuids and their digests, so lookups never
+// reach SQLite. A bloom filter sits in front of the hash table; most uuids
+// asked about during a sync are new ones, and those are turned away without
+// a probe. Removed uuids stay set in the filter until it is next rebuilt,
+// which only costs the occasional extra probe.
+class CachedPreviewsIndex
+{
+public:
+	CachedPreviewsIndex();
+
+	void insert(const uuid_t& uuid, const std::string& digest);
+	void remove(const uuid_t& uuid);
+	void clear();
+	void reserve(uint32_t numberOfEntries);
+
+	bool contains(const uuid_t& uuid) const;
+	bool digestForUuid(const uuid_t& uuid, std::string& digest) const;
+	uint32_t numberOfEntries() const;
+
+	void copyUuids(std::set<uuid_t>& uuids) const;
+
+private:
+	bool mightContain(const uuid_t& uuid) const;
+	void addToFilter(const uuid_t& uuid);
+	void rebuildFilter(uint32_t capacity);
+
+private:
+	std::unordered_map<uuid_t, std::string> _digests;
+
+	std::vector<uint64_t> _filter;
+	uint64_t _filterMask;
+	uint32_t _filterCapacity;
+};
+} // lib
+} // enlighten
+#endif // CACHED_PREVIEWS_INDEX_H
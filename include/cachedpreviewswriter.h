@@ -0,0 +1,44 @@
+#ifndef CACHED_PREVIEWS_WRITER_H
+#define CACHED_PREVIEWS_WRITER_H
+
+#include "cachedpreviews.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace enlighten
+{
+namespace lib
+{
+// Collects completed uploads and removals and records them in the cache one
+// batch at a time, rather than paying for a sync per preview. A batch is written
+// once it holds batchSize updates or its oldest update is maxDelayMs old, and
+// whenever flush is called. Uploads are idempotent, so a crash only means the
+// unwritten batch is uploaded again.
+class CachedPreviewsWriter
+{
+public:
+	static const uint32_t kDefaultBatchSize;
+	static const uint32_t kDefaultMaxDelayMs;
+
+	CachedPreviewsWriter(ICachedPreviews* cachedPreviews,
+		uint32_t batchSize = kDefaultBatchSize, uint32_t maxDelayMs = kDefaultMaxDelayMs);
+	~CachedPreviewsWriter();
+
+	bool add(const uuid_t& uuid, SyncAction action, const std::string& digest);
+	bool flush();
+
+	uint32_t numberOfPendingUpdates() const;
+
+private:
+	ICachedPreviews* _cachedPreviews;
+	uint32_t _batchSize;
+	std::chrono::milliseconds _maxDelay;
+
+	std::vector<CachedPreviewUpdate> _pendingUpdates;
+	std::chrono::steady_clock::time_point _oldestPendingUpdate;
+};
+} // lib
+} // enlighten
+#endif // CACHED_PREVIEWS_WRITER_H
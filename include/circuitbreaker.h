@@ -0,0 +1,63 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace enlighten
+{
+namespace lib
+{
+// Stops a destination being hammered while it's down. Once enough requests
+// in a row have failed the breaker opens and refuses requests until a cool
+// down has passed. A single trial request is then let through, which closes
+// the breaker if it succeeds and reopens it for twice as long if it fails.
+class CircuitBreaker
+{
+public:
+	static const uint32_t kDefaultFailureThreshold = 5;
+	static const uint32_t kDefaultCoolDownMs = 30000;
+	static const uint32_t kDefaultMaxCoolDownMs = 600000;
+
+public:
+	CircuitBreaker(uint32_t failureThreshold = kDefaultFailureThreshold,
+		uint32_t coolDownMs = kDefaultCoolDownMs, uint32_t maxCoolDownMs = kDefaultMaxCoolDownMs);
+
+	// Shared by everything uploading to the destination
+	static CircuitBreaker& forDestination(const std::string& destinationIdentifier);
+
+	bool allowRequest();
+	void recordSuccess();
+	void recordFailure();
+
+	bool isOpen() const;
+
+	// When an open breaker will next let a request through, in milliseconds
+	// since the epoch
+	int64_t reopensAt() const;
+
+private:
+	CircuitBreaker(const CircuitBreaker&);
+	CircuitBreaker& operator=(const CircuitBreaker&);
+
+	uint32_t _failureThreshold;
+	uint32_t _initialCoolDownMs;
+	uint32_t _maxCoolDownMs;
+
+	uint32_t _consecutiveFailures;
+	uint32_t _coolDownMs;
+	int64_t _openUntil;
+	bool _open;
+	bool _trialInFlight;
+
+	mutable std::mutex _mutex;
+
+	static std::map<std::string, std::unique_ptr<CircuitBreaker>> _breakers;
+	static std::mutex _breakersMutex;
+};
+} // lib
+} // enlighten
+#endif // CIRCUIT_BREAKER_H
@@ -0,0 +1,83 @@
+#ifndef CONCURRENCY_LIMITER_H
+#define CONCURRENCY_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace enlighten
+{
+namespace lib
+{
+struct ConcurrencyStats
+{
+	uint32_t limit;
+	uint32_t inUse;
+
+	// Of the last complete window of samples
+	double p50LatencyMs;
+	double p95LatencyMs;
+	double throughput;
+	double errorRate;
+
+	// The best median latency seen lately, which the window's is judged against
+	double baselineLatencyMs;
+};
+
+// Caps how many operations run at once and tunes the cap from how they fare.
+// Samples are gathered into windows, and at the end of each window:
+//  - too many errors halve the limit,
+//  - a median latency well above the baseline shrinks the limit in proportion,
+//    as the extra time is spent queueing somewhere,
+//  - otherwise, if the limit was reached and throughput held up, it grows by one.
+// The baseline drifts up slowly so a move to a slower network is learnt.
+class ConcurrencyLimiter
+{
+public:
+	ConcurrencyLimiter(uint32_t initialLimit, uint32_t minLimit, uint32_t maxLimit);
+
+	// Waits for the number in use to drop below the limit. Returns false if
+	// cancelled first.
+	bool acquire(const std::atomic<bool>& cancel);
+	void release();
+
+	// units is whatever throughput is counted in, bytes for an upload
+	void recordSample(double latencyMs, uint64_t units, bool succeeded);
+
+	uint32_t limit() const;
+	uint32_t maxLimit() const;
+	ConcurrencyStats stats() const;
+
+private:
+	ConcurrencyLimiter(const ConcurrencyLimiter&);
+	ConcurrencyLimiter& operator=(const ConcurrencyLimiter&);
+
+	void closeWindow(std::chrono::steady_clock::time_point now);
+
+	typedef std::chrono::steady_clock Clock;
+
+	uint32_t _minLimit;
+	uint32_t _maxLimit;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _released;
+	uint32_t _limit;
+	uint32_t _inUse;
+
+	// The window being gathered
+	std::vector<double> _latencies;
+	uint64_t _units;
+	uint32_t _errors;
+	uint32_t _peakInUse;
+	Clock::time_point _windowStarted;
+
+	double _baselineLatencyMs;
+	double _lastThroughput;
+	ConcurrencyStats _lastWindow;
+};
+} // lib
+} // enlighten
+#endif // CONCURRENCY_LIMITER_H
@@ -0,0 +1,82 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace enlighten
+{
+namespace lib
+{
+// A process wide pool of workers which every synchronizer hands its CPU bound
+// work to, so the number of busy threads follows the number of cores rather
+// than the number of catalogs.
+//
+// Tasks are submitted on behalf of a group, typically one per catalog. Workers
+// take the highest priority task available and, within a priority, serve groups
+// in turn, so a large initial sync can't starve a small catalog. Tasks submitted
+// from inside a task are queued the same way, so they can't jump ahead of other
+// groups' work.
+class Executor
+{
+public:
+	enum Priority
+	{
+		PriorityHigh,
+		PriorityNormal,
+		PriorityLow,
+
+		NumberOfPriorities
+	};
+
+	typedef std::function<void()> Task;
+	typedef uint32_t GroupId;
+
+public:
+	explicit Executor(uint32_t numberOfWorkers);
+	~Executor();
+
+	static Executor& get();
+
+	GroupId createGroup();
+	void removeGroup(GroupId group);
+
+	bool submit(GroupId group, Priority priority, Task task);
+
+	uint32_t numberOfWorkers() const;
+
+private:
+	Executor(const Executor&);
+	Executor& operator=(const Executor&);
+
+	struct Group
+	{
+		std::deque<Task> tasks[NumberOfPriorities];
+	};
+
+	void workerLoop();
+
+	bool takeScheduledTask(Task& task);
+
+private:
+	std::vector<std::thread> _workers;
+
+	std::map<GroupId, Group> _groups;
+	GroupId _nextGroupId;
+	GroupId _lastServedGroup;
+
+	uint32_t _scheduledTasks;
+	bool _stopping;
+
+	std::mutex _mutex;
+	std::condition_variable _workAvailable;
+};
+} // lib
+} // enlighten
+#endif // EXECUTOR_H
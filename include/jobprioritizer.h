@@ -0,0 +1,91 @@
+#ifndef JOB_PRIORITIZER_H
+#define JOB_PRIORITIZER_H
+
+#include "uuid.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace enlighten
+{
+namespace lib
+{
+class PreviewsDatabase;
+
+// Built in orders for IEnlightenSettings::JobOrder
+enum JobOrder
+{
+	JobOrder_CaptureTime,
+	JobOrder_PyramidTime,
+	JobOrder_Uuid
+};
+
+// Supplies the key a sync pass is ordered by. Jobs with higher keys are
+// processed first and jobs with equal keys keep uuid order.
+class IJobPrioritizer
+{
+public:
+	virtual ~IJobPrioritizer() {}
+
+	// Called at the start of each pass, before any keys are asked for
+	virtual bool preparePass() = 0;
+	virtual double priorityForUuid(const uuid_t& uuid) const = 0;
+};
+
+// Most recently rendered previews first
+class PyramidTimePrioritizer : public IJobPrioritizer
+{
+public:
+	PyramidTimePrioritizer(PreviewsDatabase* previewsDatabase);
+
+	bool preparePass();
+	double priorityForUuid(const uuid_t& uuid) const;
+
+protected:
+	PreviewsDatabase* _previewsDatabase;
+	std::map<uuid_t, double> _priorities;
+};
+
+// Most recently taken photos first. Lightroom keeps the catalog locked while
+// it's open, in which case photos are ordered by their pyramid time instead.
+class CaptureTimePrioritizer : public PyramidTimePrioritizer
+{
+public:
+	CaptureTimePrioritizer(PreviewsDatabase* previewsDatabase, const std::string& catalogFile);
+
+	bool preparePass();
+
+	// "<name> Previews.lrdata/previews.db" belongs to "<name>.lrcat"
+	static std::string catalogFileForPreviewsDatabase(const std::string& previewsDatabaseFile);
+
+private:
+	bool loadCaptureTimes();
+
+	std::string _catalogFile;
+};
+
+// Previews asked for by a client go before everything else, the most
+// recently asked for first. Other uuids are ordered by the fallback, if any.
+class RequestedPrioritizer : public IJobPrioritizer
+{
+public:
+	RequestedPrioritizer();
+
+	void setFallback(IJobPrioritizer* fallback);
+	void request(const uuid_t& uuid);
+
+	bool preparePass();
+	double priorityForUuid(const uuid_t& uuid) const;
+
+private:
+	IJobPrioritizer* _fallback;
+
+	std::map<uuid_t, uint64_t> _requests;
+	uint64_t _numberOfRequests;
+	mutable std::mutex _mutex;
+};
+} // lib
+} // enlighten
+#endif // JOB_PRIORITIZER_H
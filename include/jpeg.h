@@ -9,6 +9,19 @@ namespace enlighten
 {
 namespace lib
 {
+// A single component of a planar (YCbCr or greyscale) image, stored at the
+// component's own sampling resolution. Rows are rowStride bytes apart.
+struct JpegPlane
+{
+	uint8_t* bytes;
+	uint32_t width;
+	uint32_t height;
+	uint32_t rowStride;
+
+	uint32_t horizontalSampling;
+	uint32_t verticalSampling;
+};
+
 class IJpeg
 {
 public:
@@ -16,6 +29,7 @@ public:
 	virtual ~IJpeg() {}
 
 	virtual bool decompress() = 0;
+	virtual bool decompressPlanar() = 0;
 	virtual bool compress(uint32_t qualityLevel) = 0;
 
 	virtual uint32_t components() const = 0;
@@ -23,7 +37,11 @@ public:
 	virtual uint32_t height() const = 0;
 	virtual const uint8_t* rawBytes() const = 0;
 
+	virtual uint32_t numberOfPlanes() const = 0;
+	virtual const JpegPlane* plane(uint32_t planeIndex) const = 0;
+
 	virtual bool fromRawBytes(uint8_t* bytes, uint32_t width, uint32_t height, uint32_t components) = 0;
+	virtual bool fromPlanes(const JpegPlane* planes, uint32_t numberOfPlanes, uint32_t width, uint32_t height) = 0;
 	virtual const uint8_t* compressedData(uint32_t& size) const = 0;
 
 	virtual bool writeToFile(const char* filePath) = 0;
@@ -37,27 +55,52 @@ public:
 	virtual ~Jpeg();
 
 	bool decompress();
+	bool decompressPlanar();
 	bool compress(uint32_t qualityLevel);
 
+	// Reads just the header, for the size of the image before any scaling
+	bool readDimensions(uint32_t& width, uint32_t& height, uint32_t& components) const;
+
+	// Decompresses straight to 1/denominator of the size, which libjpeg does
+	// far cheaper than decoding in full. One of 1, 2, 4 or 8. Planar
+	// decompression only runs unscaled.
+	bool setScaleDenominator(uint32_t denominator);
+	uint32_t scaleDenominator() const;
+
 	uint32_t components() const;
 	uint32_t width() const;
 	uint32_t height() const;
 	const uint8_t* rawBytes() const;
 
+	uint32_t numberOfPlanes() const;
+	const JpegPlane* plane(uint32_t planeIndex) const;
+
 	bool fromRawBytes(uint8_t* bytes, uint32_t width, uint32_t height, uint32_t components);
+	bool fromPlanes(const JpegPlane* planes, uint32_t numberOfPlanes, uint32_t width, uint32_t height);
 	const uint8_t* compressedData(uint32_t& size) const;
 
 	bool writeToFile(const char* filePath);
 
+	static const uint32_t kMaxPlanes = 4;
+
 private:
+	bool compressRgb(uint32_t qualityLevel);
+	bool compressPlanar(uint32_t qualityLevel);
+	void freePlanes();
+
 	bool _retainedCompressedData;
 	uint8_t* _compressedBytes;
 	uint32_t _compressedSize;
 
+	uint32_t _scaleDenominator;
+
 	uint8_t* _decompressedBytes;
 	uint32_t _width;
 	uint32_t _height;
 	uint32_t _components;
+
+	JpegPlane _planes[kMaxPlanes];
+	uint32_t _numberOfPlanes;
 };
 } // lib
 } // enlighten
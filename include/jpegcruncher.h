@@ -4,23 +4,64 @@
 #include <cstdint>
 #include <string>
 
+#include "orientation.h"
+
 namespace enlighten
 {
 namespace lib
 {
 class IJpeg;
+struct JpegPlane;
 class JpegCruncher
 {
+public:
+	enum CrunchMode
+	{
+		CrunchModeRGB,
+		CrunchModeYCbCr
+	};
+
 public:
 	JpegCruncher(IJpeg* sourceJpeg, IJpeg* targetJpeg);
 
+	void setCrunchMode(CrunchMode mode);
+	CrunchMode crunchMode() const;
+
+	void setOrientation(Orientation orientation);
+	Orientation orientation() const;
+
 	bool reencodeJpeg(uint32_t longestDimension, int32_t qualityLevel);
 private:
+	void calculateTargetDimensions(uint32_t longestDimension, uint32_t& targetWidth,
+		uint32_t& targetHeight);
+
+	bool reencodeRgb(uint32_t longestDimension, int32_t qualityLevel);
+	bool reencodePlanar(uint32_t longestDimension, int32_t qualityLevel);
+
+	// Where each resampled pixel lands in the target buffer. Rotations and flips are
+	// applied by walking the target with these offsets rather than in a separate pass.
+	struct TargetAddressing
+	{
+		int64_t origin;
+		int64_t xStep;
+		int64_t yStep;
+	};
+
+	bool orientationSwapsDimensions() const;
+	TargetAddressing addressingForOrientation(uint32_t width, uint32_t height,
+		uint32_t targetRowStride, uint32_t pixelStride) const;
+
 	bool rescaleBuffer(const uint8_t* sourceBuffer, uint32_t sourceWidth, uint32_t sourceHeight,
-		uint32_t components, uint8_t* targetBuffer, uint32_t targetWidth, uint32_t targetHeight);
+		uint32_t components, uint8_t* targetBuffer, uint32_t targetWidth, uint32_t targetHeight,
+		const TargetAddressing& addressing);
+	bool rescalePlane(const JpegPlane& sourcePlane, uint32_t targetWidth, uint32_t targetHeight,
+		JpegPlane& targetPlane);
 
 	IJpeg* _sourceJpeg;
 	IJpeg* _targetJpeg;
+
+	CrunchMode _mode;
+	Orientation _orientation;
 };
 } // lib
 } // enlighten
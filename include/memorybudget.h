@@ -0,0 +1,80 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace enlighten
+{
+namespace lib
+{
+// Caps the bytes of preview data held across every pipeline in the process.
+// Stages reserve what they're about to allocate and give it back once it's
+// freed, so however many previews are in flight their buffers fit in the
+// budget. A single reservation bigger than the whole budget is let through
+// when nothing else is reserved, rather than never.
+class MemoryBudget
+{
+public:
+	explicit MemoryBudget(uint64_t capacity);
+
+	static MemoryBudget& get();
+
+	void setCapacity(uint64_t capacity);
+	uint64_t capacity() const;
+	uint64_t reserved() const;
+	uint64_t peakReserved() const;
+
+	// Waits for the bytes to be free. Returns false if cancelled first.
+	bool reserve(uint64_t bytes, const std::atomic<bool>& cancel);
+
+	// Doesn't wait, and doesn't jump ahead of anyone who is waiting
+	bool tryReserve(uint64_t bytes);
+
+	void release(uint64_t bytes);
+
+private:
+	MemoryBudget(const MemoryBudget&);
+	MemoryBudget& operator=(const MemoryBudget&);
+
+	bool fits(uint64_t bytes) const;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _released;
+
+	uint64_t _capacity;
+	uint64_t _reserved;
+	uint64_t _peakReserved;
+	uint32_t _waiters;
+};
+
+// Bytes held from a budget on behalf of one buffer or item, given back when
+// it goes. Moves with the item it's accounting for.
+class MemoryReservation
+{
+public:
+	MemoryReservation();
+	explicit MemoryReservation(MemoryBudget& budget);
+	MemoryReservation(MemoryReservation&& other);
+	MemoryReservation& operator=(MemoryReservation&& other);
+	~MemoryReservation();
+
+	uint64_t bytes() const;
+
+	bool grow(uint64_t bytes, const std::atomic<bool>& cancel);
+	bool tryGrow(uint64_t bytes);
+	void shrinkTo(uint64_t bytes);
+	void release();
+
+private:
+	MemoryReservation(const MemoryReservation&);
+	MemoryReservation& operator=(const MemoryReservation&);
+
+	MemoryBudget* _budget;
+	uint64_t _bytes;
+};
+} // lib
+} // enlighten
+#endif // MEMORY_BUDGET_H
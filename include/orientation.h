@@ -0,0 +1,23 @@
+#ifndef ORIENTATION_H
+#define ORIENTATION_H
+
+namespace enlighten
+{
+namespace lib
+{
+	// Values match the EXIF orientation tag
+	enum Orientation
+	{
+		Orientation_Normal = 1,
+		Orientation_FlipHorizontal,
+		Orientation_Rotate180,
+		Orientation_FlipVertical,
+		Orientation_Transpose,
+		Orientation_Rotate90,
+		Orientation_Transverse,
+		Orientation_Rotate270
+	};
+} // lib
+} // enlighten
+
+#endif // ORIENTATION_H
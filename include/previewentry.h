@@ -5,21 +5,24 @@
 #include <vector>
 
 #include "previewentrylevel.h"
+#include "orientation.h"
+#include "uuid.h"
 
 namespace enlighten
 {
 namespace lib
 {
-typedef std::string uuid_t;
-
 class PreviewEntry
 {
 public:
-	PreviewEntry(const std::string& uuid, const std::string& digest,
-		const std::vector<PreviewEntryLevel>& levels);
+	PreviewEntry();
+	PreviewEntry(const uuid_t& uuid, const std::string& digest,
+		const std::vector<PreviewEntryLevel>& levels,
+		Orientation orientation = Orientation_Normal);
 
 	const uuid_t& uuid() const;
 	const std::string& digest() const;
+	Orientation orientation() const;
 
 	std::string filePathRelativeToRoot() const;
 
@@ -31,6 +34,7 @@ public:
 private:
 	uuid_t _uuid;
 	std::string _digest;
+	Orientation _orientation;
 
 	std::vector<PreviewEntryLevel> _levels;
 };
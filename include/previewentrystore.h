@@ -0,0 +1,56 @@
+#ifndef PREVIEW_ENTRY_STORE_H
+#define PREVIEW_ENTRY_STORE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "previewentry.h"
+#include "previewentrylevel.h"
+#include "orientation.h"
+
+namespace enlighten
+{
+namespace lib
+{
+// A flat, allocation-light store of preview entries. Digests are packed into
+// 16 bytes alongside the binary uuid, every entry's levels live in one shared array, and lookups
+// go through an open-addressing hash index rather than a tree of heap nodes.
+class PreviewEntryStore
+{
+public:
+	PreviewEntryStore();
+
+	bool insert(const uuid_t& uuid, const std::string& digest, Orientation orientation,
+		const std::vector<PreviewEntryLevel>& levels);
+	bool contains(const uuid_t& uuid) const;
+	bool entryForUuid(const uuid_t& uuid, PreviewEntry& entry) const;
+
+	uint32_t numberOfEntries() const;
+	void reserve(uint32_t numberOfEntries);
+	void clear();
+
+private:
+	struct Record
+	{
+		Uuid uuid;
+		uint8_t digest[16];
+		uint32_t firstLevel;
+		uint8_t numberOfLevels;
+		uint8_t orientation;
+	};
+
+	static const uint32_t kEmptySlot = 0xFFFFFFFF;
+
+	uint32_t findRecord(const uuid_t& uuid) const;
+	uint32_t slotForUuid(const uuid_t& uuid) const;
+	void rehash(uint32_t numberOfSlots);
+
+	std::vector<Record> _records;
+	std::vector<PreviewEntryLevel> _levels;
+	std::vector<uint32_t> _slots;
+};
+} // lib
+} // enlighten
+
+#endif // PREVIEW_ENTRY_STORE_H
@@ -2,15 +2,17 @@
 #define PREVIEWS_DATABASE_H
 
 #include <string>
+#include <functional>
 #include <map>
 #include <vector>
 #include <set>
 #include "previewentrylevel.h"
 #include "previewentry.h"
+#include "previewentrystore.h"
+#include "sqlitestatement.h"
 #include "syncaction.h"
 
 struct sqlite3;
-struct sqlite3_stmt;
 
 namespace enlighten
 {
@@ -20,36 +22,83 @@ class ICachedPreviews;
 class PreviewsDatabase
 {
 public:
+	// The digest is the preview's for adds and updates, and the cached one for
+	// removals, which may be empty
+	typedef std::function<void(const uuid_t&, SyncAction, const std::string&)> SyncActionCallback;
+
 	PreviewsDatabase();
 	~PreviewsDatabase();
 
 	bool initialiseWithFile(const std::string& fileName);
 	bool reopen();
 
+	// Copies the database into memory and serves every read from the copy until
+	// endSnapshot, so a sync pass neither waits on nor blocks Lightroom's writes.
+	bool beginSnapshot();
+	void endSnapshot();
+	bool isReadingSnapshot() const;
+
 	unsigned int numberOfPreviewEntries();
 	bool uuidForIndex(uint32_t index, uuid_t& uuid);
-	const PreviewEntry* entryForUuid(const uuid_t& uuid);
+	bool entryForUuid(const uuid_t& uuid, PreviewEntry& entry);
+	bool loadAllEntries();
+
+	// Sort keys for ordering a pass. Time stamps are seconds since 2001, as
+	// Lightroom stores them; image ids key Adobe_images in the catalog.
+	bool pyramidTimeStamps(std::map<uuid_t, double>& timeStamps);
+	bool imageIds(std::map<int64_t, uuid_t>& uuidsByImageId);
 
+	bool hasChanged();
+	bool diffAgainstCachedPreviews(const ICachedPreviews& cachedPreviews,
+		const SyncActionCallback& callback);
 	bool checkEntriesAgainstCachedPreviews(const ICachedPreviews& cachedPreviews,
-		std::map<uuid_t, SyncAction>& uuidActions);
+		std::map<uuid_t, SyncAction>& uuidActions, std::map<uuid_t, std::string>* digests = nullptr);
+	bool checkChangedEntriesAgainstCachedPreviews(const ICachedPreviews& cachedPreviews,
+		std::map<uuid_t, SyncAction>& uuidActions, std::map<uuid_t, std::string>* digests = nullptr);
 
 private:
-	sqlite3_stmt* makeStatement(const char* query);
+	void closeDatabase();
+	void resetHighWaterMarks();
+	sqlite3* readDatabase() const;
+
+	bool queryDataVersion(int64_t& dataVersion);
+
+	SqliteStatement* cachedStatement(const char* query);
 
-	bool selectUuidColumnForIndex(uint32_t index, uuid_t& uuid);
+	bool selectUuidColumn();
 
 	bool selectImageCacheEntryColumnsForUuid(const uuid_t& uuid,
-		std::string& digest);
+		std::string& digest, Orientation& orientation);
 	bool selectPyramidColumnsForUuid(const uuid_t& uuid,
 		std::vector<PreviewEntryLevel>& levels);
 
 private:
 	int32_t _cachedNumberOfEntries;
 	std::string _sourceFile;
-	std::map<uuid_t, PreviewEntry*>  _cachedEntries;
+
+	// Every uuid in table order, built in one pass on first indexed access and
+	// dropped whenever the database is (re)opened.
+	std::vector<uuid_t> _uuidsByIndex;
+	bool _uuidsByIndexValid;
+	PreviewEntryStore _entries;
+
+	// What the last diff saw of the Pyramid table. Rows past the rowid mark, or
+	// with a newer file time stamp, are the only ones an incremental diff visits.
+	int64_t _dataVersion;
+	int64_t _pyramidRowCount;
+	int64_t _rowidHighWaterMark;
+	double _fileTimeStampHighWaterMark;
+
+	// Prepared once per connection, keyed by their SQL. Statements are reset
+	// after each use so they don't hold a read lock on Lightroom's database.
+	std::map<std::string, SqliteStatement> _statementCache;
 
 	sqlite3* _sqliteDatabase;
 
+	// An in-memory copy taken by beginSnapshot, and the data version it was taken at
+	sqlite3* _snapshotDatabase;
+	int64_t _snapshotDataVersion;
+
 };
 } // lib
 } // enlighten
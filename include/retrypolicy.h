@@ -0,0 +1,27 @@
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <cstdint>
+
+namespace enlighten
+{
+namespace lib
+{
+// How often and how patiently a failed job is retried. Delays double with
+// each retry up to maxDelayMs, and each is jittered down by as much as half
+// so jobs which failed together don't all retry together.
+struct RetryPolicy
+{
+	uint32_t maxRetries;
+	uint32_t baseDelayMs;
+	uint32_t maxDelayMs;
+
+	bool shouldRetry(uint32_t retries) const;
+	uint32_t delayForRetry(uint32_t retries) const;
+
+	// Milliseconds since the epoch, which is what retry times are stored as
+	static int64_t currentTimeMs();
+};
+} // lib
+} // enlighten
+#endif // RETRY_POLICY_H
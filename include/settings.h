@@ -15,6 +15,15 @@ public:
 	{
 		CachedDatabasePath,
 		WatcherPollRate,
+		SnapshotPreviewsDatabase,
+		CrunchWorkerCount,
+		UploadWorkerCount,
+		AdaptiveConcurrency,
+		MemoryBudgetMegabytes,
+		SyncJobOrder,
+		RequeueDeadLetteredJobs,
+		UploadKilobytesPerSecond,
+		UploadSchedule,
 
 		// Probably non-user defined
 		PreviewLongestDimension,
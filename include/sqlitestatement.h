@@ -0,0 +1,78 @@
+#ifndef SQLITE_STATEMENT_H
+#define SQLITE_STATEMENT_H
+
+#include <cstdint>
+#include <string>
+
+#include "uuid.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace enlighten
+{
+namespace lib
+{
+class AbstractSqliteTimingDelegate;
+
+// Owns a prepared statement and finalizes it when it goes, so early returns
+// can't leak one. A statement may be kept and reused; reset() readies it for
+// the next execution. Each execution, from its first step until it is reset
+// or finalized, is reported to the timing delegate when one is set.
+class SqliteStatement
+{
+public:
+	SqliteStatement();
+	~SqliteStatement();
+
+	SqliteStatement(SqliteStatement&& other);
+	SqliteStatement& operator=(SqliteStatement&& other);
+
+	// Delegates are process wide and should be set before any statements run
+	static void setTimingDelegate(AbstractSqliteTimingDelegate* delegate);
+
+	bool prepare(sqlite3* database, const char* query);
+	void finalize();
+	bool isValid() const { return _statement != nullptr; }
+
+	int step();
+	void reset();
+
+	void bindText(int parameter, const std::string& text);
+	void bindUuid(int parameter, const uuid_t& uuid);
+	void bindNull(int parameter);
+	void bindInt64(int parameter, int64_t value);
+	void bindDouble(int parameter, double value);
+
+	int columnInt(int column) const;
+	int64_t columnInt64(int column) const;
+	double columnDouble(int column) const;
+	const char* columnText(int column) const;
+	std::string columnString(int column) const;
+	bool columnUuid(int column, uuid_t& uuid) const;
+
+	const char* query() const;
+
+private:
+	SqliteStatement(const SqliteStatement&);
+	SqliteStatement& operator=(const SqliteStatement&);
+
+	void reportExecution();
+
+private:
+	sqlite3_stmt* _statement;
+
+	uint64_t _elapsedMicroseconds;
+	uint32_t _numberOfSteps;
+};
+
+class AbstractSqliteTimingDelegate
+{
+public:
+	virtual ~AbstractSqliteTimingDelegate() {}
+	virtual void statementExecuted(const char* query, uint64_t elapsedMicroseconds,
+		uint32_t numberOfSteps) = 0;
+};
+} // lib
+} // enlighten
+#endif // SQLITE_STATEMENT_H
@@ -5,13 +5,22 @@
 #include "previewentry.h"
 #include "watcher.h"
 #include "syncaction.h"
+#include "executor.h"
+#include "concurrencylimiter.h"
+#include "jobprioritizer.h"
+#include "retrypolicy.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <thread>
 #include <mutex>
-#include <future>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace enlighten
 {
@@ -19,6 +28,7 @@ namespace lib
 {
 class PreviewsDatabase;
 class CachedPreviews;
+class CachedPreviewsWriter;
 class Watcher;
 class IEnlightenSettings;
 class IFile;
@@ -26,9 +36,17 @@ class IAws;
 class PreviewsSynchronizer : public AbstractSynchronizer, public AbstractWatcherDelegate
 {
 private:
-	typedef std::function<void(const uuid_t&)> SuccessCallbackFunc;
+	typedef std::function<void(const uuid_t&, SyncAction, const std::string&)> SuccessCallbackFunc;
 	typedef std::function<void(const uuid_t&, const std::string&)> ErrorCallbackFunc;
 
+	// Resolved once per pass
+	struct CrunchParameters
+	{
+		std::string basePath;
+		int32_t longestDimension;
+		int32_t quality;
+	};
+
 public:
 	PreviewsSynchronizer(IEnlightenSettings* settings, IAws* aws);
 	~PreviewsSynchronizer();
@@ -40,33 +58,90 @@ public:
 	// WatcherDelegate
 	bool fileHasChanged(Watcher* watcher, const IFile* file);
 
+	// Moves a preview to the front of the queue, for when a client is waiting on it
+	void requestPreview(const uuid_t& uuid);
+
+	// How many crunches and uploads a pass runs at once, and what they're tuned by
+	ConcurrencyStats crunchConcurrency() const;
+	ConcurrencyStats uploadConcurrency() const;
+
 private:
 	bool processChanges();
-	void crunchAndUpload(std::map<uuid_t, SyncAction>* entries, SuccessCallbackFunc processedUuidCallback,
+	void startPass(std::map<uuid_t, SyncAction>* entries, bool followUp);
+	std::map<uuid_t, SyncAction>* resumeJobs();
+	std::map<uuid_t, SyncAction>* collectChanges();
+	void synchronizeChanges(std::map<uuid_t, SyncAction>* entries);
+	void crunchAndUpload(const std::map<uuid_t, SyncAction>& entries, SuccessCallbackFunc processedUuidCallback,
 		 ErrorCallbackFunc processingErrorCallback);
+	struct PipelineItem;
+	struct SyncPipeline;
+
+	void prioritizeWork(SyncPipeline& pipeline);
+	bool claimNextJob(SyncPipeline* pipeline, size_t& index, bool& requested);
+	IJobPrioritizer* createOrderPrioritizer(const std::string& file);
+
+	void readStage(SyncPipeline* pipeline);
+	void crunchTask(SyncPipeline* pipeline, std::shared_ptr<PipelineItem> item,
+		std::chrono::steady_clock::time_point submitted);
+	void uploadStage(SyncPipeline* pipeline);
+
+	bool acquirePipelineSlot(SyncPipeline* pipeline);
+	void releasePipelineSlot(SyncPipeline* pipeline);
+	void finishCrunching(SyncPipeline* pipeline, bool readerDone);
+
+	bool readPreview(PipelineItem& item, const CrunchParameters& parameters,
+		ErrorCallbackFunc processingErrorCallback);
+	bool reserveCrunchMemory(PipelineItem& item, const CrunchParameters& parameters);
+	bool crunchPreview(PipelineItem& item, const CrunchParameters& parameters,
+		ErrorCallbackFunc processingErrorCallback);
+	void uploadPreview(const PipelineItem& item, SuccessCallbackFunc processedUuidCallback);
+
+	uint32_t stageWorkers(uint32_t wanted, size_t numberOfEntries) const;
+	bool removeObjectForEntry(const PreviewEntry& entry);
 	std::string pathOfPreviewsDatabaseFile();
 
-	void processedUuid(const uuid_t& uuid);
+	void processedUuid(const uuid_t& uuid, SyncAction action, const std::string& digest);
 	void errorProcessingUuid(const uuid_t& uuid, const std::string& error);
+	void failJob(const uuid_t& uuid, const RetryPolicy& policy);
 	void stopAndCleanup();
 
 private:
 	PreviewsDatabase* _previewsDatabase;
 	CachedPreviews* _cachedPreviews;
+	CachedPreviewsWriter* _cachedPreviewsWriter;
 
 	IEnlightenSettings* _settings;
 	IAws* _aws;
 
+	// Crunching runs on the process wide executor, shared with every other catalog
+	Executor::GroupId _executorGroup;
+
+	// Tuned as passes run, and kept from one pass to the next
+	ConcurrencyLimiter* _crunchLimiter;
+	ConcurrencyLimiter* _uploadLimiter;
+
+	// Orders each pass. Requested previews come first, then the configured order.
+	RequestedPrioritizer* _jobPrioritizer;
+	IJobPrioritizer* _orderPrioritizer;
+
+	// Guarded by _mutex. Requests not yet claimed by the running pass.
+	std::deque<uuid_t> _requestedUuids;
+
 	std::string _awsDestinationIdentifier;
 
 	Watcher* _watcher;
 	IFile* _previewsDatabaseFile;
 
 	std::thread _workerThread;
-	std::promise<bool> _workerPromise;
-	volatile bool _cancelWorking;
+	std::atomic<bool> _cancelWorking;
 	std::mutex _mutex;
 
+	// Guarded by _mutex. Changes noticed while a pass is running are
+	// coalesced into a single follow-up pass.
+	bool _passRunning;
+	bool _changesPending;
+	std::condition_variable _passCondition;
+
 	enum State
 	{
 		Idle,
@@ -0,0 +1,60 @@
+#ifndef UUID_H
+#define UUID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace enlighten
+{
+namespace lib
+{
+// The value of a single hex digit in either case, or -1 if it isn't one
+int hexValue(char character);
+
+// A 128-bit uuid held by value. The two halves are stored most significant
+// byte first, so ordering matches the ordering of the formatted strings.
+class Uuid
+{
+public:
+	static const size_t kStringLength = 36;
+
+	Uuid();
+	explicit Uuid(const std::string& string);
+
+	static bool fromString(const char* string, size_t length, Uuid& uuid);
+	static bool fromString(const std::string& string, Uuid& uuid);
+
+	std::string toString() const;
+	void format(char* buffer) const;
+
+	bool isNil() const;
+	size_t hash() const;
+
+	bool operator==(const Uuid& other) const { return _high == other._high && _low == other._low; }
+	bool operator!=(const Uuid& other) const { return !(*this == other); }
+	bool operator<(const Uuid& other) const
+	{
+		return _high < other._high || (_high == other._high && _low < other._low);
+	}
+
+private:
+	uint64_t _high;
+	uint64_t _low;
+};
+
+typedef Uuid uuid_t;
+} // lib
+} // enlighten
+
+namespace std
+{
+template <>
+struct hash<enlighten::lib::Uuid>
+{
+	size_t operator()(const enlighten::lib::Uuid& uuid) const { return uuid.hash(); }
+};
+} // std
+
+#endif // UUID_H
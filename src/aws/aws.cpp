@@ -1,8 +1,11 @@
 #include "aws/aws.h"
+#include "bandwidthlimiter.h"
+#include "settings.h"
 #include "validation.h"
 
 #include <curl/curl.h>
 
+#include <algorithm>
 #include <cassert>
 
 namespace enlighten
@@ -10,6 +13,15 @@ namespace enlighten
 namespace lib
 {
 
+void AwsConfig::readSettings(IEnlightenSettings* settings)
+{
+	int32_t kilobytesPerSecond = settings->get(IEnlightenSettings::UploadKilobytesPerSecond,
+		static_cast<int32_t>(uploadKilobytesPerSecond));
+	uploadKilobytesPerSecond = static_cast<uint32_t>(std::max<int32_t>(kilobytesPerSecond, 0));
+
+	uploadSchedule = settings->get(IEnlightenSettings::UploadSchedule, uploadSchedule);
+}
+
 Aws::Aws()
 {
 }
@@ -28,6 +40,10 @@ Aws& Aws::get()
 
 bool Aws::initialise(const AwsConfig& config)
 {
+	BandwidthSchedule schedule;
+	VALIDATE(schedule.parse(config.uploadSchedule), "Failed to parse the upload schedule");
+	BandwidthLimiter::get().setSchedule(schedule, config.uploadKilobytesPerSecond * 1024ull);
+
 	_config = config;
 
 	if (_initialised)
@@ -94,12 +110,16 @@ IAwsRequest* Aws::createRequestForDestination(const std::string& destinationIden
 
 	const AwsPrivateProfile& profile = it->second;
 	AwsRequest* request = new AwsRequest(&_config, &profile.accessProfile, &profile.destination);
+
+	std::lock_guard<std::mutex> autolock(_requestsMutex);
 	_requests.insert(request);
 	return request;
 }
 
 void Aws::freeRequest(IAwsRequest* request)
 {
+	std::lock_guard<std::mutex> autolock(_requestsMutex);
+
 	auto it = _requests.find(request);
 	if (it != _requests.end())
 	{
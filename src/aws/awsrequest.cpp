@@ -1,5 +1,6 @@
 #include "aws/awsrequest.h"
 #include "aws/aws.h"
+#include "bandwidthlimiter.h"
 #include "validation.h"
 #include "logger.h"
 
@@ -26,6 +27,9 @@
 
 namespace
 {
+	// An upload waiting on the bandwidth limit checks for a cancel this often
+	const uint32_t kBandwidthWaitMs = 100;
+
 	std::string Base64Encode(const uint8_t* data, uint32_t dataSize)
 	{
 		uint32_t approximateBufferSize = ((dataSize * 4) / 3) + (dataSize / 96) + 6;
@@ -435,10 +439,28 @@ int32_t AwsRequest::onRequest(char *buffer, size_t size, size_t nitems)
 	uint32_t bufferSize = 0;
 	if (_currentReadData)
 	{
-		bufferSize = std::min(size*nitems,
-			static_cast<size_t>(_currentReadData->dataSize));
+		bufferSize = static_cast<uint32_t>(std::min<uint64_t>(size*nitems,
+			_currentReadData->dataSize - _transferredData));
+
+		// Every upload in the process shares the bandwidth limit, so curl may be
+		// handed less than it asked for
+		if (bufferSize > 0)
+		{
+			uint64_t granted = 0;
+			while (granted == 0)
+			{
+				if (_cancel)
+				{
+					return CURL_READFUNC_ABORT;
+				}
+
+				granted = BandwidthLimiter::get().take(bufferSize, kBandwidthWaitMs);
+			}
+
+			bufferSize = static_cast<uint32_t>(granted);
+		}
 
-		memcpy(buffer + _transferredData, _currentReadData->data, bufferSize);
+		memcpy(buffer, _currentReadData->data + _transferredData, bufferSize);
 		_transferredData += bufferSize;
 	}
 
@@ -0,0 +1,202 @@
+#include "bandwidthlimiter.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <sstream>
+#include <thread>
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	// The bucket holds this much of a second's worth of tokens, and never less
+	// than a curl buffer's worth so a whole read can be granted at once
+	const double kBurstSeconds = 0.25;
+	const double kMinBurstBytes = 16 * 1024;
+
+	// Waiting takes are only woken for a chunk at least this big, or what they
+	// asked for if less, rather than for every byte
+	const double kMinGrantBytes = 1024;
+
+	// How often the schedule is checked against the clock
+	const std::chrono::seconds kScheduleCheckInterval(1);
+
+	const uint64_t kBytesPerKilobyte = 1024;
+}
+
+bool BandwidthSchedule::parse(const std::string& schedule)
+{
+	std::vector<Window> windows;
+
+	std::stringstream stream(schedule);
+	std::string entry;
+	while (std::getline(stream, entry, ','))
+	{
+		if (entry.find_first_not_of(" \t") == std::string::npos)
+			continue;
+
+		unsigned int startHour, startMinute, endHour, endMinute;
+		unsigned long long kilobytesPerSecond;
+		char trailing;
+		int fields = sscanf(entry.c_str(), " %u:%u - %u:%u = %llu %c", &startHour, &startMinute,
+			&endHour, &endMinute, &kilobytesPerSecond, &trailing);
+
+		VALIDATE(fields == 5 && startHour < 24 && startMinute < 60 && endHour < 24 && endMinute < 60,
+			"Invalid bandwidth schedule entry '%s'", entry.c_str());
+
+		Window window;
+		window.startMinute = startHour * 60 + startMinute;
+		window.endMinute = endHour * 60 + endMinute;
+		window.bytesPerSecond = kilobytesPerSecond * kBytesPerKilobyte;
+		windows.push_back(window);
+	}
+
+	_windows.swap(windows);
+	return true;
+}
+
+bool BandwidthSchedule::empty() const
+{
+	return _windows.empty();
+}
+
+uint64_t BandwidthSchedule::bytesPerSecondAt(uint32_t minuteOfDay, uint64_t defaultBytesPerSecond) const
+{
+	for (const Window& window : _windows)
+	{
+		// A window which ends where it starts covers the whole day
+		bool contains = window.startMinute < window.endMinute ?
+			minuteOfDay >= window.startMinute && minuteOfDay < window.endMinute :
+			minuteOfDay >= window.startMinute || minuteOfDay < window.endMinute;
+
+		if (contains)
+			return window.bytesPerSecond;
+	}
+
+	return defaultBytesPerSecond;
+}
+
+BandwidthLimiter::BandwidthLimiter() : _defaultBytesPerSecond(0), _scheduleCheckedAt(Clock::now()),
+	_bytesPerSecond(0), _tokens(0.0), _refilledAt(Clock::now())
+{
+}
+
+BandwidthLimiter& BandwidthLimiter::get()
+{
+	static BandwidthLimiter limiter;
+	return limiter;
+}
+
+void BandwidthLimiter::setRate(uint64_t bytesPerSecond)
+{
+	setSchedule(BandwidthSchedule(), bytesPerSecond);
+}
+
+void BandwidthLimiter::setSchedule(const BandwidthSchedule& schedule, uint64_t defaultBytesPerSecond)
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	_schedule = schedule;
+	_defaultBytesPerSecond = defaultBytesPerSecond;
+
+	Clock::time_point now = Clock::now();
+	refill(now);
+	applySchedule(now);
+}
+
+uint64_t BandwidthLimiter::currentRate()
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	Clock::time_point now = Clock::now();
+	if (now - _scheduleCheckedAt >= kScheduleCheckInterval)
+		applySchedule(now);
+
+	return _bytesPerSecond;
+}
+
+uint64_t BandwidthLimiter::take(uint64_t wanted, uint32_t maxWaitMs)
+{
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(maxWaitMs);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		Clock::time_point now = Clock::now();
+		if (now - _scheduleCheckedAt >= kScheduleCheckInterval)
+			applySchedule(now);
+
+		refill(now);
+
+		if (_bytesPerSecond == 0)
+			return wanted;
+
+		double worthGranting = std::min<double>(static_cast<double>(wanted), kMinGrantBytes);
+		if (_tokens >= worthGranting)
+		{
+			uint64_t granted = std::min<uint64_t>(wanted, static_cast<uint64_t>(_tokens));
+			_tokens -= granted;
+			return granted;
+		}
+
+		if (now >= deadline)
+			return 0;
+
+		// Sleep until there's enough, rather than polling, and let other uploads
+		// take what comes in meanwhile
+		std::chrono::duration<double> untilEnough((worthGranting - _tokens) / _bytesPerSecond);
+		Clock::duration wait = std::min<Clock::duration>(
+			std::chrono::duration_cast<Clock::duration>(untilEnough), deadline - now);
+
+		lock.unlock();
+		std::this_thread::sleep_for(wait);
+		lock.lock();
+	}
+}
+
+void BandwidthLimiter::refill(Clock::time_point now)
+{
+	if (_bytesPerSecond > 0)
+	{
+		double elapsedSeconds = std::chrono::duration<double>(now - _refilledAt).count();
+		double burstBytes = std::max(_bytesPerSecond * kBurstSeconds, kMinBurstBytes);
+
+		_tokens = std::min(burstBytes, _tokens + elapsedSeconds * _bytesPerSecond);
+	}
+
+	_refilledAt = now;
+}
+
+void BandwidthLimiter::applySchedule(Clock::time_point now)
+{
+	_scheduleCheckedAt = now;
+
+	time_t currentTime = time(nullptr);
+	struct tm localTime;
+	localtime_r(&currentTime, &localTime);
+
+	uint32_t minuteOfDay = static_cast<uint32_t>(localTime.tm_hour * 60 + localTime.tm_min);
+	uint64_t bytesPerSecond = _schedule.bytesPerSecondAt(minuteOfDay, _defaultBytesPerSecond);
+	if (bytesPerSecond == _bytesPerSecond)
+		return;
+
+	if (bytesPerSecond == 0)
+	{
+		Logger::get().log(Logger::INFO, "Upload bandwidth unlimited");
+	}
+	else
+	{
+		Logger::get().log(Logger::INFO, "Upload bandwidth limited to %llu KB/s",
+			static_cast<unsigned long long>(bytesPerSecond / kBytesPerKilobyte));
+	}
+
+	// A lower limit shouldn't inherit a higher one's burst
+	_bytesPerSecond = bytesPerSecond;
+	_tokens = std::min(_tokens, std::max(_bytesPerSecond * kBurstSeconds, kMinBurstBytes));
+}
+} // lib
+} // enlighten
@@ -1,9 +1,12 @@
 #include "cachedpreviews.h"
+#include "sqlitestatement.h"
 #include "settings.h"
 #include "validation.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <chrono>
+#include <utility>
 
 #include "sqlite3.h"
 
@@ -11,6 +14,67 @@ namespace enlighten
 {
 namespace lib
 {
+namespace
+{
+	// Steps through PreviewsCache by its primary key, so nothing is copied or
+	// sorted however big the cache is. Uuids are written in upper case, which
+	// makes the key's order the same as Uuid's ordering.
+	class CachedUuidCursor : public ICachedUuidCursor
+	{
+	public:
+		CachedUuidCursor(SqliteStatement&& statement) : _statement(std::move(statement))
+		{
+		}
+
+		bool next(uuid_t& uuid, std::string& digest)
+		{
+			int stepResult;
+			while ((stepResult = _statement.step()) == SQLITE_ROW)
+			{
+				if (!_statement.columnUuid(0, uuid))
+					continue;
+
+				// NULL for previews cached before digests were recorded
+				const char* text = _statement.columnText(1);
+				digest.assign(text ? text : "");
+
+				return true;
+			}
+
+			if (stepResult != SQLITE_DONE)
+			{
+				Logger::get().log(Logger::ERROR, "Failed to read PreviewsCache. Reason: %s",
+					sqlite3_errstr(stepResult));
+			}
+
+			return false;
+		}
+
+	private:
+		SqliteStatement _statement;
+	};
+
+	// Applied to every connection. WAL lets the watcher read the cache while
+	// uploads are being recorded, and at synchronous=NORMAL a power cut can
+	// only lose the last few markAsCached calls, which are simply re-uploaded.
+	const char* kConnectionPragmas[] = {
+		"PRAGMA journal_mode=WAL",
+		"PRAGMA synchronous=NORMAL",
+		"PRAGMA cache_size=-4096",		// KiB
+		"PRAGMA mmap_size=67108864"
+	};
+}
+
+const CachedPreviews::Migration CachedPreviews::kMigrations[] = {
+	{ 1, &CachedPreviews::migrateToDigestColumn },
+	{ 2, &CachedPreviews::migrateToUuidPrimaryKey },
+	{ 3, &CachedPreviews::migrateToJobJournal },
+	{ 4, &CachedPreviews::migrateToJobRetryTimes },
+	{ 5, &CachedPreviews::migrateToJobDigests }
+};
+
+const int CachedPreviews::kSchemaVersion = 5;
+
 CachedPreviews::CachedPreviews(IEnlightenSettings* settings) : _sqliteDatabase(nullptr),
 	_settings(settings)
 {
@@ -18,6 +82,15 @@ CachedPreviews::CachedPreviews(IEnlightenSettings* settings) : _sqliteDatabase(n
 
 CachedPreviews::~CachedPreviews()
 {
+	// Statements have to go before the connection will close
+	_insertStatement.finalize();
+	_deleteStatement.finalize();
+	_journalStatement.finalize();
+	_journalResetStatement.finalize();
+	_jobStateStatement.finalize();
+	_jobFailedStatement.finalize();
+	_jobDeferredStatement.finalize();
+
 	if (_sqliteDatabase)
 		sqlite3_close(_sqliteDatabase);
 }
@@ -28,64 +101,324 @@ bool CachedPreviews::loadOrCreateDatabase()
 	filePath += databaseFileName();
 
 	int dbOpenResult = sqlite3_open_v2(filePath.c_str(), &_sqliteDatabase,
-		SQLITE_OPEN_READWRITE, NULL);
+		SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
 
-	if (dbOpenResult != SQLITE_OK)
-		return createCachedPreviewsDatabase(filePath);
+	VALIDATE(dbOpenResult == SQLITE_OK, "Failed to open '%s'. Reason: %s",
+		filePath.c_str(), sqlite3_errstr(dbOpenResult));
+
+	return configureConnection() && migrateSchema() && loadIndex() &&
+		_insertStatement.prepare(_sqliteDatabase,
+			"INSERT OR REPLACE INTO PreviewsCache (uuid,digest) VALUES (?,?)") &&
+		_deleteStatement.prepare(_sqliteDatabase, "DELETE FROM PreviewsCache WHERE uuid=?") &&
+		_journalStatement.prepare(_sqliteDatabase,
+			"INSERT OR IGNORE INTO SyncJobs (uuid,action,state,retries,digest) VALUES (?1,?2,?3,0,?4)") &&
+		_journalResetStatement.prepare(_sqliteDatabase,
+			"UPDATE SyncJobs SET action=?2,state=?3,retries=0,retryAt=0,digest=?5 "
+				"WHERE uuid=?1 AND (action!=?2 OR state=?4 OR digest!=?5)") &&
+		_jobStateStatement.prepare(_sqliteDatabase, "UPDATE SyncJobs SET state=?2 WHERE uuid=?1") &&
+		_jobFailedStatement.prepare(_sqliteDatabase,
+			"UPDATE SyncJobs SET state=?2,retryAt=?3,retries=retries+1 WHERE uuid=?1") &&
+		_jobDeferredStatement.prepare(_sqliteDatabase,
+			"UPDATE SyncJobs SET state=?2,retryAt=?3 WHERE uuid=?1");
+}
 
-	return true;
+int CachedPreviews::schemaVersion() const
+{
+	VALIDATE_AND_RETURN(-1, _sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK_AND_RETURN(-1, statement.prepare(_sqliteDatabase, "PRAGMA user_version"));
+
+	if (statement.step() != SQLITE_ROW)
+		return -1;
+
+	return statement.columnInt(0);
 }
 
 uint32_t CachedPreviews::numberOfCachedPreviews() const
 {
-	int numberOfRows = 0;
-
 	VALIDATE_AND_RETURN(0, _sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	sqlite3_stmt* statement = nullptr;
-	const char* query = "SELECT COUNT(*) FROM PreviewsCache";
-	int statementResult = sqlite3_prepare_v2(_sqliteDatabase, query, -1, &statement,
-		NULL);
+	return _index.numberOfEntries();
+}
 
-	VALIDATE_AND_RETURN(0, statementResult == SQLITE_OK, "Statement '%s' error. Reason: %s",
-		query, sqlite3_errmsg(_sqliteDatabase));
+bool CachedPreviews::isInCache(const uuid_t& uuid) const
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	if (sqlite3_step(statement) == SQLITE_ROW)
-		numberOfRows = sqlite3_column_int(statement, 0);
+	return _index.contains(uuid);
+}
 
-	sqlite3_finalize(statement);
+bool CachedPreviews::digestForUuid(const uuid_t& uuid, std::string& digest) const
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	return numberOfRows;
+	return _index.digestForUuid(uuid, digest);
 }
 
-bool CachedPreviews::isInCache(const uuid_t& uuid) const
+bool CachedPreviews::markAsCached(const uuid_t& uuid, const std::string& digest)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	// A uuid is only ever cached against the digest that was last uploaded
+	CHECK(executeUpdate(_insertStatement, uuid, &digest));
+
+	_index.insert(uuid, digest);
+	return true;
+}
+
+bool CachedPreviews::removeFromCache(const uuid_t& uuid)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	CHECK(executeUpdate(_deleteStatement, uuid));
+
+	_index.remove(uuid);
+	return true;
+}
+
+bool CachedPreviews::applyUpdates(const std::vector<CachedPreviewUpdate>& updates)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	if (updates.empty())
+		return true;
+
+	// One transaction, and so one sync, for the whole batch
+	sqlite3_exec(_sqliteDatabase, "BEGIN", NULL, NULL, NULL);
+
+	bool applied = true;
+	for (const CachedPreviewUpdate& update : updates)
+	{
+		applied = update.action == SyncAction_Remove ?
+			executeUpdate(_deleteStatement, update.uuid) :
+			executeUpdate(_insertStatement, update.uuid, &update.digest);
+
+		// Done only once the result is recorded
+		applied = applied && updateJobState(_jobStateStatement, update.uuid, SyncJobState_Done);
+
+		if (!applied)
+			break;
+	}
+
+	if (applied)
+		applied = sqlite3_exec(_sqliteDatabase, "COMMIT", NULL, NULL, NULL) == SQLITE_OK;
+
+	if (!applied)
+	{
+		sqlite3_exec(_sqliteDatabase, "ROLLBACK", NULL, NULL, NULL);
+		return false;
+	}
+
+	for (const CachedPreviewUpdate& update : updates)
+	{
+		if (update.action == SyncAction_Remove)
+			_index.remove(update.uuid);
+		else
+			_index.insert(update.uuid, update.digest);
+	}
+
+	return true;
+}
+
+bool CachedPreviews::journalJobs(const std::map<uuid_t, SyncAction>& jobs,
+	const std::map<uuid_t, std::string>& digests)
 {
 	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	const char* queryFormat = "SELECT uuid FROM PreviewsCache WHERE "
-                               "uuid='%s'";
+	if (jobs.empty())
+		return true;
+
+	// A job diffed again with a different action or digest, or after it was
+	// done, starts over; a preview rewritten since it failed is worth another
+	// go even if it was dead lettered. Otherwise it keeps its retries and
+	// backoff, so a full diff doesn't hand failing jobs straight back.
+	sqlite3_exec(_sqliteDatabase, "BEGIN", NULL, NULL, NULL);
+
+	const std::string noDigest;
+
+	int stepResult = SQLITE_DONE;
+	for (const auto& job : jobs)
+	{
+		auto digest = digests.find(job.first);
+		const std::string& jobDigest = digest != digests.end() ? digest->second : noDigest;
+
+		_journalStatement.bindUuid(1, job.first);
+		_journalStatement.bindInt64(2, job.second);
+		_journalStatement.bindInt64(3, SyncJobState_Pending);
+		_journalStatement.bindText(4, jobDigest);
+
+		stepResult = _journalStatement.step();
+		_journalStatement.reset();
+
+		if (stepResult != SQLITE_DONE)
+			break;
+
+		_journalResetStatement.bindUuid(1, job.first);
+		_journalResetStatement.bindInt64(2, job.second);
+		_journalResetStatement.bindInt64(3, SyncJobState_Pending);
+		_journalResetStatement.bindInt64(4, SyncJobState_Done);
+		_journalResetStatement.bindText(5, jobDigest);
+
+		stepResult = _journalResetStatement.step();
+		_journalResetStatement.reset();
 
-	char query[128];
-	int written = snprintf(query, 128, queryFormat, uuid.c_str());
-	VALIDATE(written < 128, "Buffer overflow");
+		if (stepResult != SQLITE_DONE)
+			break;
+	}
 
-	VALIDATE(executeAndCheckQuery(query, SQLITE_ROW), "Sql result != SQLITE_DONE");
+	if (stepResult != SQLITE_DONE ||
+		sqlite3_exec(_sqliteDatabase, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		sqlite3_exec(_sqliteDatabase, "ROLLBACK", NULL, NULL, NULL);
+
+		Logger::get().log(Logger::ERROR, "Failed to journal %u jobs. Reason: %s",
+			static_cast<uint32_t>(jobs.size()), sqlite3_errmsg(_sqliteDatabase));
+		return false;
+	}
 
 	return true;
 }
 
-bool CachedPreviews::markAsCached(const uuid_t& uuid)
+bool CachedPreviews::markJobInFlight(const uuid_t& uuid)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	return updateJobState(_jobStateStatement, uuid, SyncJobState_InFlight);
+}
+
+bool CachedPreviews::markJobFailed(const uuid_t& uuid, int64_t retryAt)
 {
 	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	const char* queryFormat = "INSERT INTO PreviewsCache (uuid) VALUES "
-                               "('%s')";
+	return updateJobState(_jobFailedStatement, uuid, SyncJobState_Failed, &retryAt);
+}
 
-	char query[128];
-	int written = snprintf(query, 128, queryFormat, uuid.c_str());
-	VALIDATE(written < 128, "Buffer overflow");
+bool CachedPreviews::markJobDeadLettered(const uuid_t& uuid)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	VALIDATE(executeAndCheckQuery(query, SQLITE_DONE), "Sql result != SQLITE_DONE");
+	return updateJobState(_jobStateStatement, uuid, SyncJobState_DeadLettered);
+}
+
+bool CachedPreviews::deferJob(const uuid_t& uuid, int64_t retryAt)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	// Put off without having been tried, so it doesn't count as a retry
+	return updateJobState(_jobDeferredStatement, uuid, SyncJobState_Pending, &retryAt);
+}
+
+bool CachedPreviews::jobForUuid(const uuid_t& uuid, SyncJob& job) const
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase,
+		"SELECT uuid,action,state,retries,retryAt,digest FROM SyncJobs WHERE uuid=?"));
+	statement.bindUuid(1, uuid);
+
+	if (statement.step() != SQLITE_ROW)
+		return false;
+
+	job.uuid = uuid;
+	job.action = static_cast<SyncAction>(statement.columnInt(1));
+	job.state = static_cast<SyncJobState>(statement.columnInt(2));
+	job.retries = static_cast<uint32_t>(statement.columnInt(3));
+	job.retryAt = statement.columnInt64(4);
+	job.digest = statement.columnString(5);
+
+	return true;
+}
+
+bool CachedPreviews::unfinishedJobs(std::vector<SyncJob>& jobs) const
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase, "SELECT uuid,action,state,retries,retryAt,digest "
+		"FROM SyncJobs WHERE state IN (?,?,?)"));
+	statement.bindInt64(1, SyncJobState_Pending);
+	statement.bindInt64(2, SyncJobState_InFlight);
+	statement.bindInt64(3, SyncJobState_Failed);
+
+	return selectJobs(statement, jobs);
+}
+
+bool CachedPreviews::dueJobs(int64_t now, std::vector<SyncJob>& jobs) const
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase, "SELECT uuid,action,state,retries,retryAt,digest "
+		"FROM SyncJobs WHERE state IN (?,?,?) AND retryAt<=?"));
+	statement.bindInt64(1, SyncJobState_Pending);
+	statement.bindInt64(2, SyncJobState_InFlight);
+	statement.bindInt64(3, SyncJobState_Failed);
+	statement.bindInt64(4, now);
+
+	return selectJobs(statement, jobs);
+}
+
+bool CachedPreviews::deadLetteredJobs(std::vector<SyncJob>& jobs) const
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase, "SELECT uuid,action,state,retries,retryAt,digest "
+		"FROM SyncJobs WHERE state=?"));
+	statement.bindInt64(1, SyncJobState_DeadLettered);
+
+	return selectJobs(statement, jobs);
+}
+
+bool CachedPreviews::earliestRetry(int64_t& retryAt) const
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase,
+		"SELECT MIN(retryAt) FROM SyncJobs WHERE state IN (?,?,?)"));
+	statement.bindInt64(1, SyncJobState_Pending);
+	statement.bindInt64(2, SyncJobState_InFlight);
+	statement.bindInt64(3, SyncJobState_Failed);
+
+	// MIN over no rows is NULL
+	if (statement.step() != SQLITE_ROW || statement.columnText(0) == nullptr)
+		return false;
+
+	retryAt = statement.columnInt64(0);
+	return true;
+}
+
+bool CachedPreviews::requeueDeadLetteredJobs()
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase,
+		"UPDATE SyncJobs SET state=?,retries=0,retryAt=0 WHERE state=?"));
+	statement.bindInt64(1, SyncJobState_Pending);
+	statement.bindInt64(2, SyncJobState_DeadLettered);
+
+	int stepResult = statement.step();
+	VALIDATE(stepResult == SQLITE_DONE, "Failed to requeue SyncJobs. Reason: %s",
+		sqlite3_errstr(stepResult));
+
+	return true;
+}
+
+bool CachedPreviews::purgeFinishedJobs()
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase, "DELETE FROM SyncJobs WHERE state=?"));
+	statement.bindInt64(1, SyncJobState_Done);
+
+	int stepResult = statement.step();
+	VALIDATE(stepResult == SQLITE_DONE, "Failed to purge SyncJobs. Reason: %s",
+		sqlite3_errstr(stepResult));
 
 	return true;
 }
@@ -97,50 +430,223 @@ bool CachedPreviews::generateProxy(std::set<uuid_t>& entries) const
 
 	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	const char* query = "SELECT uuid FROM PreviewsCache";
+	_index.copyUuids(entries);
 
-	sqlite3_stmt* statement = nullptr;
-	int statementResult = sqlite3_prepare_v2(_sqliteDatabase, query, -1, &statement,
-		NULL);
+	return true;
+}
+
+ICachedUuidCursor* CachedPreviews::createOrderedCursor() const
+{
+	VALIDATE_AND_RETURN(nullptr, _sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	VALIDATE_AND_RETURN(nullptr, statement.prepare(_sqliteDatabase,
+		"SELECT uuid,digest FROM PreviewsCache ORDER BY uuid"), "Failed to read PreviewsCache");
+
+	return new CachedUuidCursor(std::move(statement));
+}
 
-	VALIDATE_AND_RETURN(nullptr, statementResult == SQLITE_OK, "Statement '%s' error. Reason: %s",
-		query, sqlite3_errmsg(_sqliteDatabase));
+bool CachedPreviews::loadIndex()
+{
+	// The only full read of PreviewsCache; every lookup after this is served
+	// from memory and writes keep the index in step.
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase, "SELECT uuid,digest FROM PreviewsCache"));
+
+	_index.clear();
 
-	while (sqlite3_step(statement) == SQLITE_ROW)
+	int stepResult;
+	while ((stepResult = statement.step()) == SQLITE_ROW)
 	{
-		const char* uuidStr = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
-		entries.insert(uuidStr);
+		uuid_t uuid;
+		if (statement.columnUuid(0, uuid))
+			_index.insert(uuid, statement.columnString(1));
 	}
 
+	VALIDATE(stepResult == SQLITE_DONE, "Failed to read PreviewsCache. Reason: %s",
+		sqlite3_errstr(stepResult));
+
+	Logger::get().log(Logger::INFO, "Loaded %u cached previews", _index.numberOfEntries());
+
 	return true;
 }
 
-bool CachedPreviews::createCachedPreviewsDatabase(const std::string& filePath)
+bool CachedPreviews::configureConnection()
 {
-	int dbOpenResult = sqlite3_open_v2(filePath.c_str(), &_sqliteDatabase,
-		SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	for (const char* pragma : kConnectionPragmas)
+	{
+		int execResult = sqlite3_exec(_sqliteDatabase, pragma, NULL, NULL, NULL);
+		VALIDATE(execResult == SQLITE_OK, "'%s' failed. Reason: %s", pragma,
+			sqlite3_errmsg(_sqliteDatabase));
+	}
 
-	if (dbOpenResult != SQLITE_OK)
-		return false;
+	return true;
+}
+
+bool CachedPreviews::migrateSchema()
+{
+	int version = schemaVersion();
+
+	VALIDATE(version >= 0, "Failed to read the PreviewsCache schema version");
+	VALIDATE(version <= kSchemaVersion, "PreviewsCache schema version %d is newer than %d",
+		version, kSchemaVersion);
+
+	for (const Migration& migration : kMigrations)
+	{
+		if (migration.version <= version)
+			continue;
+
+		// Each step commits together with its version number, so an interrupted
+		// migration resumes from the last completed step on the next launch.
+		sqlite3_exec(_sqliteDatabase, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+
+		std::string setVersion = "PRAGMA user_version=" + std::to_string(migration.version);
+		bool migrated = (this->*migration.step)() &&
+			sqlite3_exec(_sqliteDatabase, setVersion.c_str(), NULL, NULL, NULL) == SQLITE_OK;
+
+		sqlite3_exec(_sqliteDatabase, migrated ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+
+		VALIDATE(migrated, "Failed to migrate PreviewsCache to schema version %d. Reason: %s",
+			migration.version, sqlite3_errmsg(_sqliteDatabase));
 
-	return executeAndCheckQuery("CREATE TABLE PreviewsCache(uuid TEXT NOT NULL)", SQLITE_DONE);
+		Logger::get().log(Logger::INFO, "Migrated PreviewsCache to schema version %d",
+			migration.version);
+	}
+
+	return true;
 }
 
-bool CachedPreviews::executeAndCheckQuery(const char* query, int expectedResult) const
+bool CachedPreviews::migrateToDigestColumn()
 {
-	CHECK(_sqliteDatabase);
+	// Unversioned caches have either the original uuid-only table or one that
+	// already gained its digest column
+	return executeAndCheckQuery("CREATE TABLE IF NOT EXISTS PreviewsCache(uuid TEXT NOT NULL)",
+		SQLITE_DONE) && addDigestColumnIfMissing();
+}
+
+bool CachedPreviews::migrateToUuidPrimaryKey()
+{
+	// Rows are copied in insertion order so the most recent digest wins when
+	// an old cache recorded a uuid more than once
+	const char* query =
+		"CREATE TABLE PreviewsCache_v2(uuid TEXT PRIMARY KEY NOT NULL, digest TEXT) WITHOUT ROWID;"
+		"INSERT OR REPLACE INTO PreviewsCache_v2 (uuid,digest) "
+			"SELECT upper(uuid),digest FROM PreviewsCache ORDER BY rowid;"
+		"DROP TABLE PreviewsCache;"
+		"ALTER TABLE PreviewsCache_v2 RENAME TO PreviewsCache";
+
+	int execResult = sqlite3_exec(_sqliteDatabase, query, NULL, NULL, NULL);
+	VALIDATE(execResult == SQLITE_OK, "Rebuilding PreviewsCache failed. Reason: %s",
+		sqlite3_errmsg(_sqliteDatabase));
 
-	sqlite3_stmt* statement = nullptr;
-	int statementResult = sqlite3_prepare_v2(_sqliteDatabase, query, -1, &statement,
-		NULL);
+	return true;
+}
 
-	VALIDATE_AND_RETURN(nullptr, statementResult == SQLITE_OK, "Statement '%s' error. Reason: %s",
-		query, sqlite3_errmsg(_sqliteDatabase));
+bool CachedPreviews::migrateToJobJournal()
+{
+	return executeAndCheckQuery("CREATE TABLE SyncJobs(uuid TEXT PRIMARY KEY NOT NULL, "
+		"action INTEGER NOT NULL, state INTEGER NOT NULL, retries INTEGER NOT NULL) WITHOUT ROWID",
+		SQLITE_DONE);
+}
 
-	if (sqlite3_step(statement) == expectedResult)
+bool CachedPreviews::migrateToJobRetryTimes()
+{
+	return executeAndCheckQuery("ALTER TABLE SyncJobs ADD COLUMN retryAt INTEGER NOT NULL DEFAULT 0",
+		SQLITE_DONE);
+}
+
+bool CachedPreviews::migrateToJobDigests()
+{
+	return executeAndCheckQuery("ALTER TABLE SyncJobs ADD COLUMN digest TEXT NOT NULL DEFAULT ''",
+		SQLITE_DONE);
+}
+
+bool CachedPreviews::addDigestColumnIfMissing()
+{
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase, "PRAGMA table_info(PreviewsCache)"));
+
+	bool hasDigestColumn = false;
+	while (statement.step() == SQLITE_ROW)
+	{
+		if (statement.columnString(1) == "digest")
+			hasDigestColumn = true;
+	}
+
+	if (hasDigestColumn)
 		return true;
 
-	return false;
+	Logger::get().log(Logger::INFO, "Adding digest column to PreviewsCache");
+	return executeAndCheckQuery("ALTER TABLE PreviewsCache ADD COLUMN digest TEXT", SQLITE_DONE);
+}
+
+bool CachedPreviews::executeUpdate(SqliteStatement& statement, const uuid_t& uuid,
+	const std::string* digest)
+{
+	statement.bindUuid(1, uuid);
+
+	// Unknown digests are stored as NULL
+	if (digest && !digest->empty())
+		statement.bindText(2, *digest);
+
+	int stepResult = statement.step();
+	statement.reset();
+
+	VALIDATE(stepResult == SQLITE_DONE, "Statement '%s' failed. Reason: %s",
+		statement.query(), sqlite3_errstr(stepResult));
+
+	return true;
+}
+
+bool CachedPreviews::updateJobState(SqliteStatement& statement, const uuid_t& uuid,
+	SyncJobState state, const int64_t* retryAt)
+{
+	statement.bindUuid(1, uuid);
+	statement.bindInt64(2, state);
+
+	if (retryAt)
+		statement.bindInt64(3, *retryAt);
+
+	int stepResult = statement.step();
+	statement.reset();
+
+	VALIDATE(stepResult == SQLITE_DONE, "Statement '%s' failed. Reason: %s",
+		statement.query(), sqlite3_errstr(stepResult));
+
+	return true;
+}
+
+bool CachedPreviews::selectJobs(SqliteStatement& statement, std::vector<SyncJob>& jobs) const
+{
+	int stepResult;
+	while ((stepResult = statement.step()) == SQLITE_ROW)
+	{
+		SyncJob job;
+		if (!statement.columnUuid(0, job.uuid))
+			continue;
+
+		job.action = static_cast<SyncAction>(statement.columnInt(1));
+		job.state = static_cast<SyncJobState>(statement.columnInt(2));
+		job.retries = static_cast<uint32_t>(statement.columnInt(3));
+		job.retryAt = statement.columnInt64(4);
+		job.digest = statement.columnString(5);
+		jobs.push_back(job);
+	}
+
+	VALIDATE(stepResult == SQLITE_DONE, "Failed to read SyncJobs. Reason: %s",
+		sqlite3_errstr(stepResult));
+
+	return true;
+}
+
+bool CachedPreviews::executeAndCheckQuery(const char* query, int expectedResult) const
+{
+	CHECK(_sqliteDatabase);
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(_sqliteDatabase, query));
+
+	return statement.step() == expectedResult;
 }
 
 std::string CachedPreviews::databaseFileName()
@@ -0,0 +1,136 @@
+#include "cachedpreviewsindex.h"
+
+#include <algorithm>
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	// Around 1% false positives at capacity
+	const uint32_t kFilterBitsPerEntry = 10;
+	const uint32_t kFilterHashes = 7;
+	const uint32_t kMinimumFilterCapacity = 1024;
+
+	// Two halves of one well mixed hash, combined as h1 + i * h2
+	void filterHashes(const uuid_t& uuid, uint64_t& h1, uint64_t& h2)
+	{
+		uint64_t hash = static_cast<uint64_t>(uuid.hash()) * 0xFF51AFD7ED558CCDull;
+		h1 = hash & 0xFFFFFFFFull;
+		h2 = (hash >> 32) | 1;
+	}
+}
+
+CachedPreviewsIndex::CachedPreviewsIndex() : _filterMask(0), _filterCapacity(0)
+{
+	rebuildFilter(kMinimumFilterCapacity);
+}
+
+void CachedPreviewsIndex::insert(const uuid_t& uuid, const std::string& digest)
+{
+	auto result = _digests.insert(std::make_pair(uuid, digest));
+	if (!result.second)
+	{
+		result.first->second = digest;
+		return;
+	}
+
+	if (_digests.size() > _filterCapacity)
+		rebuildFilter(_filterCapacity * 2);
+	else
+		addToFilter(uuid);
+}
+
+void CachedPreviewsIndex::remove(const uuid_t& uuid)
+{
+	_digests.erase(uuid);
+}
+
+void CachedPreviewsIndex::clear()
+{
+	_digests.clear();
+	rebuildFilter(kMinimumFilterCapacity);
+}
+
+void CachedPreviewsIndex::reserve(uint32_t numberOfEntries)
+{
+	_digests.reserve(numberOfEntries);
+
+	if (numberOfEntries > _filterCapacity)
+		rebuildFilter(numberOfEntries);
+}
+
+bool CachedPreviewsIndex::contains(const uuid_t& uuid) const
+{
+	return mightContain(uuid) && _digests.count(uuid) > 0;
+}
+
+bool CachedPreviewsIndex::digestForUuid(const uuid_t& uuid, std::string& digest) const
+{
+	if (!mightContain(uuid))
+		return false;
+
+	auto it = _digests.find(uuid);
+	if (it == _digests.end())
+		return false;
+
+	digest = it->second;
+	return true;
+}
+
+uint32_t CachedPreviewsIndex::numberOfEntries() const
+{
+	return static_cast<uint32_t>(_digests.size());
+}
+
+void CachedPreviewsIndex::copyUuids(std::set<uuid_t>& uuids) const
+{
+	for (const auto& entry : _digests)
+		uuids.insert(entry.first);
+}
+
+bool CachedPreviewsIndex::mightContain(const uuid_t& uuid) const
+{
+	uint64_t h1, h2;
+	filterHashes(uuid, h1, h2);
+
+	for (uint32_t i = 0; i < kFilterHashes; ++i)
+	{
+		uint64_t bit = (h1 + i * h2) & _filterMask;
+		if (!(_filter[bit >> 6] & (1ull << (bit & 63))))
+			return false;
+	}
+
+	return true;
+}
+
+void CachedPreviewsIndex::addToFilter(const uuid_t& uuid)
+{
+	uint64_t h1, h2;
+	filterHashes(uuid, h1, h2);
+
+	for (uint32_t i = 0; i < kFilterHashes; ++i)
+	{
+		uint64_t bit = (h1 + i * h2) & _filterMask;
+		_filter[bit >> 6] |= 1ull << (bit & 63);
+	}
+}
+
+void CachedPreviewsIndex::rebuildFilter(uint32_t capacity)
+{
+	_filterCapacity = std::max(capacity, kMinimumFilterCapacity);
+
+	// Power of two bit counts so positions are a mask away
+	uint64_t numberOfBits = 64;
+	while (numberOfBits < static_cast<uint64_t>(_filterCapacity) * kFilterBitsPerEntry)
+		numberOfBits <<= 1;
+
+	_filterMask = numberOfBits - 1;
+	_filter.assign(numberOfBits / 64, 0);
+
+	for (const auto& entry : _digests)
+		addToFilter(entry.first);
+}
+} // lib
+} // enlighten
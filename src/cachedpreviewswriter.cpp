@@ -0,0 +1,63 @@
+#include "cachedpreviewswriter.h"
+#include "logger.h"
+#include "validation.h"
+
+namespace enlighten
+{
+namespace lib
+{
+const uint32_t CachedPreviewsWriter::kDefaultBatchSize = 64;
+const uint32_t CachedPreviewsWriter::kDefaultMaxDelayMs = 2000;
+
+CachedPreviewsWriter::CachedPreviewsWriter(ICachedPreviews* cachedPreviews,
+	uint32_t batchSize, uint32_t maxDelayMs) : _cachedPreviews(cachedPreviews),
+	_batchSize(batchSize > 0 ? batchSize : 1), _maxDelay(maxDelayMs)
+{
+	_pendingUpdates.reserve(_batchSize);
+}
+
+CachedPreviewsWriter::~CachedPreviewsWriter()
+{
+	flush();
+}
+
+bool CachedPreviewsWriter::add(const uuid_t& uuid, SyncAction action, const std::string& digest)
+{
+	auto now = std::chrono::steady_clock::now();
+	if (_pendingUpdates.empty())
+		_oldestPendingUpdate = now;
+
+	CachedPreviewUpdate update = { uuid, action, digest };
+	_pendingUpdates.push_back(update);
+
+	if (_pendingUpdates.size() < _batchSize && now - _oldestPendingUpdate < _maxDelay)
+		return true;
+
+	return flush();
+}
+
+bool CachedPreviewsWriter::flush()
+{
+	if (_pendingUpdates.empty())
+		return true;
+
+	CHECK(_cachedPreviews);
+
+	bool applied = _cachedPreviews->applyUpdates(_pendingUpdates);
+
+	// Whatever didn't make it is picked up by the next diff and uploaded again
+	if (!applied)
+		Logger::get().log(Logger::ERROR, "Failed to record %u cached previews",
+			static_cast<uint32_t>(_pendingUpdates.size()));
+
+	_pendingUpdates.clear();
+
+	return applied;
+}
+
+uint32_t CachedPreviewsWriter::numberOfPendingUpdates() const
+{
+	return static_cast<uint32_t>(_pendingUpdates.size());
+}
+} // lib
+} // enlighten
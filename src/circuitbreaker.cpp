@@ -0,0 +1,101 @@
+#include "circuitbreaker.h"
+#include "retrypolicy.h"
+#include "logger.h"
+
+#include <algorithm>
+
+namespace enlighten
+{
+namespace lib
+{
+std::map<std::string, std::unique_ptr<CircuitBreaker>> CircuitBreaker::_breakers;
+std::mutex CircuitBreaker::_breakersMutex;
+
+CircuitBreaker::CircuitBreaker(uint32_t failureThreshold, uint32_t coolDownMs,
+	uint32_t maxCoolDownMs) : _failureThreshold(std::max<uint32_t>(failureThreshold, 1)),
+	_initialCoolDownMs(coolDownMs), _maxCoolDownMs(std::max(coolDownMs, maxCoolDownMs)),
+	_consecutiveFailures(0), _coolDownMs(coolDownMs), _openUntil(0), _open(false),
+	_trialInFlight(false)
+{
+}
+
+CircuitBreaker& CircuitBreaker::forDestination(const std::string& destinationIdentifier)
+{
+	std::lock_guard<std::mutex> autolock(_breakersMutex);
+
+	std::unique_ptr<CircuitBreaker>& breaker = _breakers[destinationIdentifier];
+	if (!breaker)
+		breaker.reset(new CircuitBreaker());
+
+	return *breaker;
+}
+
+bool CircuitBreaker::allowRequest()
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	if (!_open)
+		return true;
+
+	// Half open: one request finds out whether the destination is back
+	if (_trialInFlight || RetryPolicy::currentTimeMs() < _openUntil)
+		return false;
+
+	_trialInFlight = true;
+	return true;
+}
+
+void CircuitBreaker::recordSuccess()
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	if (_open)
+		Logger::get().log(Logger::INFO, "Destination recovered, closing circuit breaker");
+
+	_consecutiveFailures = 0;
+	_coolDownMs = _initialCoolDownMs;
+	_open = false;
+	_trialInFlight = false;
+}
+
+void CircuitBreaker::recordFailure()
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	++_consecutiveFailures;
+
+	if (_open)
+	{
+		// Only the trial request can fail while open; it earns a longer wait
+		if (!_trialInFlight)
+			return;
+
+		_coolDownMs = static_cast<uint32_t>(std::min<uint64_t>(
+			static_cast<uint64_t>(_coolDownMs) * 2, _maxCoolDownMs));
+	}
+	else if (_consecutiveFailures < _failureThreshold)
+	{
+		return;
+	}
+
+	_open = true;
+	_trialInFlight = false;
+	_openUntil = RetryPolicy::currentTimeMs() + _coolDownMs;
+
+	Logger::get().log(Logger::WARNING, "%u requests in a row failed, pausing requests for %u ms",
+		_consecutiveFailures, _coolDownMs);
+}
+
+bool CircuitBreaker::isOpen() const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+	return _open;
+}
+
+int64_t CircuitBreaker::reopensAt() const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+	return _open ? _openUntil : 0;
+}
+} // lib
+} // enlighten
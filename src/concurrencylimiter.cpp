@@ -0,0 +1,199 @@
+#include "concurrencylimiter.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	// A window holds at least this many samples, and twice the limit when that's
+	// more, so each window sees the limit used a couple of times over
+	const uint32_t kMinWindowSamples = 10;
+
+	// More errors than this in a window halves the limit
+	const double kMaxErrorRate = 0.1;
+	const double kBackoffRatio = 0.5;
+
+	// A median latency under 1/kLatencyTolerance of the baseline is left alone,
+	// and no window shrinks the limit by more than half
+	const double kLatencyTolerance = 0.8;
+	const double kMinGradient = 0.5;
+
+	// The limit only grows while throughput keeps up with the last window.
+	// Windows shorter than this are too short to judge throughput by.
+	const double kThroughputTolerance = 0.9;
+	const double kMinThroughputWindowMs = 50.0;
+
+	// How far the baseline creeps up each window the latency stays above it
+	const double kBaselineDrift = 0.02;
+
+	double percentile(const std::vector<double>& sorted, double fraction)
+	{
+		if (sorted.empty())
+			return 0.0;
+
+		size_t index = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+		return sorted[std::min(std::max<size_t>(index, 1), sorted.size()) - 1];
+	}
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(uint32_t initialLimit, uint32_t minLimit, uint32_t maxLimit) :
+	_minLimit(std::max<uint32_t>(minLimit, 1)), _maxLimit(std::max(_minLimit, maxLimit)),
+	_limit(std::min(std::max(initialLimit, _minLimit), _maxLimit)), _inUse(0), _units(0),
+	_errors(0), _peakInUse(0), _windowStarted(Clock::now()), _baselineLatencyMs(0.0),
+	_lastThroughput(0.0)
+{
+	_lastWindow.limit = _limit;
+	_lastWindow.inUse = 0;
+	_lastWindow.p50LatencyMs = 0.0;
+	_lastWindow.p95LatencyMs = 0.0;
+	_lastWindow.throughput = 0.0;
+	_lastWindow.errorRate = 0.0;
+	_lastWindow.baselineLatencyMs = 0.0;
+}
+
+bool ConcurrencyLimiter::acquire(const std::atomic<bool>& cancel)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	// Cancellation isn't signalled, so it's rechecked every so often
+	while (_inUse >= _limit)
+	{
+		if (cancel)
+			return false;
+
+		_released.wait_for(lock, std::chrono::milliseconds(100));
+	}
+
+	++_inUse;
+	_peakInUse = std::max(_peakInUse, _inUse);
+
+	return true;
+}
+
+void ConcurrencyLimiter::release()
+{
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		--_inUse;
+	}
+
+	_released.notify_one();
+}
+
+void ConcurrencyLimiter::recordSample(double latencyMs, uint64_t units, bool succeeded)
+{
+	uint32_t previousLimit;
+	uint32_t newLimit;
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+
+		// Failures are often quick refusals or timeouts, which say nothing
+		// about how busy the link is
+		if (succeeded)
+		{
+			_latencies.push_back(latencyMs);
+			_units += units;
+		}
+		else
+		{
+			++_errors;
+		}
+
+		uint32_t samples = static_cast<uint32_t>(_latencies.size()) + _errors;
+		if (samples < std::max(kMinWindowSamples, 2 * _limit))
+			return;
+
+		previousLimit = _limit;
+		closeWindow(Clock::now());
+		newLimit = _limit;
+	}
+
+	if (newLimit > previousLimit)
+		_released.notify_all();
+
+	if (newLimit != previousLimit)
+	{
+		Logger::get().log(Logger::DEBUG, "Concurrency limit %u -> %u", previousLimit, newLimit);
+	}
+}
+
+void ConcurrencyLimiter::closeWindow(Clock::time_point now)
+{
+	std::sort(_latencies.begin(), _latencies.end());
+
+	double windowMs = std::chrono::duration<double, std::milli>(now - _windowStarted).count();
+	uint32_t samples = static_cast<uint32_t>(_latencies.size()) + _errors;
+
+	_lastWindow.p50LatencyMs = percentile(_latencies, 0.5);
+	_lastWindow.p95LatencyMs = percentile(_latencies, 0.95);
+	_lastWindow.throughput = windowMs > 0.0 ? _units * 1000.0 / windowMs : 0.0;
+	_lastWindow.errorRate = static_cast<double>(_errors) / samples;
+
+	if (!_latencies.empty())
+	{
+		if (_baselineLatencyMs <= 0.0 || _lastWindow.p50LatencyMs < _baselineLatencyMs)
+			_baselineLatencyMs = _lastWindow.p50LatencyMs;
+		else
+			_baselineLatencyMs = std::min(_lastWindow.p50LatencyMs, _baselineLatencyMs * (1.0 + kBaselineDrift));
+	}
+
+	if (_lastWindow.errorRate > kMaxErrorRate)
+	{
+		_limit = static_cast<uint32_t>(_limit * kBackoffRatio);
+	}
+	else
+	{
+		double gradient = _lastWindow.p50LatencyMs > 0.0 ?
+			std::max(kMinGradient, std::min(1.0, _baselineLatencyMs / _lastWindow.p50LatencyMs)) : 1.0;
+
+		bool throughputHeld = windowMs < kMinThroughputWindowMs ||
+			_lastWindow.throughput >= _lastThroughput * kThroughputTolerance;
+
+		if (gradient < kLatencyTolerance)
+			_limit = static_cast<uint32_t>(_limit * gradient);
+		else if (_peakInUse >= _limit && throughputHeld)
+			++_limit;
+	}
+
+	_limit = std::min(std::max(_limit, _minLimit), _maxLimit);
+
+	if (windowMs >= kMinThroughputWindowMs)
+		_lastThroughput = _lastWindow.throughput;
+
+	_lastWindow.baselineLatencyMs = _baselineLatencyMs;
+
+	_latencies.clear();
+	_units = 0;
+	_errors = 0;
+	_peakInUse = _inUse;
+	_windowStarted = now;
+}
+
+uint32_t ConcurrencyLimiter::limit() const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+	return _limit;
+}
+
+uint32_t ConcurrencyLimiter::maxLimit() const
+{
+	return _maxLimit;
+}
+
+ConcurrencyStats ConcurrencyLimiter::stats() const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	ConcurrencyStats stats = _lastWindow;
+	stats.limit = _limit;
+	stats.inUse = _inUse;
+
+	return stats;
+}
+} // lib
+} // enlighten
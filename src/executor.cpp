@@ -0,0 +1,143 @@
+#include "executor.h"
+#include "logger.h"
+#include "validation.h"
+
+#include <algorithm>
+
+namespace enlighten
+{
+namespace lib
+{
+Executor::Executor(uint32_t numberOfWorkers) : _nextGroupId(1), _lastServedGroup(0),
+	_scheduledTasks(0), _stopping(false)
+{
+	numberOfWorkers = std::max<uint32_t>(numberOfWorkers, 1);
+
+	for (uint32_t i = 0; i < numberOfWorkers; ++i)
+		_workers.push_back(std::thread(&Executor::workerLoop, this));
+}
+
+Executor::~Executor()
+{
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		_stopping = true;
+	}
+
+	_workAvailable.notify_all();
+
+	for (auto& worker : _workers)
+		worker.join();
+}
+
+Executor& Executor::get()
+{
+	static Executor executor(std::thread::hardware_concurrency());
+	return executor;
+}
+
+Executor::GroupId Executor::createGroup()
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	GroupId group = _nextGroupId++;
+	_groups[group];
+
+	return group;
+}
+
+void Executor::removeGroup(GroupId group)
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	auto it = _groups.find(group);
+	if (it == _groups.end())
+		return;
+
+	// Anything still queued is dropped with the group
+	for (uint32_t priority = 0; priority < NumberOfPriorities; ++priority)
+		_scheduledTasks -= static_cast<uint32_t>(it->second.tasks[priority].size());
+
+	_groups.erase(it);
+}
+
+bool Executor::submit(GroupId group, Priority priority, Task task)
+{
+	VALIDATE(priority < NumberOfPriorities, "Invalid priority %d", priority);
+
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+
+		auto it = _groups.find(group);
+		VALIDATE(it != _groups.end(), "Executor group %u does not exist", group);
+		VALIDATE(!_stopping, "Executor is stopping");
+
+		it->second.tasks[priority].push_back(std::move(task));
+		++_scheduledTasks;
+	}
+
+	_workAvailable.notify_one();
+
+	return true;
+}
+
+uint32_t Executor::numberOfWorkers() const
+{
+	return static_cast<uint32_t>(_workers.size());
+}
+
+void Executor::workerLoop()
+{
+	while (true)
+	{
+		Task task;
+		if (takeScheduledTask(task))
+		{
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_stopping)
+			break;
+
+		_workAvailable.wait(lock, [this]()
+		{
+			return _stopping || _scheduledTasks > 0;
+		});
+	}
+}
+
+bool Executor::takeScheduledTask(Task& task)
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	if (_scheduledTasks == 0)
+		return false;
+
+	for (uint32_t priority = 0; priority < NumberOfPriorities; ++priority)
+	{
+		// Start with the group after the one served last, wrapping around
+		auto it = _groups.upper_bound(_lastServedGroup);
+		for (size_t i = 0; i < _groups.size(); ++i, ++it)
+		{
+			if (it == _groups.end())
+				it = _groups.begin();
+
+			std::deque<Task>& tasks = it->second.tasks[priority];
+			if (tasks.empty())
+				continue;
+
+			task = std::move(tasks.front());
+			tasks.pop_front();
+			--_scheduledTasks;
+
+			_lastServedGroup = it->first;
+			return true;
+		}
+	}
+
+	return false;
+}
+} // lib
+} // enlighten
@@ -0,0 +1,155 @@
+#include "jobprioritizer.h"
+#include "previewsdatabase.h"
+#include "sqlitestatement.h"
+#include "validation.h"
+
+#include <algorithm>
+
+#include "sqlite3.h"
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	// Above any time stamp, so requested previews always go first
+	const double kRequestedPriority = 1e15;
+
+	// How many requests are remembered; the oldest are forgotten first
+	const size_t kMaxRequests = 1024;
+}
+
+PyramidTimePrioritizer::PyramidTimePrioritizer(PreviewsDatabase* previewsDatabase) :
+	_previewsDatabase(previewsDatabase)
+{
+}
+
+bool PyramidTimePrioritizer::preparePass()
+{
+	_priorities.clear();
+
+	return _previewsDatabase->pyramidTimeStamps(_priorities);
+}
+
+double PyramidTimePrioritizer::priorityForUuid(const uuid_t& uuid) const
+{
+	auto it = _priorities.find(uuid);
+	return it != _priorities.end() ? it->second : 0.0;
+}
+
+CaptureTimePrioritizer::CaptureTimePrioritizer(PreviewsDatabase* previewsDatabase,
+	const std::string& catalogFile) : PyramidTimePrioritizer(previewsDatabase),
+	_catalogFile(catalogFile)
+{
+}
+
+bool CaptureTimePrioritizer::preparePass()
+{
+	// Pyramid times cover anything the catalog doesn't
+	CHECK(PyramidTimePrioritizer::preparePass());
+
+	if (!loadCaptureTimes())
+		Logger::get().log(Logger::WARNING, "Ordering by pyramid time, the catalog can't be read");
+
+	return true;
+}
+
+std::string CaptureTimePrioritizer::catalogFileForPreviewsDatabase(const std::string& previewsDatabaseFile)
+{
+	size_t idx = previewsDatabaseFile.rfind(" Previews.lrdata");
+	if (idx == std::string::npos)
+		return "";
+
+	return previewsDatabaseFile.substr(0, idx) + ".lrcat";
+}
+
+bool CaptureTimePrioritizer::loadCaptureTimes()
+{
+	VALIDATE(!_catalogFile.empty(), "No catalog to read capture times from");
+
+	std::map<int64_t, uuid_t> uuidsByImageId;
+	CHECK(_previewsDatabase->imageIds(uuidsByImageId));
+
+	sqlite3* catalog = nullptr;
+	int dbOpenResult = sqlite3_open_v2(_catalogFile.c_str(), &catalog, SQLITE_OPEN_READONLY, NULL);
+	if (dbOpenResult != SQLITE_OK)
+	{
+		Logger::get().log(Logger::ERROR, "Failed to open '%s'. Reason: %s", _catalogFile.c_str(),
+			sqlite3_errstr(dbOpenResult));
+
+		sqlite3_close(catalog);
+		return false;
+	}
+
+	// Seconds since 2001, like the pyramid times they replace
+	bool loaded = true;
+	{
+		SqliteStatement statement;
+		loaded = statement.prepare(catalog, "SELECT id_local,"
+			"(julianday(captureTime)-julianday('2001-01-01'))*86400 FROM Adobe_images "
+			"WHERE captureTime IS NOT NULL");
+
+		int stepResult = SQLITE_DONE;
+		while (loaded && (stepResult = statement.step()) == SQLITE_ROW)
+		{
+			auto it = uuidsByImageId.find(statement.columnInt64(0));
+			if (it != uuidsByImageId.end())
+				_priorities[it->second] = statement.columnDouble(1);
+		}
+
+		loaded = loaded && stepResult == SQLITE_DONE;
+	}
+
+	sqlite3_close(catalog);
+
+	return loaded;
+}
+
+RequestedPrioritizer::RequestedPrioritizer() : _fallback(nullptr), _numberOfRequests(0)
+{
+}
+
+void RequestedPrioritizer::setFallback(IJobPrioritizer* fallback)
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+	_fallback = fallback;
+}
+
+void RequestedPrioritizer::request(const uuid_t& uuid)
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	_requests[uuid] = ++_numberOfRequests;
+
+	if (_requests.size() > kMaxRequests)
+	{
+		auto oldest = std::min_element(_requests.begin(), _requests.end(),
+			[](const std::pair<const uuid_t, uint64_t>& a, const std::pair<const uuid_t, uint64_t>& b)
+		{
+			return a.second < b.second;
+		});
+
+		_requests.erase(oldest);
+	}
+}
+
+bool RequestedPrioritizer::preparePass()
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	return !_fallback || _fallback->preparePass();
+}
+
+double RequestedPrioritizer::priorityForUuid(const uuid_t& uuid) const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	auto it = _requests.find(uuid);
+	if (it != _requests.end())
+		return kRequestedPriority + static_cast<double>(it->second);
+
+	return _fallback ? _fallback->priorityForUuid(uuid) : 0.0;
+}
+} // lib
+} // enlighten
@@ -4,6 +4,7 @@
 #include <jpeglib.h>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 
 namespace enlighten
 {
@@ -65,16 +66,33 @@ namespace
 		return 1;
 	}
 
+	// Copies a strip of plane rows into scratch rows padded out to the component's
+	// block width. The right and bottom edges are replicated so the padding blocks
+	// don't bleed into the visible image.
+	static void fillPaddedRows(const enlighten::lib::JpegPlane& plane, uint32_t firstRow,
+		uint32_t numberOfRows, uint32_t paddedWidth, JSAMPROW* rows)
+	{
+		for (uint32_t rowIdx = 0; rowIdx < numberOfRows; ++rowIdx)
+		{
+			uint32_t sourceRow = std::min(firstRow + rowIdx, plane.height - 1);
+			const uint8_t* source = plane.bytes + sourceRow * plane.rowStride;
+
+			uint32_t width = std::min(plane.width, paddedWidth);
+			memcpy(rows[rowIdx], source, width);
+			memset(rows[rowIdx] + width, source[width - 1], paddedWidth - width);
+		}
+	}
 }
 
 Jpeg::Jpeg() : _retainedCompressedData(false), _compressedBytes(nullptr),
-	_compressedSize(0), _decompressedBytes(nullptr), _width(0), _height(0),
-	_components(0)
+	_compressedSize(0), _scaleDenominator(1), _decompressedBytes(nullptr), _width(0), _height(0),
+	_components(0), _numberOfPlanes(0)
 {
 }
 
 Jpeg::Jpeg(uint8_t* bytes, uint32_t size, bool retain) : _retainedCompressedData(retain),
-	_decompressedBytes(nullptr), _width(0), _height(0), _components(0)
+	_scaleDenominator(1), _decompressedBytes(nullptr), _width(0), _height(0), _components(0),
+	_numberOfPlanes(0)
 {
 	if (retain)
 	{
@@ -97,6 +115,8 @@ Jpeg::~Jpeg()
 		_decompressedBytes = nullptr;
 	}
 
+	freePlanes();
+
 	if (_retainedCompressedData && _compressedBytes)
 	{
 		free(_compressedBytes);
@@ -109,6 +129,7 @@ bool Jpeg::decompress()
 	VALIDATE(_compressedBytes, "No compressed data set");
 	VALIDATE(_compressedSize > 0, "Compressed data size is 0");
 	VALIDATE(_decompressedBytes == nullptr, "Decompressed image already set");
+	VALIDATE(_numberOfPlanes == 0, "Decompressed planes already set");
 
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
@@ -119,6 +140,9 @@ bool Jpeg::decompress()
 
 	VALIDATE(jpeg_read_header(&cinfo, TRUE), "Failed to read Jpeg header");
 
+	cinfo.scale_num   = 1;
+	cinfo.scale_denom = _scaleDenominator;
+
 	jpeg_start_decompress(&cinfo);
 
 	_width  = cinfo.output_width;
@@ -142,12 +166,112 @@ bool Jpeg::decompress()
 	return true;
 }
 
+bool Jpeg::decompressPlanar()
+{
+	VALIDATE(_compressedBytes, "No compressed data set");
+	VALIDATE(_compressedSize > 0, "Compressed data size is 0");
+	VALIDATE(_decompressedBytes == nullptr, "Decompressed image already set");
+	VALIDATE(_numberOfPlanes == 0, "Decompressed planes already set");
+
+	// The plane layout below assumes full size DCT blocks
+	if (_scaleDenominator != 1)
+	{
+		Logger::get().log(Logger::DEBUG, "Scaled Jpegs can not be decompressed to planes");
+		return false;
+	}
+
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, _compressedBytes, _compressedSize);
+
+	VALIDATE(jpeg_read_header(&cinfo, TRUE), "Failed to read Jpeg header");
+
+	// Only YCbCr and greyscale can be handed out untouched. Anything else (CMYK, YCCK)
+	// has to go through libjpeg's colour conversion.
+	bool planarColorSpace = (cinfo.jpeg_color_space == JCS_YCbCr && cinfo.num_components == 3) ||
+		(cinfo.jpeg_color_space == JCS_GRAYSCALE && cinfo.num_components == 1);
+	if (!planarColorSpace)
+	{
+		Logger::get().log(Logger::DEBUG, "Jpeg colour space %d can not be decompressed to planes",
+			cinfo.jpeg_color_space);
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	// Raw output skips both the colour conversion and the chroma upsampling, so each
+	// component arrives at its native sampling resolution.
+	cinfo.out_color_space = cinfo.jpeg_color_space;
+	cinfo.raw_data_out    = TRUE;
+
+	jpeg_start_decompress(&cinfo);
+
+	_width  = cinfo.output_width;
+	_height = cinfo.output_height;
+	_components = cinfo.num_components;
+	_numberOfPlanes = cinfo.num_components;
+
+	// libjpeg writes whole blocks, so the planes are padded out to the block grid.
+	uint32_t rowsPerIMCU = cinfo.max_v_samp_factor * DCTSIZE;
+	for (uint32_t planeIdx = 0; planeIdx < _numberOfPlanes; ++planeIdx)
+	{
+		const jpeg_component_info& component = cinfo.comp_info[planeIdx];
+		JpegPlane& plane = _planes[planeIdx];
+
+		plane.width     = component.downsampled_width;
+		plane.height    = component.downsampled_height;
+		plane.rowStride = component.width_in_blocks * DCTSIZE;
+		plane.horizontalSampling = component.h_samp_factor;
+		plane.verticalSampling   = component.v_samp_factor;
+
+		uint32_t paddedRows = cinfo.total_iMCU_rows * component.v_samp_factor * DCTSIZE;
+		plane.bytes = (uint8_t*)malloc(plane.rowStride * paddedRows);
+	}
+
+	JSAMPROW componentRows[kMaxPlanes][MAX_SAMP_FACTOR * DCTSIZE];
+	JSAMPARRAY planeRows[kMaxPlanes];
+	while (cinfo.output_scanline < cinfo.output_height)
+	{
+		uint32_t iMCURow = cinfo.output_scanline / rowsPerIMCU;
+		for (uint32_t planeIdx = 0; planeIdx < _numberOfPlanes; ++planeIdx)
+		{
+			const JpegPlane& plane = _planes[planeIdx];
+			uint32_t planeRowsPerIMCU = plane.verticalSampling * DCTSIZE;
+			uint32_t firstRow = iMCURow * planeRowsPerIMCU;
+
+			for (uint32_t rowIdx = 0; rowIdx < planeRowsPerIMCU; ++rowIdx)
+				componentRows[planeIdx][rowIdx] = plane.bytes + (firstRow + rowIdx) * plane.rowStride;
+
+			planeRows[planeIdx] = componentRows[planeIdx];
+		}
+
+		if (jpeg_read_raw_data(&cinfo, planeRows, rowsPerIMCU) == 0)
+			break;
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+
+	return true;
+}
+
 bool Jpeg::compress(uint32_t qualityLevel)
 {
 	VALIDATE(qualityLevel >= 0 && qualityLevel <= 100, "Invalid quality level");
-	VALIDATE(_decompressedBytes, "No RGB bytes set");
+	VALIDATE(_decompressedBytes || _numberOfPlanes > 0, "No RGB bytes or planes set");
 	VALIDATE(_compressedBytes == nullptr, "Compressed image already set");
 
+	if (_numberOfPlanes > 0)
+		return compressPlanar(qualityLevel);
+
+	return compressRgb(qualityLevel);
+}
+
+bool Jpeg::compressRgb(uint32_t qualityLevel)
+{
+
 	struct jpeg_compress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 
@@ -190,6 +314,133 @@ bool Jpeg::compress(uint32_t qualityLevel)
 	return true;
 }
 
+bool Jpeg::compressPlanar(uint32_t qualityLevel)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+
+	JpegMemoryDestination memoryDestination;
+	memoryDestination._byteBuffer = &_compressedBytes;
+	memoryDestination._bufferSize = &_compressedSize;
+
+	cinfo.err  = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+
+	cinfo.dest = reinterpret_cast<jpeg_destination_mgr*>(&memoryDestination);
+	cinfo.dest->init_destination    = initialiseDestination;
+	cinfo.dest->empty_output_buffer = flushOutputBuffer;
+	cinfo.dest->term_destination    = terminateDestination;
+
+	cinfo.image_width      = _width;
+	cinfo.image_height     = _height;
+	cinfo.input_components = _numberOfPlanes;
+	cinfo.in_color_space   = _numberOfPlanes == 1 ? JCS_GRAYSCALE : JCS_YCbCr;
+
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, qualityLevel, true);
+
+	// Feed the planes straight to the DCT, keeping the sampling they were decoded with.
+	cinfo.raw_data_in = TRUE;
+	for (uint32_t planeIdx = 0; planeIdx < _numberOfPlanes; ++planeIdx)
+	{
+		cinfo.comp_info[planeIdx].h_samp_factor = _planes[planeIdx].horizontalSampling;
+		cinfo.comp_info[planeIdx].v_samp_factor = _planes[planeIdx].verticalSampling;
+	}
+
+	jpeg_start_compress(&cinfo, true);
+
+	_retainedCompressedData = true; // _compressedBytes will have been allocated
+
+	// Each pass consumes one iMCU row; stage it in a padded scratch strip.
+	uint32_t paddedWidths[kMaxPlanes];
+	uint32_t stripSize = 0;
+	for (uint32_t planeIdx = 0; planeIdx < _numberOfPlanes; ++planeIdx)
+	{
+		paddedWidths[planeIdx] = cinfo.comp_info[planeIdx].width_in_blocks * DCTSIZE;
+		stripSize += paddedWidths[planeIdx] * _planes[planeIdx].verticalSampling * DCTSIZE;
+	}
+
+	uint8_t* strip = (uint8_t*)malloc(stripSize);
+
+	JSAMPROW componentRows[kMaxPlanes][MAX_SAMP_FACTOR * DCTSIZE];
+	JSAMPARRAY planeRows[kMaxPlanes];
+	uint8_t* stripPosition = strip;
+	for (uint32_t planeIdx = 0; planeIdx < _numberOfPlanes; ++planeIdx)
+	{
+		uint32_t planeRowsPerIMCU = _planes[planeIdx].verticalSampling * DCTSIZE;
+		for (uint32_t rowIdx = 0; rowIdx < planeRowsPerIMCU; ++rowIdx)
+		{
+			componentRows[planeIdx][rowIdx] = stripPosition;
+			stripPosition += paddedWidths[planeIdx];
+		}
+
+		planeRows[planeIdx] = componentRows[planeIdx];
+	}
+
+	uint32_t rowsPerIMCU = cinfo.max_v_samp_factor * DCTSIZE;
+	while (cinfo.next_scanline < cinfo.image_height)
+	{
+		uint32_t iMCURow = cinfo.next_scanline / rowsPerIMCU;
+		for (uint32_t planeIdx = 0; planeIdx < _numberOfPlanes; ++planeIdx)
+		{
+			uint32_t planeRowsPerIMCU = _planes[planeIdx].verticalSampling * DCTSIZE;
+			fillPaddedRows(_planes[planeIdx], iMCURow * planeRowsPerIMCU, planeRowsPerIMCU,
+				paddedWidths[planeIdx], componentRows[planeIdx]);
+		}
+
+		if (jpeg_write_raw_data(&cinfo, planeRows, rowsPerIMCU) == 0)
+			break;
+	}
+
+	free(strip);
+
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	return true;
+}
+
+bool Jpeg::readDimensions(uint32_t& width, uint32_t& height, uint32_t& components) const
+{
+	VALIDATE(_compressedBytes, "No compressed data set");
+	VALIDATE(_compressedSize > 0, "Compressed data size is 0");
+
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, _compressedBytes, _compressedSize);
+
+	bool headerRead = jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK;
+	if (headerRead)
+	{
+		width  = cinfo.image_width;
+		height = cinfo.image_height;
+		components = cinfo.num_components;
+	}
+
+	jpeg_destroy_decompress(&cinfo);
+
+	VALIDATE(headerRead, "Failed to read Jpeg header");
+
+	return true;
+}
+
+bool Jpeg::setScaleDenominator(uint32_t denominator)
+{
+	VALIDATE(denominator == 1 || denominator == 2 || denominator == 4 || denominator == 8,
+		"Invalid scale denominator %u", denominator);
+
+	_scaleDenominator = denominator;
+	return true;
+}
+
+uint32_t Jpeg::scaleDenominator() const
+{
+	return _scaleDenominator;
+}
+
 uint32_t Jpeg::components() const
 {
 	return _components;
@@ -210,6 +461,18 @@ const uint8_t* Jpeg::rawBytes() const
 	return _decompressedBytes;
 }
 
+uint32_t Jpeg::numberOfPlanes() const
+{
+	return _numberOfPlanes;
+}
+
+const JpegPlane* Jpeg::plane(uint32_t planeIndex) const
+{
+	VALIDATE_AND_RETURN(nullptr, planeIndex < _numberOfPlanes, "Invalid plane index %u", planeIndex);
+
+	return &_planes[planeIndex];
+}
+
 bool Jpeg::fromRawBytes(uint8_t* bytes, uint32_t width, uint32_t height, uint32_t components)
 {
 	VALIDATE(bytes, "input bytes must not be nullptr");
@@ -220,6 +483,8 @@ bool Jpeg::fromRawBytes(uint8_t* bytes, uint32_t width, uint32_t height, uint32_
 	if (_decompressedBytes)
 		free(_decompressedBytes);
 
+	freePlanes();
+
 	uint32_t bufferSize = width*height*components;
 	_decompressedBytes = (uint8_t*)malloc(bufferSize);
 	memcpy(_decompressedBytes, bytes, bufferSize);
@@ -230,6 +495,67 @@ bool Jpeg::fromRawBytes(uint8_t* bytes, uint32_t width, uint32_t height, uint32_
 	return true;
 }
 
+bool Jpeg::fromPlanes(const JpegPlane* planes, uint32_t numberOfPlanes, uint32_t width, uint32_t height)
+{
+	VALIDATE(planes, "input planes must not be nullptr");
+	VALIDATE(numberOfPlanes == 1 || numberOfPlanes == 3, "numberOfPlanes must be 1 or 3");
+	VALIDATE(width  > 0, "width must be greater than 0");
+	VALIDATE(height > 0, "height must be greater than 0");
+
+	for (uint32_t planeIdx = 0; planeIdx < numberOfPlanes; ++planeIdx)
+	{
+		const JpegPlane& plane = planes[planeIdx];
+		VALIDATE(plane.bytes, "plane %u has no bytes", planeIdx);
+		VALIDATE(plane.width > 0 && plane.height > 0, "plane %u has no dimensions", planeIdx);
+		VALIDATE(plane.rowStride >= plane.width, "plane %u has an invalid row stride", planeIdx);
+		VALIDATE(plane.horizontalSampling >= 1 && plane.horizontalSampling <= MAX_SAMP_FACTOR &&
+			plane.verticalSampling >= 1 && plane.verticalSampling <= MAX_SAMP_FACTOR,
+			"plane %u has invalid sampling factors", planeIdx);
+	}
+
+	freePlanes();
+
+	if (_decompressedBytes)
+	{
+		free(_decompressedBytes);
+		_decompressedBytes = nullptr;
+	}
+
+	// Planes are stored tightly packed, the source stride is not preserved.
+	for (uint32_t planeIdx = 0; planeIdx < numberOfPlanes; ++planeIdx)
+	{
+		const JpegPlane& source = planes[planeIdx];
+		JpegPlane& plane = _planes[planeIdx];
+
+		plane = source;
+		plane.rowStride = source.width;
+		plane.bytes = (uint8_t*)malloc(plane.rowStride * plane.height);
+
+		for (uint32_t row = 0; row < plane.height; ++row)
+		{
+			memcpy(plane.bytes + row * plane.rowStride, source.bytes + row * source.rowStride,
+				plane.width);
+		}
+	}
+
+	_numberOfPlanes = numberOfPlanes;
+	_width = width;
+	_height = height;
+	_components = numberOfPlanes;
+	return true;
+}
+
+void Jpeg::freePlanes()
+{
+	for (uint32_t planeIdx = 0; planeIdx < _numberOfPlanes; ++planeIdx)
+	{
+		free(_planes[planeIdx].bytes);
+		_planes[planeIdx].bytes = nullptr;
+	}
+
+	_numberOfPlanes = 0;
+}
+
 bool Jpeg::writeToFile(const char* filePath)
 {
 	VALIDATE(filePath, "filePath is not valid");
@@ -5,28 +5,60 @@
 #include <jpeglib.h>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 
 namespace enlighten
 {
 namespace lib
 {
 JpegCruncher::JpegCruncher(IJpeg* sourceJpeg, IJpeg* targetJpeg) :
-	_sourceJpeg(sourceJpeg), _targetJpeg(targetJpeg)
+	_sourceJpeg(sourceJpeg), _targetJpeg(targetJpeg), _mode(CrunchModeRGB),
+	_orientation(Orientation_Normal)
 {
 }
 
+void JpegCruncher::setCrunchMode(CrunchMode mode)
+{
+	_mode = mode;
+}
+
+JpegCruncher::CrunchMode JpegCruncher::crunchMode() const
+{
+	return _mode;
+}
+
+void JpegCruncher::setOrientation(Orientation orientation)
+{
+	_orientation = orientation;
+}
+
+Orientation JpegCruncher::orientation() const
+{
+	return _orientation;
+}
+
 bool JpegCruncher::reencodeJpeg(uint32_t longestDimension, int32_t qualityLevel)
 {
 	VALIDATE(_sourceJpeg, "Source Jpeg is invalid");
 	VALIDATE(_targetJpeg, "Target Jpeg is invalid");
+	VALIDATE(_orientation >= Orientation_Normal && _orientation <= Orientation_Rotate270,
+		"Invalid orientation %d", _orientation);
+
+	// The YCbCr path resizes the planes as libjpeg stores them, which avoids a colour
+	// conversion on both sides and resizes the chroma at its subsampled resolution.
+	// Sources which can't be handed out as planes fall back to RGB.
+	if (_mode == CrunchModeYCbCr && _sourceJpeg->decompressPlanar())
+		return reencodePlanar(longestDimension, qualityLevel);
 
 	VALIDATE(_sourceJpeg->decompress(), "Failed to decompress Jpeg");
 
-	// Scale the image down
-	uint32_t targetWidth, targetHeight;
-	uint32_t sourceWidth  = _sourceJpeg->width();
-	uint32_t sourceHeight = _sourceJpeg->height();
-	uint32_t components   = _sourceJpeg->components();
+	return reencodeRgb(longestDimension, qualityLevel);
+}
+
+void JpegCruncher::calculateTargetDimensions(uint32_t longestDimension, uint32_t& targetWidth,
+	uint32_t& targetHeight)
+{
 	if (_sourceJpeg->width() >= _sourceJpeg->height())
 	{
 		float aspectRatio = static_cast<float>(_sourceJpeg->height()) / _sourceJpeg->width();
@@ -39,33 +71,167 @@ bool JpegCruncher::reencodeJpeg(uint32_t longestDimension, int32_t qualityLevel)
 		targetHeight = longestDimension;
 		targetWidth  = longestDimension * aspectRatio;
 	}
+}
+
+bool JpegCruncher::reencodeRgb(uint32_t longestDimension, int32_t qualityLevel)
+{
+	// Scale the image down. The target dimensions are in source orientation; the
+	// orientation only changes where each pixel is written.
+	uint32_t targetWidth, targetHeight;
+	uint32_t sourceWidth  = _sourceJpeg->width();
+	uint32_t sourceHeight = _sourceJpeg->height();
+	uint32_t components   = _sourceJpeg->components();
+	calculateTargetDimensions(longestDimension, targetWidth, targetHeight);
+
+	uint32_t orientedWidth  = orientationSwapsDimensions() ? targetHeight : targetWidth;
+	uint32_t orientedHeight = orientationSwapsDimensions() ? targetWidth : targetHeight;
+	TargetAddressing addressing = addressingForOrientation(targetWidth, targetHeight,
+		orientedWidth * components, components);
 
 	const uint8_t* sourceBytes = _sourceJpeg->rawBytes();
 	uint8_t* targetBytes = (uint8_t*)malloc(targetWidth * targetHeight * components);
 
 	bool rescaleSuccessful = rescaleBuffer(sourceBytes, sourceWidth, sourceHeight, components,
-		targetBytes, targetWidth, targetHeight);
+		targetBytes, targetWidth, targetHeight, addressing);
+
+	if (rescaleSuccessful)
+		_targetJpeg->fromRawBytes(targetBytes, orientedWidth, orientedHeight, components);
+
+	free(targetBytes);
 
 	VALIDATE(rescaleSuccessful, "Failed to resize preview jpeg file.");
+	VALIDATE(_targetJpeg->compress(qualityLevel), "Failed to compress Jpeg");
+
+	return true;
+}
+
+bool JpegCruncher::reencodePlanar(uint32_t longestDimension, int32_t qualityLevel)
+{
+	uint32_t numberOfPlanes = _sourceJpeg->numberOfPlanes();
+	VALIDATE(numberOfPlanes > 0 && numberOfPlanes <= Jpeg::kMaxPlanes,
+		"Invalid number of planes: %u", numberOfPlanes);
+
+	uint32_t targetWidth, targetHeight;
+	calculateTargetDimensions(longestDimension, targetWidth, targetHeight);
+
+	uint32_t maxHorizontalSampling = 1;
+	uint32_t maxVerticalSampling   = 1;
+	for (uint32_t planeIdx = 0; planeIdx < numberOfPlanes; ++planeIdx)
+	{
+		const JpegPlane* sourcePlane = _sourceJpeg->plane(planeIdx);
+		VALIDATE(sourcePlane, "Source plane %u is invalid", planeIdx);
+
+		maxHorizontalSampling = std::max(maxHorizontalSampling, sourcePlane->horizontalSampling);
+		maxVerticalSampling   = std::max(maxVerticalSampling, sourcePlane->verticalSampling);
+	}
+
+	// Each target plane keeps the source's sampling, so the chroma is only ever
+	// resized at its subsampled resolution. Rotating by 90 degrees swaps the sampling
+	// factors along with the dimensions.
+	bool swapDimensions = orientationSwapsDimensions();
+	JpegPlane targetPlanes[Jpeg::kMaxPlanes];
+	bool rescaleSuccessful = true;
+	for (uint32_t planeIdx = 0; planeIdx < numberOfPlanes; ++planeIdx)
+	{
+		const JpegPlane& sourcePlane = *_sourceJpeg->plane(planeIdx);
+		JpegPlane& targetPlane = targetPlanes[planeIdx];
+
+		uint32_t planeWidth  = (targetWidth * sourcePlane.horizontalSampling +
+			maxHorizontalSampling - 1) / maxHorizontalSampling;
+		uint32_t planeHeight = (targetHeight * sourcePlane.verticalSampling +
+			maxVerticalSampling - 1) / maxVerticalSampling;
+
+		targetPlane.width  = swapDimensions ? planeHeight : planeWidth;
+		targetPlane.height = swapDimensions ? planeWidth : planeHeight;
+		targetPlane.horizontalSampling = swapDimensions ? sourcePlane.verticalSampling :
+			sourcePlane.horizontalSampling;
+		targetPlane.verticalSampling   = swapDimensions ? sourcePlane.horizontalSampling :
+			sourcePlane.verticalSampling;
+		targetPlane.rowStride = targetPlane.width;
+		targetPlane.bytes = (uint8_t*)malloc(targetPlane.rowStride * targetPlane.height);
+
+		rescaleSuccessful = rescaleSuccessful &&
+			rescalePlane(sourcePlane, planeWidth, planeHeight, targetPlane);
+	}
+
+	if (rescaleSuccessful)
+	{
+		_targetJpeg->fromPlanes(targetPlanes, numberOfPlanes,
+			swapDimensions ? targetHeight : targetWidth,
+			swapDimensions ? targetWidth : targetHeight);
+	}
 
-	_targetJpeg->fromRawBytes(targetBytes, targetWidth, targetHeight, components);
+	for (uint32_t planeIdx = 0; planeIdx < numberOfPlanes; ++planeIdx)
+		free(targetPlanes[planeIdx].bytes);
 
+	VALIDATE(rescaleSuccessful, "Failed to resize preview jpeg planes.");
 	VALIDATE(_targetJpeg->compress(qualityLevel), "Failed to compress Jpeg");
 
 	return true;
 }
 
+bool JpegCruncher::orientationSwapsDimensions() const
+{
+	return _orientation >= Orientation_Transpose;
+}
+
+JpegCruncher::TargetAddressing JpegCruncher::addressingForOrientation(uint32_t width,
+	uint32_t height, uint32_t targetRowStride, uint32_t pixelStride) const
+{
+	// width and height are in source orientation. Each case maps a source pixel (x, y)
+	// to its displayed position, expressed as byte offsets into the target.
+	int64_t lastColumn = static_cast<int64_t>(width) - 1;
+	int64_t lastRow    = static_cast<int64_t>(height) - 1;
+	int64_t row   = targetRowStride;
+	int64_t pixel = pixelStride;
+
+	switch (_orientation)
+	{
+		case Orientation_FlipHorizontal:
+			return { lastColumn * pixel, -pixel, row };
+		case Orientation_Rotate180:
+			return { lastRow * row + lastColumn * pixel, -pixel, -row };
+		case Orientation_FlipVertical:
+			return { lastRow * row, pixel, -row };
+		case Orientation_Transpose:
+			return { 0, row, pixel };
+		case Orientation_Rotate90:
+			return { lastRow * pixel, row, -pixel };
+		case Orientation_Transverse:
+			return { lastColumn * row + lastRow * pixel, -row, -pixel };
+		case Orientation_Rotate270:
+			return { lastColumn * row, -row, pixel };
+		case Orientation_Normal:
+		default:
+			return { 0, pixel, row };
+	}
+}
+
 bool JpegCruncher::rescaleBuffer(const uint8_t* sourceBuffer, uint32_t sourceWidth, uint32_t sourceHeight,
-	uint32_t components, uint8_t* targetBuffer, uint32_t targetWidth, uint32_t targetHeight)
+	uint32_t components, uint8_t* targetBuffer, uint32_t targetWidth, uint32_t targetHeight,
+	const TargetAddressing& addressing)
 {
+	uint32_t sourceRowStride = sourceWidth * components;
+
+	// Nothing to interpolate, so this is just the reorientation.
+	if (sourceWidth == targetWidth && sourceHeight == targetHeight)
+	{
+		for (uint32_t y = 0; y < targetHeight; ++y)
+		{
+			const uint8_t* sourceRow = sourceBuffer + y * sourceRowStride;
+			uint8_t* target = targetBuffer + addressing.origin + y * addressing.yStep;
+			for (uint32_t x = 0; x < targetWidth; ++x, target += addressing.xStep)
+				memcpy(target, sourceRow + x * components, components);
+		}
+
+		return true;
+	}
+
 	float xRatio = static_cast<float>(sourceWidth  - 1) / targetWidth;
 	float yRatio = static_cast<float>(sourceHeight - 1) / targetHeight;
 
-	uint32_t sourceRowStride = sourceWidth * components;
-	uint32_t targetRowStride = targetWidth * components;
-
 	uint32_t sourceXPixel, sourceYPixel, sourceIndex0, sourceIndex1, sourceIndex2, sourceIndex3;
-	uint32_t targetIndex;
+	int64_t targetIndex;
 	uint8_t blue, green, red;
 	float xWeight, yWeight;
 
@@ -99,7 +265,7 @@ bool JpegCruncher::rescaleBuffer(const uint8_t* sourceBuffer, uint32_t sourceWid
 			blue  = (sourceTaps[0]>>16 & 0xFF)*(1-xWeight)*(1-yWeight) + (sourceTaps[1]>>16 & 0xFF)*(xWeight)*(1-yWeight) +
 	                (sourceTaps[2]>>16 & 0xFF)*(yWeight)*(1-xWeight)   + (sourceTaps[3]>>16 & 0xFF)*(xWeight*yWeight);
 
-			targetIndex = y * targetRowStride + (x * components);
+			targetIndex = addressing.origin + x * addressing.xStep + y * addressing.yStep;
 			targetBuffer[targetIndex]   = red;
 			targetBuffer[targetIndex+1] = green;
 			targetBuffer[targetIndex+2] = blue;
@@ -108,5 +274,71 @@ bool JpegCruncher::rescaleBuffer(const uint8_t* sourceBuffer, uint32_t sourceWid
 
 	return true;
 }
+
+bool JpegCruncher::rescalePlane(const JpegPlane& sourcePlane, uint32_t targetWidth, uint32_t targetHeight,
+	JpegPlane& targetPlane)
+{
+	VALIDATE(sourcePlane.bytes && targetPlane.bytes, "Plane has no bytes");
+	VALIDATE(sourcePlane.width > 0 && sourcePlane.height > 0, "Source plane has no dimensions");
+	VALIDATE(targetWidth > 0 && targetHeight > 0, "Target plane has no dimensions");
+
+	TargetAddressing addressing = addressingForOrientation(targetWidth, targetHeight,
+		targetPlane.rowStride, 1);
+
+	// Nothing to interpolate, so this is just the reorientation.
+	if (sourcePlane.width == targetWidth && sourcePlane.height == targetHeight)
+	{
+		for (uint32_t y = 0; y < targetHeight; ++y)
+		{
+			const uint8_t* sourceRow = sourcePlane.bytes + y * sourcePlane.rowStride;
+			uint8_t* target = targetPlane.bytes + addressing.origin + y * addressing.yStep;
+			for (uint32_t x = 0; x < targetWidth; ++x, target += addressing.xStep)
+				*target = sourceRow[x];
+		}
+
+		return true;
+	}
+
+	float xRatio = static_cast<float>(sourcePlane.width  - 1) / targetWidth;
+	float yRatio = static_cast<float>(sourcePlane.height - 1) / targetHeight;
+
+	// The horizontal taps are the same for every row, so work them out once.
+	std::vector<uint32_t> sourceColumns(targetWidth);
+	std::vector<float> xWeights(targetWidth);
+	for (uint32_t x = 0; x < targetWidth; ++x)
+	{
+		sourceColumns[x] = static_cast<uint32_t>(xRatio * x);
+		xWeights[x] = (xRatio * x) - sourceColumns[x];
+	}
+
+	uint32_t lastColumn = sourcePlane.width - 1;
+	uint32_t lastRow    = sourcePlane.height - 1;
+
+	// Do a bilinear interpolation
+	for (uint32_t y = 0; y < targetHeight; ++y)
+	{
+		uint32_t sourceYPixel = static_cast<uint32_t>(yRatio * y);
+		float yWeight = (yRatio * y) - sourceYPixel;
+
+		const uint8_t* row0 = sourcePlane.bytes + sourceYPixel * sourcePlane.rowStride;
+		const uint8_t* row1 = sourcePlane.bytes + std::min(sourceYPixel + 1, lastRow) *
+			sourcePlane.rowStride;
+		uint8_t* target = targetPlane.bytes + addressing.origin + y * addressing.yStep;
+
+		for (uint32_t x = 0; x < targetWidth; ++x, target += addressing.xStep)
+		{
+			uint32_t x0 = sourceColumns[x];
+			uint32_t x1 = std::min(x0 + 1, lastColumn);
+			float xWeight = xWeights[x];
+
+			float top    = row0[x0] + (row0[x1] - row0[x0]) * xWeight;
+			float bottom = row1[x0] + (row1[x1] - row1[x0]) * xWeight;
+
+			*target = static_cast<uint8_t>(top + (bottom - top) * yWeight + 0.5f);
+		}
+	}
+
+	return true;
+}
 } // lib
 } // enlighten
@@ -0,0 +1,188 @@
+#include "memorybudget.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	// Enough for a few dozen previews in flight, and little enough for a small NAS
+	const uint64_t kDefaultCapacity = 256ull * 1024 * 1024;
+
+	// Cancellation isn't signalled, so waiters recheck for it this often
+	const uint32_t kReserveWaitMs = 100;
+}
+
+MemoryBudget::MemoryBudget(uint64_t capacity) : _capacity(capacity), _reserved(0),
+	_peakReserved(0), _waiters(0)
+{
+}
+
+MemoryBudget& MemoryBudget::get()
+{
+	static MemoryBudget budget(kDefaultCapacity);
+	return budget;
+}
+
+void MemoryBudget::setCapacity(uint64_t capacity)
+{
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		_capacity = capacity;
+	}
+
+	_released.notify_all();
+}
+
+uint64_t MemoryBudget::capacity() const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+	return _capacity;
+}
+
+uint64_t MemoryBudget::reserved() const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+	return _reserved;
+}
+
+uint64_t MemoryBudget::peakReserved() const
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+	return _peakReserved;
+}
+
+bool MemoryBudget::reserve(uint64_t bytes, const std::atomic<bool>& cancel)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (!fits(bytes))
+	{
+		Logger::get().log(Logger::DEBUG, "Waiting for %llu bytes of memory, %llu of %llu reserved",
+			static_cast<unsigned long long>(bytes), static_cast<unsigned long long>(_reserved),
+			static_cast<unsigned long long>(_capacity));
+
+		++_waiters;
+		while (!fits(bytes))
+		{
+			if (cancel)
+			{
+				--_waiters;
+				return false;
+			}
+
+			_released.wait_for(lock, std::chrono::milliseconds(kReserveWaitMs));
+		}
+		--_waiters;
+	}
+
+	_reserved += bytes;
+	_peakReserved = std::max(_peakReserved, _reserved);
+
+	return true;
+}
+
+bool MemoryBudget::tryReserve(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	if (_waiters > 0 || !fits(bytes))
+		return false;
+
+	_reserved += bytes;
+	_peakReserved = std::max(_peakReserved, _reserved);
+
+	return true;
+}
+
+void MemoryBudget::release(uint64_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		_reserved -= std::min(bytes, _reserved);
+	}
+
+	// Waiters want differing amounts, so any of them may now fit
+	_released.notify_all();
+}
+
+bool MemoryBudget::fits(uint64_t bytes) const
+{
+	return _reserved == 0 || _reserved + bytes <= _capacity;
+}
+
+MemoryReservation::MemoryReservation() : _budget(nullptr), _bytes(0)
+{
+}
+
+MemoryReservation::MemoryReservation(MemoryBudget& budget) : _budget(&budget), _bytes(0)
+{
+}
+
+MemoryReservation::MemoryReservation(MemoryReservation&& other) :
+	_budget(other._budget), _bytes(other._bytes)
+{
+	other._bytes = 0;
+}
+
+MemoryReservation& MemoryReservation::operator=(MemoryReservation&& other)
+{
+	if (this != &other)
+	{
+		release();
+
+		_budget = other._budget;
+		_bytes = other._bytes;
+		other._bytes = 0;
+	}
+
+	return *this;
+}
+
+MemoryReservation::~MemoryReservation()
+{
+	release();
+}
+
+uint64_t MemoryReservation::bytes() const
+{
+	return _bytes;
+}
+
+bool MemoryReservation::grow(uint64_t bytes, const std::atomic<bool>& cancel)
+{
+	if (!_budget || !_budget->reserve(bytes, cancel))
+		return false;
+
+	_bytes += bytes;
+	return true;
+}
+
+bool MemoryReservation::tryGrow(uint64_t bytes)
+{
+	if (!_budget || !_budget->tryReserve(bytes))
+		return false;
+
+	_bytes += bytes;
+	return true;
+}
+
+void MemoryReservation::shrinkTo(uint64_t bytes)
+{
+	if (!_budget || bytes >= _bytes)
+		return;
+
+	_budget->release(_bytes - bytes);
+	_bytes = bytes;
+}
+
+void MemoryReservation::release()
+{
+	shrinkTo(0);
+}
+} // lib
+} // enlighten
@@ -8,13 +8,17 @@ namespace lib
 {
 const unsigned int PreviewEntry::INVALID_LEVEL_INDEX = 0xFFFF;
 
-PreviewEntry::PreviewEntry(const std::string& uuid, const std::string& digest,
-	const std::vector<PreviewEntryLevel>& levels) : _uuid(uuid), _digest(digest),
-		_levels(levels)
+PreviewEntry::PreviewEntry() : _orientation(Orientation_Normal)
 {
 }
 
-const std::string& PreviewEntry::uuid() const
+PreviewEntry::PreviewEntry(const uuid_t& uuid, const std::string& digest,
+	const std::vector<PreviewEntryLevel>& levels, Orientation orientation) : _uuid(uuid),
+		_digest(digest), _orientation(orientation), _levels(levels)
+{
+}
+
+const uuid_t& PreviewEntry::uuid() const
 {
 	return _uuid;
 }
@@ -24,11 +28,19 @@ const std::string& PreviewEntry::digest() const
 	return _digest;
 }
 
+Orientation PreviewEntry::orientation() const
+{
+	return _orientation;
+}
+
 std::string PreviewEntry::filePathRelativeToRoot() const
 {
+	char uuid[Uuid::kStringLength + 1];
+	_uuid.format(uuid);
+
 	char buffer[96];
-	int written = snprintf(buffer, 96, "%s/%s/%s-%s.lrprev", _uuid.substr(0,1).c_str(),
-		_uuid.substr(0,4).c_str(), _uuid.c_str(), _digest.c_str());
+	int written = snprintf(buffer, 96, "%.1s/%.4s/%s-%s.lrprev", uuid, uuid, uuid,
+		_digest.c_str());
 
 	VALIDATE_AND_RETURN(std::string(""), written < 96, "Buffer overflow");
 
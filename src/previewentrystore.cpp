@@ -0,0 +1,171 @@
+#include "previewentrystore.h"
+#include "uuid.h"
+#include "validation.h"
+
+#include <cstring>
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	const uint32_t kMinimumNumberOfSlots = 16;
+
+	bool packDigest(const std::string& digest, uint8_t* packed)
+	{
+		if (digest.length() != 32)
+			return false;
+
+		for (uint32_t byteIdx = 0; byteIdx < 16; ++byteIdx)
+		{
+			int high = hexValue(digest[byteIdx * 2]);
+			int low  = hexValue(digest[byteIdx * 2 + 1]);
+			if (high < 0 || low < 0)
+				return false;
+
+			packed[byteIdx] = static_cast<uint8_t>((high << 4) | low);
+		}
+
+		return true;
+	}
+
+	// Lightroom writes digests in lower case
+	std::string unpackDigest(const uint8_t* packed)
+	{
+		static const char* kHexDigits = "0123456789abcdef";
+
+		std::string digest(32, '0');
+		for (uint32_t byteIdx = 0; byteIdx < 16; ++byteIdx)
+		{
+			digest[byteIdx * 2]     = kHexDigits[packed[byteIdx] >> 4];
+			digest[byteIdx * 2 + 1] = kHexDigits[packed[byteIdx] & 0xF];
+		}
+
+		return digest;
+	}
+}
+
+const uint32_t PreviewEntryStore::kEmptySlot;
+
+PreviewEntryStore::PreviewEntryStore()
+{
+}
+
+bool PreviewEntryStore::insert(const uuid_t& uuid, const std::string& digest, Orientation orientation,
+	const std::vector<PreviewEntryLevel>& levels)
+{
+	uint8_t packedDigest[16];
+	VALIDATE(!uuid.isNil(), "Invalid uuid");
+	VALIDATE(packDigest(digest, packedDigest), "Malformed digest '%s'", digest.c_str());
+	VALIDATE(levels.size() <= 0xFF, "Too many levels for '%s'", uuid.toString().c_str());
+
+	// Keep the load factor at or under a half so probe sequences stay short.
+	if ((_records.size() + 1) * 2 > _slots.size())
+		rehash(std::max<uint32_t>(kMinimumNumberOfSlots, _slots.size() * 2));
+
+	uint32_t slot = slotForUuid(uuid);
+	if (_slots[slot] == kEmptySlot)
+	{
+		Record record;
+		record.uuid = uuid;
+		record.firstLevel = _levels.size();
+		record.numberOfLevels = 0;
+
+		_slots[slot] = _records.size();
+		_records.push_back(record);
+	}
+
+	Record& record = _records[_slots[slot]];
+	memcpy(record.digest, packedDigest, 16);
+	record.orientation = static_cast<uint8_t>(orientation);
+
+	// Levels are rewritten in place when they fit, otherwise they move to the end
+	// of the shared array. Entries are rarely replaced, so the gap isn't reclaimed.
+	if (levels.size() > record.numberOfLevels)
+	{
+		record.firstLevel = _levels.size();
+		_levels.insert(_levels.end(), levels.begin(), levels.end());
+	}
+	else
+	{
+		std::copy(levels.begin(), levels.end(), _levels.begin() + record.firstLevel);
+	}
+	record.numberOfLevels = static_cast<uint8_t>(levels.size());
+
+	return true;
+}
+
+bool PreviewEntryStore::contains(const uuid_t& uuid) const
+{
+	return findRecord(uuid) != kEmptySlot;
+}
+
+bool PreviewEntryStore::entryForUuid(const uuid_t& uuid, PreviewEntry& entry) const
+{
+	uint32_t recordIdx = findRecord(uuid);
+	if (recordIdx == kEmptySlot)
+		return false;
+
+	const Record& record = _records[recordIdx];
+	std::vector<PreviewEntryLevel> levels(_levels.begin() + record.firstLevel,
+		_levels.begin() + record.firstLevel + record.numberOfLevels);
+
+	entry = PreviewEntry(record.uuid, unpackDigest(record.digest), levels,
+		static_cast<Orientation>(record.orientation));
+
+	return true;
+}
+
+uint32_t PreviewEntryStore::numberOfEntries() const
+{
+	return _records.size();
+}
+
+void PreviewEntryStore::reserve(uint32_t numberOfEntries)
+{
+	_records.reserve(numberOfEntries);
+
+	uint32_t numberOfSlots = kMinimumNumberOfSlots;
+	while (numberOfSlots < numberOfEntries * 2)
+		numberOfSlots *= 2;
+
+	if (numberOfSlots > _slots.size())
+		rehash(numberOfSlots);
+}
+
+void PreviewEntryStore::clear()
+{
+	_records.clear();
+	_levels.clear();
+	_slots.clear();
+}
+
+uint32_t PreviewEntryStore::findRecord(const uuid_t& uuid) const
+{
+	if (_slots.empty())
+		return kEmptySlot;
+
+	return _slots[slotForUuid(uuid)];
+}
+
+uint32_t PreviewEntryStore::slotForUuid(const uuid_t& uuid) const
+{
+	// Probing is linear from the uuid's hash
+	uint32_t mask = _slots.size() - 1;
+	uint32_t slot = static_cast<uint32_t>(uuid.hash()) & mask;
+	while (_slots[slot] != kEmptySlot && _records[_slots[slot]].uuid != uuid)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+void PreviewEntryStore::rehash(uint32_t numberOfSlots)
+{
+	_slots.assign(numberOfSlots, kEmptySlot);
+
+	for (uint32_t recordIdx = 0; recordIdx < _records.size(); ++recordIdx)
+		_slots[slotForUuid(_records[recordIdx].uuid)] = recordIdx;
+}
+} // lib
+} // enlighten
@@ -2,63 +2,231 @@
 #include "previewentry.h"
 #include "validation.h"
 #include "cachedpreviews.h"
+#include "sqlitestatement.h"
 
 #include "sqlite3.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
 namespace enlighten
 {
 namespace lib
 {
-PreviewsDatabase::PreviewsDatabase() : _sqliteDatabase(nullptr),
-	_cachedNumberOfEntries(-1)
+namespace
 {
-}
+	const int kBusyTimeoutMs = 1000;
+	const int kSnapshotRetryIntervalMs = 10;
 
-PreviewsDatabase::~PreviewsDatabase()
-{
-	if (_sqliteDatabase)
+	// Lightroom stores orientation as the pair of source corners (A top-left, B top-right,
+	// C bottom-right, D bottom-left) that end up at the top-left and top-right when displayed.
+	Orientation orientationFromLightroomCode(const char* code)
 	{
-		sqlite3_close(_sqliteDatabase);
+		static const struct
+		{
+			const char* code;
+			Orientation orientation;
+		} kOrientationCodes[] =
+		{
+			{ "AB", Orientation_Normal },
+			{ "BA", Orientation_FlipHorizontal },
+			{ "CD", Orientation_Rotate180 },
+			{ "DC", Orientation_FlipVertical },
+			{ "AD", Orientation_Transpose },
+			{ "DA", Orientation_Rotate90 },
+			{ "CB", Orientation_Transverse },
+			{ "BC", Orientation_Rotate270 },
+		};
+
+		if (code)
+		{
+			for (auto& entry : kOrientationCodes)
+			{
+				if (strcmp(code, entry.code) == 0)
+					return entry.orientation;
+			}
+		}
+
+		return Orientation_Normal;
 	}
 
-	for (auto it = _cachedEntries.begin(); it != _cachedEntries.end(); it++)
-		delete it->second;
+	// Previews cached before digests were recorded are taken to be current,
+	// rather than re-uploading the whole cache in one go.
+	bool isStaleDigest(const std::string& cachedDigest, const std::string& digest)
+	{
+		return !cachedDigest.empty() && cachedDigest != digest;
+	}
+}
+
+PreviewsDatabase::PreviewsDatabase() : _cachedNumberOfEntries(-1), _uuidsByIndexValid(false),
+	_sqliteDatabase(nullptr), _snapshotDatabase(nullptr), _snapshotDataVersion(-1)
+{
+	resetHighWaterMarks();
+}
+
+PreviewsDatabase::~PreviewsDatabase()
+{
+	closeDatabase();
 }
 
 bool PreviewsDatabase::initialiseWithFile(const std::string& fileName)
 {
 	VALIDATE(fileName.length(), "Invalid filename");
 
+	closeDatabase();
+
 	int dbOpenResult = sqlite3_open_v2(fileName.c_str(), &_sqliteDatabase,
 		SQLITE_OPEN_READONLY, NULL);
 	VALIDATE(dbOpenResult == SQLITE_OK, "Failed to open sqlite database '%s'. Reason: %s",
 		fileName.c_str(), sqlite3_errmsg(_sqliteDatabase));
 
+	// Lightroom writes to this database while we're reading it
+	sqlite3_busy_timeout(_sqliteDatabase, kBusyTimeoutMs);
+
 	_sourceFile = fileName;
 	_cachedNumberOfEntries = -1;
 
+	_uuidsByIndex.clear();
+	_uuidsByIndexValid = false;
+
+	_entries.clear();
+
+	resetHighWaterMarks();
+
 	return true;
 }
 
 bool PreviewsDatabase::reopen()
 {
 	VALIDATE(_sourceFile.length() != 0 && _sqliteDatabase != nullptr, "Database is not already open");
-	sqlite3_close(_sqliteDatabase);
+	closeDatabase();
 
 	return initialiseWithFile(_sourceFile);
 }
 
-sqlite3_stmt* PreviewsDatabase::makeStatement(const char* query)
+void PreviewsDatabase::closeDatabase()
+{
+	endSnapshot();
+
+	// Cached statements belong to the connection, so they go with it.
+	_statementCache.clear();
+
+	if (_sqliteDatabase)
+	{
+		sqlite3_close(_sqliteDatabase);
+		_sqliteDatabase = nullptr;
+	}
+}
+
+bool PreviewsDatabase::beginSnapshot()
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	endSnapshot();
+
+	// Read the version first, so a commit landing mid-copy is picked up next time
+	int64_t dataVersion = -1;
+	CHECK(queryDataVersion(dataVersion));
+
+	auto start = std::chrono::steady_clock::now();
+
+	sqlite3* snapshot = nullptr;
+	int openResult = sqlite3_open_v2(":memory:", &snapshot,
+		SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	if (openResult != SQLITE_OK)
+	{
+		sqlite3_close(snapshot);
+		VALIDATE(false, "Failed to open a snapshot database. Reason: %s", sqlite3_errstr(openResult));
+	}
+
+	// A single step copies every page under one read transaction, which is what
+	// makes the copy consistent. While Lightroom holds its write lock the step
+	// comes back busy, so it is retried for as long as a normal read would wait.
+	int stepResult = SQLITE_ERROR;
+	sqlite3_backup* backup = sqlite3_backup_init(snapshot, "main", _sqliteDatabase, "main");
+	if (backup)
+	{
+		auto deadline = start + std::chrono::milliseconds(kBusyTimeoutMs);
+		while ((stepResult = sqlite3_backup_step(backup, -1)) == SQLITE_BUSY ||
+			stepResult == SQLITE_LOCKED)
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+				break;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(kSnapshotRetryIntervalMs));
+		}
+
+		sqlite3_backup_finish(backup);
+	}
+
+	if (stepResult != SQLITE_DONE)
+	{
+		Logger::get().log(Logger::ERROR, "Failed to snapshot '%s'. Reason: %s",
+			_sourceFile.c_str(), backup ? sqlite3_errstr(stepResult) : sqlite3_errmsg(snapshot));
+
+		sqlite3_close(snapshot);
+		return false;
+	}
+
+	// Statements prepared against the live connection can't be used on the copy
+	_statementCache.clear();
+
+	_snapshotDatabase = snapshot;
+	_snapshotDataVersion = dataVersion;
+
+	Logger::get().log(Logger::DEBUG, "Took a snapshot of '%s' in %lld ms", _sourceFile.c_str(),
+		static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start).count()));
+
+	return true;
+}
+
+void PreviewsDatabase::endSnapshot()
+{
+	if (!_snapshotDatabase)
+		return;
+
+	_statementCache.clear();
+
+	sqlite3_close(_snapshotDatabase);
+	_snapshotDatabase = nullptr;
+	_snapshotDataVersion = -1;
+}
+
+bool PreviewsDatabase::isReadingSnapshot() const
 {
-	sqlite3_stmt* statement = nullptr;
+	return _snapshotDatabase != nullptr;
+}
 
-	int statementResult = sqlite3_prepare_v2(_sqliteDatabase, query, -1, &statement,
-		NULL);
+sqlite3* PreviewsDatabase::readDatabase() const
+{
+	return _snapshotDatabase ? _snapshotDatabase : _sqliteDatabase;
+}
+
+void PreviewsDatabase::resetHighWaterMarks()
+{
+	_dataVersion = -1;
+	_pyramidRowCount = -1;
+	_rowidHighWaterMark = -1;
+	_fileTimeStampHighWaterMark = 0.0;
+}
+
+SqliteStatement* PreviewsDatabase::cachedStatement(const char* query)
+{
+	auto it = _statementCache.find(query);
+	if (it != _statementCache.end())
+	{
+		it->second.reset();
+		return &it->second;
+	}
 
-	VALIDATE_AND_RETURN(nullptr, statementResult == SQLITE_OK, "Statement '%s' error. Reason: %s",
-		query, sqlite3_errmsg(_sqliteDatabase));
+	SqliteStatement statement;
+	CHECK_AND_RETURN(nullptr, statement.prepare(readDatabase(), query));
 
-	return statement;
+	it = _statementCache.insert(std::make_pair(std::string(query), std::move(statement))).first;
+	return &it->second;
 }
 
 unsigned int PreviewsDatabase::numberOfPreviewEntries()
@@ -70,14 +238,11 @@ unsigned int PreviewsDatabase::numberOfPreviewEntries()
 
 	VALIDATE_AND_RETURN(0, _sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	sqlite3_stmt* statement = makeStatement("SELECT COUNT(*) FROM ImageCacheEntry");
-	if (!statement)
-		return 0;
-
-	if (sqlite3_step(statement) == SQLITE_ROW)
-		numberOfRows = sqlite3_column_int(statement, 0);
+	SqliteStatement statement;
+	CHECK_AND_RETURN(0, statement.prepare(readDatabase(), "SELECT COUNT(*) FROM ImageCacheEntry"));
 
-	sqlite3_finalize(statement);
+	if (statement.step() == SQLITE_ROW)
+		numberOfRows = statement.columnInt(0);
 
 	_cachedNumberOfEntries = numberOfRows;
 
@@ -87,116 +252,468 @@ unsigned int PreviewsDatabase::numberOfPreviewEntries()
 bool PreviewsDatabase::uuidForIndex(uint32_t index, uuid_t& uuid)
 {
 	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
-	VALIDATE(index < _cachedNumberOfEntries, "Sqlite database is in an invalid state.");
 
-	return selectUuidColumnForIndex(index, uuid);
+	if (!_uuidsByIndexValid)
+	{
+		CHECK(selectUuidColumn());
+	}
+
+	VALIDATE(index < _uuidsByIndex.size(), "Index %u is out of range", index);
+
+	uuid = _uuidsByIndex[index];
+	return true;
 }
 
-const PreviewEntry* PreviewsDatabase::entryForUuid(const uuid_t& uuid)
+bool PreviewsDatabase::entryForUuid(const uuid_t& uuid, PreviewEntry& entry)
 {
-	VALIDATE_AND_RETURN(nullptr, _sqliteDatabase, "Sqlite database is in an invalid state.");
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
 
-	auto it = _cachedEntries.find(uuid);
-	if (it != _cachedEntries.end())
-		return it->second;
+	if (_entries.entryForUuid(uuid, entry))
+		return true;
 
 	std::string digest;
+	Orientation orientation;
 	std::vector<PreviewEntryLevel> levels;
 
-	if (!selectImageCacheEntryColumnsForUuid(uuid, digest) ||
+	if (!selectImageCacheEntryColumnsForUuid(uuid, digest, orientation) ||
 		!selectPyramidColumnsForUuid(uuid, levels))
 	{
-		return nullptr;
+		return false;
 	}
 
-	PreviewEntry* entry = new PreviewEntry(uuid, digest, levels);
-	_cachedEntries.insert(std::make_pair(uuid, entry));
+	// An entry the store can't pack is still handed back, it just isn't cached.
+	_entries.insert(uuid, digest, orientation, levels);
+	entry = PreviewEntry(uuid, digest, levels, orientation);
 
-	return entry;
+	return true;
 }
 
-bool PreviewsDatabase::checkEntriesAgainstCachedPreviews(const ICachedPreviews& cachedPreviews,
-	std::map<uuid_t, SyncAction>& uuidActions)
+bool PreviewsDatabase::loadAllEntries()
+{
+	// Builds every entry from a single ordered scan rather than two point queries
+	// per uuid. Entries which are already cached are refreshed in place.
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	const char* query = "SELECT PyramidLevel.uuid,ImageCacheEntry.digest,"
+		"ImageCacheEntry.orientation,PyramidLevel.level,PyramidLevel.longDimension "
+		"FROM PyramidLevel JOIN ImageCacheEntry ON "
+		"ImageCacheEntry.uuid=PyramidLevel.uuid AND ImageCacheEntry.digest=PyramidLevel.digest "
+		"ORDER BY PyramidLevel.uuid,PyramidLevel.digest,PyramidLevel.level";
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(readDatabase(), query));
+
+	_entries.reserve(numberOfPreviewEntries());
+
+	uuid_t uuid;
+	std::string digest;
+	Orientation orientation = Orientation_Normal;
+	std::vector<PreviewEntryLevel> levels;
+
+	auto insertEntry = [&]()
+	{
+		if (!levels.empty())
+			_entries.insert(uuid, digest, orientation, levels);
+
+		levels.clear();
+	};
+
+	while (statement.step() == SQLITE_ROW)
+	{
+		uuid_t rowUuid;
+		if (!statement.columnUuid(0, rowUuid))
+			continue;
+
+		if (uuid != rowUuid)
+		{
+			insertEntry();
+
+			uuid   = rowUuid;
+			digest = statement.columnString(1);
+			orientation = orientationFromLightroomCode(statement.columnText(2));
+		}
+
+		levels.push_back(PreviewEntryLevel(static_cast<int>(statement.columnDouble(3)),
+			statement.columnDouble(4)));
+	}
+	insertEntry();
+
+	return true;
+}
+
+bool PreviewsDatabase::pyramidTimeStamps(std::map<uuid_t, double>& timeStamps)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(readDatabase(), "SELECT uuid,pyramidFileTimeStamp FROM Pyramid"));
+
+	int stepResult;
+	while ((stepResult = statement.step()) == SQLITE_ROW)
+	{
+		uuid_t uuid;
+		if (!statement.columnUuid(0, uuid))
+			continue;
+
+		// A uuid with several pyramids is as new as its newest
+		double& timeStamp = timeStamps[uuid];
+		timeStamp = std::max(timeStamp, statement.columnDouble(1));
+	}
+
+	VALIDATE(stepResult == SQLITE_DONE, "Failed to read Pyramid. Reason: %s",
+		sqlite3_errstr(stepResult));
+
+	return true;
+}
+
+bool PreviewsDatabase::imageIds(std::map<int64_t, uuid_t>& uuidsByImageId)
 {
-	const char* query = "SELECT uuid FROM Pyramid";
-	sqlite3_stmt* statement = makeStatement(query);
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	SqliteStatement statement;
+	CHECK(statement.prepare(readDatabase(), "SELECT imageId,uuid FROM ImageCacheEntry"));
+
+	int stepResult;
+	while ((stepResult = statement.step()) == SQLITE_ROW)
+	{
+		uuid_t uuid;
+		if (statement.columnUuid(1, uuid))
+			uuidsByImageId[statement.columnInt64(0)] = uuid;
+	}
+
+	VALIDATE(stepResult == SQLITE_DONE, "Failed to read ImageCacheEntry. Reason: %s",
+		sqlite3_errstr(stepResult));
+
+	return true;
+}
+
+bool PreviewsDatabase::queryDataVersion(int64_t& dataVersion)
+{
+	// The copy never changes; what matters is the version it was taken at
+	if (_snapshotDatabase)
+	{
+		dataVersion = _snapshotDataVersion;
+		return true;
+	}
+
+	SqliteStatement* statement = cachedStatement("PRAGMA data_version");
 	CHECK(statement);
 
-	// Because we need to remove or add a preview, we need to check in both directions
-	// (db > cache and cache > db)
-	std::set<uuid_t> cachedUuids;
-	std::set<uuid_t>::iterator cachedIterator;
-	cachedPreviews.generateProxy(cachedUuids);
+	bool versionFound = false;
+	if (statement->step() == SQLITE_ROW)
+	{
+		dataVersion = statement->columnInt64(0);
+		versionFound = true;
+	}
+
+	statement->reset();
+
+	return versionFound;
+}
+
+bool PreviewsDatabase::hasChanged()
+{
+	// data_version only moves when another connection commits, so a watcher
+	// wakeup caused by anything else (a touch, a checkpoint) costs one pragma.
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	int64_t dataVersion;
+	if (!queryDataVersion(dataVersion))
+		return true;
+
+	if (dataVersion == _dataVersion)
+		return false;
+
+	_cachedNumberOfEntries = -1;
+	_uuidsByIndexValid = false;
+
+	// Any cached entry may have been rewritten, say under a new digest
+	_entries.clear();
+
+	return true;
+}
+
+bool PreviewsDatabase::checkChangedEntriesAgainstCachedPreviews(const ICachedPreviews& cachedPreviews,
+	std::map<uuid_t, SyncAction>& uuidActions, std::map<uuid_t, std::string>* digests)
+{
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	if (_rowidHighWaterMark < 0)
+		return checkEntriesAgainstCachedPreviews(cachedPreviews, uuidActions, digests);
+
+	// Both queries need to see the same snapshot
+	CHECK(sqlite3_exec(readDatabase(), "BEGIN", NULL, NULL, NULL) == SQLITE_OK);
+
+	int64_t dataVersion = _dataVersion;
+	queryDataVersion(dataVersion);
+
+	SqliteStatement* statement = cachedStatement("SELECT uuid,rowid,pyramidFileTimeStamp,digest FROM Pyramid "
+		"WHERE rowid>? OR pyramidFileTimeStamp>?");
+	if (!statement)
+	{
+		sqlite3_exec(readDatabase(), "COMMIT", NULL, NULL, NULL);
+		return false;
+	}
+
+	statement->bindInt64(1, _rowidHighWaterMark);
+	statement->bindDouble(2, _fileTimeStampHighWaterMark);
+
+	int64_t rowidHighWaterMark = _rowidHighWaterMark;
+	double fileTimeStampHighWaterMark = _fileTimeStampHighWaterMark;
+	int64_t numberOfNewRows = 0;
+
+	// The newest digest seen for each changed uuid, along with its time stamp
+	std::map<uuid_t, std::pair<std::string, double>> changedDigests;
+	int stepResult;
+	while ((stepResult = statement->step()) == SQLITE_ROW)
+	{
+		int64_t rowid = statement->columnInt64(1);
+		if (rowid > _rowidHighWaterMark)
+			++numberOfNewRows;
+
+		double fileTimeStamp = statement->columnDouble(2);
+		rowidHighWaterMark = std::max<int64_t>(rowidHighWaterMark, rowid);
+		fileTimeStampHighWaterMark = std::max(fileTimeStampHighWaterMark, fileTimeStamp);
+
+		uuid_t uuid;
+		if (!statement->columnUuid(0, uuid))
+			continue;
+
+		auto changed = changedDigests.find(uuid);
+		if (changed == changedDigests.end() || changed->second.second < fileTimeStamp)
+			changedDigests[uuid] = std::make_pair(statement->columnString(3), fileTimeStamp);
+	}
+	statement->reset();
+
+	if (stepResult != SQLITE_DONE)
+	{
+		Logger::get().log(Logger::ERROR, "Failed to read Pyramid. Reason: %s",
+			sqlite3_errstr(stepResult));
+		sqlite3_exec(readDatabase(), "COMMIT", NULL, NULL, NULL);
+		return false;
+	}
+
+	int64_t pyramidRowCount = -1;
+	statement = cachedStatement("SELECT COUNT(*) FROM Pyramid");
+	if (statement && statement->step() == SQLITE_ROW)
+		pyramidRowCount = statement->columnInt64(0);
+
+	if (statement)
+		statement->reset();
+
+	sqlite3_exec(readDatabase(), "COMMIT", NULL, NULL, NULL);
+
+	// Deleted rows leave no trace past the marks, but they do leave the table
+	// smaller than expected. Only a full diff can say which ones went.
+	if (pyramidRowCount != _pyramidRowCount + numberOfNewRows)
+	{
+		Logger::get().log(Logger::DEBUG, "Pyramid rows were removed, falling back to a full diff");
+		return checkEntriesAgainstCachedPreviews(cachedPreviews, uuidActions, digests);
+	}
+
+	for (auto& changed : changedDigests)
+	{
+		std::string cachedDigest;
+		if (!cachedPreviews.digestForUuid(changed.first, cachedDigest))
+			uuidActions.insert(std::make_pair(changed.first, SyncAction_Add));
+		else if (isStaleDigest(cachedDigest, changed.second.first))
+			uuidActions.insert(std::make_pair(changed.first, SyncAction_Update));
+		else
+			continue;
+
+		if (digests)
+			(*digests)[changed.first] = changed.second.first;
+	}
+
+	_dataVersion = dataVersion;
+	_pyramidRowCount = pyramidRowCount;
+	_rowidHighWaterMark = rowidHighWaterMark;
+	_fileTimeStampHighWaterMark = fileTimeStampHighWaterMark;
+
+	return true;
+}
+
+bool PreviewsDatabase::checkEntriesAgainstCachedPreviews(const ICachedPreviews& cachedPreviews,
+	std::map<uuid_t, SyncAction>& uuidActions, std::map<uuid_t, std::string>* digests)
+{
+	return diffAgainstCachedPreviews(cachedPreviews,
+		[&uuidActions, digests](const uuid_t& uuid, SyncAction action, const std::string& digest)
+	{
+		uuidActions.insert(std::make_pair(uuid, action));
+
+		if (digests)
+			(*digests)[uuid] = digest;
+	});
+}
+
+bool PreviewsDatabase::diffAgainstCachedPreviews(const ICachedPreviews& cachedPreviews,
+	const SyncActionCallback& callback)
+{
+	// Merge-joins Pyramid and the cache, both read in uuid order, so neither side
+	// is held in memory. Lightroom writes uuids in upper case, which makes the
+	// index order of both tables the same as Uuid's ordering.
+	VALIDATE(_sqliteDatabase, "Sqlite database is in an invalid state.");
+
+	// Read the version first, so a commit landing mid-diff is picked up next time
+	int64_t dataVersion = -1;
+	queryDataVersion(dataVersion);
+
+	const char* query = "SELECT uuid,rowid,pyramidFileTimeStamp,digest FROM Pyramid ORDER BY uuid";
+	SqliteStatement statement;
+	CHECK(statement.prepare(readDatabase(), query));
+
+	ICachedUuidCursor* cursor = cachedPreviews.createOrderedCursor();
+	CHECK(cursor);
+
+	int64_t pyramidRowCount = 0;
+	int64_t rowidHighWaterMark = 0;
+	double fileTimeStampHighWaterMark = 0.0;
+
+	uuid_t cachedUuid;
+	std::string cachedDigest;
+	bool hasCachedUuid = cursor->next(cachedUuid, cachedDigest);
 
-	while (sqlite3_step(statement) == SQLITE_ROW)
+	// Pyramid has a row per digest, so rows are gathered per uuid and the most
+	// recently written digest is the one compared with the cache.
+	uuid_t groupUuid;
+	std::string groupDigest;
+	double groupFileTimeStamp = 0.0;
+	bool hasGroup = false;
+
+	auto emitGroup = [&]()
 	{
-		const char* uuid = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
-		cachedIterator = cachedUuids.find(uuid);
-		if (cachedIterator == cachedUuids.end())
+		// Anything cached which sorts before this uuid has gone from previews.db
+		while (hasCachedUuid && cachedUuid < groupUuid)
 		{
-			// Uuid not in cache - mark as add
-			uuidActions.insert(std::make_pair(std::string(uuid), SyncAction_Add));
+			callback(cachedUuid, SyncAction_Remove, cachedDigest);
+			hasCachedUuid = cursor->next(cachedUuid, cachedDigest);
+		}
+
+		if (hasCachedUuid && cachedUuid == groupUuid)
+		{
+			if (isStaleDigest(cachedDigest, groupDigest))
+				callback(groupUuid, SyncAction_Update, groupDigest);
+
+			hasCachedUuid = cursor->next(cachedUuid, cachedDigest);
 		}
 		else
 		{
-			// Uuid in cache - do nothing
-			cachedUuids.erase(cachedIterator);
+			callback(groupUuid, SyncAction_Add, groupDigest);
 		}
+	};
+
+	bool ordered = true;
+
+	int stepResult;
+	while ((stepResult = statement.step()) == SQLITE_ROW)
+	{
+		++pyramidRowCount;
+
+		double fileTimeStamp = statement.columnDouble(2);
+		rowidHighWaterMark = std::max<int64_t>(rowidHighWaterMark, statement.columnInt64(1));
+		fileTimeStampHighWaterMark = std::max(fileTimeStampHighWaterMark, fileTimeStamp);
+
+		uuid_t uuid;
+		if (!statement.columnUuid(0, uuid))
+		{
+			Logger::get().log(Logger::ERROR, "Skipping malformed uuid '%s'",
+				statement.columnText(0));
+			continue;
+		}
+
+		if (hasGroup && uuid == groupUuid)
+		{
+			if (fileTimeStamp > groupFileTimeStamp)
+			{
+				groupDigest = statement.columnString(3);
+				groupFileTimeStamp = fileTimeStamp;
+			}
+			continue;
+		}
+
+		if (hasGroup && uuid < groupUuid)
+		{
+			ordered = false;
+			break;
+		}
+
+		if (hasGroup)
+			emitGroup();
+
+		groupUuid = uuid;
+		groupDigest = statement.columnString(3);
+		groupFileTimeStamp = fileTimeStamp;
+		hasGroup = true;
 	}
-	sqlite3_finalize(statement);
+	statement.finalize();
+
+	// A scan cut short (typically SQLITE_BUSY while Lightroom writes) would
+	// otherwise turn every unvisited row into a removal.
+	bool scanned = ordered && stepResult == SQLITE_DONE;
+	if (scanned && hasGroup)
+		emitGroup();
 
-	// Now cachedUuids contains entries from the cache which no longer are in the previews.db
-	for (auto uuid : cachedUuids)
+	// Whatever is left in the cache no longer exists in previews.db
+	while (scanned && hasCachedUuid)
 	{
-		uuidActions.insert(std::make_pair(uuid, SyncAction_Remove));
+		callback(cachedUuid, SyncAction_Remove, cachedDigest);
+		hasCachedUuid = cursor->next(cachedUuid, cachedDigest);
 	}
 
+	delete cursor;
+
+	VALIDATE(ordered, "Pyramid uuids are not in order");
+	VALIDATE(stepResult == SQLITE_DONE, "Failed to read Pyramid. Reason: %s",
+		sqlite3_errstr(stepResult));
+
+	_dataVersion = dataVersion;
+	_pyramidRowCount = pyramidRowCount;
+	_rowidHighWaterMark = rowidHighWaterMark;
+	_fileTimeStampHighWaterMark = fileTimeStampHighWaterMark;
+
 	return true;
 }
 
-bool PreviewsDatabase::selectUuidColumnForIndex(uint32_t index, uuid_t& uuid)
+bool PreviewsDatabase::selectUuidColumn()
 {
-	const char* queryFormat = "SELECT uuid FROM ImageCacheEntry LIMIT 1 OFFSET %d";
+	SqliteStatement statement;
+	CHECK(statement.prepare(readDatabase(), "SELECT uuid FROM ImageCacheEntry"));
 
-	char queryBuffer[128];
-	int written = snprintf(queryBuffer, 128, queryFormat, index);
-	VALIDATE(written < 128, "Buffer overflow");
-
-	sqlite3_stmt* statement = makeStatement(queryBuffer);
-	CHECK(statement);
+	_uuidsByIndex.clear();
+	if (_cachedNumberOfEntries > 0)
+		_uuidsByIndex.reserve(_cachedNumberOfEntries);
 
-	bool recordsFound = false;
-	if (sqlite3_step(statement) == SQLITE_ROW)
+	while (statement.step() == SQLITE_ROW)
 	{
-		uuid   = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
-		recordsFound = true;
+		// Malformed uuids keep their index as a nil uuid so the indices still line up
+		uuid_t uuid;
+		statement.columnUuid(0, uuid);
+		_uuidsByIndex.push_back(uuid);
 	}
 
-	sqlite3_finalize(statement);
+	_uuidsByIndexValid = true;
 
-	return recordsFound;
+	return true;
 }
 
 bool PreviewsDatabase::selectImageCacheEntryColumnsForUuid(const uuid_t& uuid,
-	std::string& digest)
+	std::string& digest, Orientation& orientation)
 {
-	const char* queryFormat = "SELECT digest FROM ImageCacheEntry WHERE uuid='%s'";
-
-	char queryBuffer[128];
-	int written = snprintf(queryBuffer, 128, queryFormat, uuid.c_str());
-	VALIDATE(written < 128, "Buffer overflow");
-
-	sqlite3_stmt* statement = makeStatement(queryBuffer);
+	SqliteStatement* statement = cachedStatement(
+		"SELECT digest,orientation FROM ImageCacheEntry WHERE uuid=?");
 	CHECK(statement);
 
+	statement->bindUuid(1, uuid);
+
 	bool recordsFound = false;
-	if (sqlite3_step(statement) == SQLITE_ROW)
+	if (statement->step() == SQLITE_ROW)
 	{
-		digest = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+		digest = statement->columnString(0);
+		orientation = orientationFromLightroomCode(statement->columnText(1));
 		recordsFound = true;
 	}
 
-	sqlite3_finalize(statement);
+	statement->reset();
 
 	return recordsFound;
 }
@@ -204,27 +721,23 @@ bool PreviewsDatabase::selectImageCacheEntryColumnsForUuid(const uuid_t& uuid,
 bool PreviewsDatabase::selectPyramidColumnsForUuid(const uuid_t& uuid,
 	std::vector<PreviewEntryLevel>& levels)
 {
-	const char* queryFormat = "SELECT level,longDimension FROM PyramidLevel WHERE "
-                               "uuid='%s'";
-
-	char queryBuffer[128];
-	int written = snprintf(queryBuffer, 128, queryFormat, uuid.c_str());
-	VALIDATE(written < 128, "Buffer overflow");
-
-	sqlite3_stmt* statement = makeStatement(queryBuffer);
+	SqliteStatement* statement = cachedStatement(
+		"SELECT level,longDimension FROM PyramidLevel WHERE uuid=?");
 	CHECK(statement);
 
+	statement->bindUuid(1, uuid);
+
 	bool recordsFound = false;
-	while (sqlite3_step(statement) == SQLITE_ROW)
+	while (statement->step() == SQLITE_ROW)
 	{
-		PreviewEntryLevel level(static_cast<int>(sqlite3_column_double(statement, 0)),
-			sqlite3_column_double(statement, 1));
+		PreviewEntryLevel level(static_cast<int>(statement->columnDouble(0)),
+			statement->columnDouble(1));
 
 		levels.push_back(level);
 		recordsFound = true;
 	}
 
-	sqlite3_finalize(statement);
+	statement->reset();
 
 	return recordsFound;
 }
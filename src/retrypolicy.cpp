@@ -0,0 +1,34 @@
+#include "retrypolicy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace enlighten
+{
+namespace lib
+{
+bool RetryPolicy::shouldRetry(uint32_t retries) const
+{
+	return retries < maxRetries;
+}
+
+uint32_t RetryPolicy::delayForRetry(uint32_t retries) const
+{
+	thread_local std::mt19937 generator(std::random_device{}());
+
+	// Past 31 doublings the shift overflows, and the cap applies anyway
+	uint64_t delay = static_cast<uint64_t>(baseDelayMs) << std::min<uint32_t>(retries, 31);
+	delay = std::min<uint64_t>(delay, maxDelayMs);
+
+	std::uniform_int_distribution<uint64_t> jitter(0, delay / 2);
+	return static_cast<uint32_t>(delay - jitter(generator));
+}
+
+int64_t RetryPolicy::currentTimeMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+} // lib
+} // enlighten
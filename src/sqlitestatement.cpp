@@ -0,0 +1,193 @@
+#include "sqlitestatement.h"
+#include "validation.h"
+
+#include <atomic>
+#include <chrono>
+
+#include "sqlite3.h"
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	std::atomic<AbstractSqliteTimingDelegate*> timingDelegate(nullptr);
+}
+
+SqliteStatement::SqliteStatement() : _statement(nullptr), _elapsedMicroseconds(0),
+	_numberOfSteps(0)
+{
+}
+
+SqliteStatement::~SqliteStatement()
+{
+	finalize();
+}
+
+SqliteStatement::SqliteStatement(SqliteStatement&& other) : _statement(other._statement),
+	_elapsedMicroseconds(other._elapsedMicroseconds), _numberOfSteps(other._numberOfSteps)
+{
+	other._statement = nullptr;
+	other._numberOfSteps = 0;
+}
+
+SqliteStatement& SqliteStatement::operator=(SqliteStatement&& other)
+{
+	if (this != &other)
+	{
+		finalize();
+
+		_statement = other._statement;
+		_elapsedMicroseconds = other._elapsedMicroseconds;
+		_numberOfSteps = other._numberOfSteps;
+
+		other._statement = nullptr;
+		other._numberOfSteps = 0;
+	}
+
+	return *this;
+}
+
+void SqliteStatement::setTimingDelegate(AbstractSqliteTimingDelegate* delegate)
+{
+	timingDelegate = delegate;
+}
+
+bool SqliteStatement::prepare(sqlite3* database, const char* query)
+{
+	finalize();
+
+	VALIDATE(database, "Sqlite database is in an invalid state.");
+
+	int statementResult = sqlite3_prepare_v2(database, query, -1, &_statement, NULL);
+	if (statementResult != SQLITE_OK)
+	{
+		sqlite3_finalize(_statement);
+		_statement = nullptr;
+	}
+
+	VALIDATE(statementResult == SQLITE_OK, "Statement '%s' error. Reason: %s",
+		query, sqlite3_errmsg(database));
+
+	return true;
+}
+
+void SqliteStatement::finalize()
+{
+	if (!_statement)
+		return;
+
+	reportExecution();
+
+	sqlite3_finalize(_statement);
+	_statement = nullptr;
+}
+
+int SqliteStatement::step()
+{
+	if (!_statement)
+		return SQLITE_MISUSE;
+
+	if (!timingDelegate.load())
+		return sqlite3_step(_statement);
+
+	auto start = std::chrono::steady_clock::now();
+	int stepResult = sqlite3_step(_statement);
+
+	_elapsedMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	++_numberOfSteps;
+
+	return stepResult;
+}
+
+void SqliteStatement::reset()
+{
+	if (!_statement)
+		return;
+
+	reportExecution();
+
+	sqlite3_reset(_statement);
+	sqlite3_clear_bindings(_statement);
+}
+
+void SqliteStatement::bindText(int parameter, const std::string& text)
+{
+	sqlite3_bind_text(_statement, parameter, text.c_str(), static_cast<int>(text.length()),
+		SQLITE_TRANSIENT);
+}
+
+void SqliteStatement::bindUuid(int parameter, const uuid_t& uuid)
+{
+	char buffer[Uuid::kStringLength + 1];
+	uuid.format(buffer);
+
+	sqlite3_bind_text(_statement, parameter, buffer, Uuid::kStringLength, SQLITE_TRANSIENT);
+}
+
+void SqliteStatement::bindNull(int parameter)
+{
+	sqlite3_bind_null(_statement, parameter);
+}
+
+void SqliteStatement::bindInt64(int parameter, int64_t value)
+{
+	sqlite3_bind_int64(_statement, parameter, value);
+}
+
+void SqliteStatement::bindDouble(int parameter, double value)
+{
+	sqlite3_bind_double(_statement, parameter, value);
+}
+
+int SqliteStatement::columnInt(int column) const
+{
+	return sqlite3_column_int(_statement, column);
+}
+
+int64_t SqliteStatement::columnInt64(int column) const
+{
+	return sqlite3_column_int64(_statement, column);
+}
+
+double SqliteStatement::columnDouble(int column) const
+{
+	return sqlite3_column_double(_statement, column);
+}
+
+const char* SqliteStatement::columnText(int column) const
+{
+	return reinterpret_cast<const char*>(sqlite3_column_text(_statement, column));
+}
+
+std::string SqliteStatement::columnString(int column) const
+{
+	const char* text = columnText(column);
+	return text ? text : "";
+}
+
+bool SqliteStatement::columnUuid(int column, uuid_t& uuid) const
+{
+	// The text has to be fetched before its length is valid
+	const char* text = columnText(column);
+	return Uuid::fromString(text, sqlite3_column_bytes(_statement, column), uuid);
+}
+
+const char* SqliteStatement::query() const
+{
+	return _statement ? sqlite3_sql(_statement) : "";
+}
+
+void SqliteStatement::reportExecution()
+{
+	AbstractSqliteTimingDelegate* delegate = timingDelegate.load();
+	if (delegate && _numberOfSteps > 0)
+		delegate->statementExecuted(query(), _elapsedMicroseconds, _numberOfSteps);
+
+	_elapsedMicroseconds = 0;
+	_numberOfSteps = 0;
+}
+} // lib
+} // enlighten
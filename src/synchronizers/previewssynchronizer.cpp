@@ -1,29 +1,126 @@
 #include "synchronizers/previewssynchronizer.h"
 #include "previewsdatabase.h"
 #include "cachedpreviews.h"
+#include "cachedpreviewswriter.h"
 #include "jpegcruncher.h"
 #include "lrprev.h"
 #include "jpeg.h"
 #include "file.h"
 #include "settings.h"
 #include "aws/aws.h"
+#include "boundedqueue.h"
+#include "circuitbreaker.h"
+#include "memorybudget.h"
 #include "logger.h"
 
 #include "validation.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstring>
 #include <cstdlib>
+#include <memory>
+#include <unordered_map>
 
 namespace enlighten
 {
 namespace lib
 {
+namespace
+{
+	// Beyond this many changes it's cheaper to scan the whole of previews.db once
+	// than to look each entry up individually.
+	const size_t kBulkLoadThreshold = 64;
+
+	const uint32_t kMaxStageWorkers = 32;
+
+	// Reading a preview is a short file read, so a couple of readers keep
+	// the executor fed
+	const uint32_t kReadWorkers = 2;
+
+	// Uploads spend most of their time waiting on the network
+	const int32_t kDefaultUploadWorkers = 4;
+
+	// How far adaptive concurrency may go. Outstanding crunches beyond the
+	// executor's workers only queue, but a few extra keep it busy.
+	const uint32_t kMaxUploadConcurrency = 16;
+	const uint32_t kCrunchesPerExecutorWorker = 2;
+
+	// Smaller decodes tried when memory is short, as libjpeg scales by 1/2, 1/4 and 1/8
+	const uint32_t kMaxDecodeScaleDenominator = 8;
+
+	const uint64_t kBytesPerMegabyte = 1024 * 1024;
+
+	// A pass holds this many previews in memory per cruncher and uploader
+	const uint32_t kQueueDepthPerWorker = 2;
+
+	// Readers waiting for room recheck for cancellation this often
+	const uint32_t kSlotWaitMs = 100;
+
+	// Uploads mostly fail while the destination or the network is down, which
+	// is worth waiting out. Reading or crunching a preview only fails again
+	// until Lightroom rewrites it.
+	const RetryPolicy kUploadRetryPolicy = { 8, 2000, 15 * 60 * 1000 };
+	const RetryPolicy kProcessingRetryPolicy = { 3, 60 * 1000, 60 * 60 * 1000 };
+
+	// However retries fall due, passes for them start at most this often
+	const int64_t kMinRetryIntervalMs = 1000;
+
+	std::string objectKeyForEntry(const PreviewEntry& entry)
+	{
+		std::string key = entry.filePathRelativeToRoot();
+
+		// Replace the extension
+		size_t extensionIndex = key.rfind(".lrprev");
+		if (extensionIndex != std::string::npos)
+		{
+			key.replace(extensionIndex, strlen(".lrprev"), ".jpg");
+		}
+
+		return key;
+	}
+
+	// The configured worker count is where the limit starts, or where it stays
+	// when adaptive concurrency is off
+	ConcurrencyLimiter* createLimiter(IEnlightenSettings* settings, IEnlightenSettings::Setting setting,
+		int32_t defaultLimit, uint32_t maxLimit)
+	{
+		int32_t configured = settings->get(setting, defaultLimit);
+		uint32_t initialLimit = std::min<uint32_t>(configured > 0 ? configured : defaultLimit,
+			kMaxStageWorkers);
+
+		if (settings->get(IEnlightenSettings::AdaptiveConcurrency, 1) == 0)
+			return new ConcurrencyLimiter(initialLimit, initialLimit, initialLimit);
+
+		return new ConcurrencyLimiter(initialLimit, 1, std::max(initialLimit, maxLimit));
+	}
+
+	double millisecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+}
+
 PreviewsSynchronizer::PreviewsSynchronizer(IEnlightenSettings* settings, IAws* aws) :
 	_previewsDatabase(new PreviewsDatabase()),
 	_cachedPreviews(new CachedPreviews(settings)),
-	_settings(settings), _aws(aws), _watcher(nullptr),
-	_previewsDatabaseFile(nullptr), _state(Idle)
+	_cachedPreviewsWriter(new CachedPreviewsWriter(_cachedPreviews)),
+	_settings(settings), _aws(aws), _executorGroup(Executor::get().createGroup()),
+	_jobPrioritizer(new RequestedPrioritizer()), _orderPrioritizer(nullptr), _watcher(nullptr),
+	_previewsDatabaseFile(nullptr), _passRunning(false), _changesPending(false), _state(Idle)
 {
+	uint32_t executorWorkers = Executor::get().numberOfWorkers();
+
+	_crunchLimiter = createLimiter(settings, IEnlightenSettings::CrunchWorkerCount,
+		static_cast<int32_t>(executorWorkers), executorWorkers * kCrunchesPerExecutorWorker);
+	_uploadLimiter = createLimiter(settings, IEnlightenSettings::UploadWorkerCount,
+		kDefaultUploadWorkers, kMaxUploadConcurrency);
+
+	// The budget is shared by every synchronizer, and left at its default unless configured
+	int32_t memoryBudget = settings->get(IEnlightenSettings::MemoryBudgetMegabytes, 0);
+	if (memoryBudget > 0)
+		MemoryBudget::get().setCapacity(static_cast<uint64_t>(memoryBudget) * kBytesPerMegabyte);
 }
 
 PreviewsSynchronizer::~PreviewsSynchronizer()
@@ -31,7 +128,13 @@ PreviewsSynchronizer::~PreviewsSynchronizer()
 	if (_state == Synchronizing)
 		stopAndCleanup();
 
+	Executor::get().removeGroup(_executorGroup);
+
+	delete _jobPrioritizer;
+	delete _uploadLimiter;
+	delete _crunchLimiter;
 	delete _previewsDatabase;
+	delete _cachedPreviewsWriter;
 	delete _cachedPreviews;
 }
 
@@ -46,6 +149,9 @@ bool PreviewsSynchronizer::beginSynchronizingFile(const std::string& file,
 	_previewsDatabaseFile = new File(file);
 	_awsDestinationIdentifier = awsDestinationIdentifier;
 
+	_orderPrioritizer = createOrderPrioritizer(file);
+	_jobPrioritizer->setFallback(_orderPrioritizer);
+
 	int32_t pollRate = _settings->get(IEnlightenSettings::WatcherPollRate, 5000);
 	_watcher = new Watcher(_previewsDatabaseFile, this);
 	_watcher->beginWatchingForChanges(pollRate);
@@ -54,6 +160,21 @@ bool PreviewsSynchronizer::beginSynchronizingFile(const std::string& file,
 
 	_state = Synchronizing;
 
+	// Dead lettered jobs get another round of retries each time we start,
+	// unless that's turned off
+	if (_settings->get(IEnlightenSettings::RequeueDeadLetteredJobs, 1) != 0)
+		_cachedPreviews->requeueDeadLetteredJobs();
+
+	// Work left over from the last run goes first, and the diff which would
+	// have found it again follows once it's done. Jobs still backing off wait
+	// their turn.
+	std::map<uuid_t, SyncAction>* resumedJobs = resumeJobs();
+	if (resumedJobs)
+	{
+		startPass(resumedJobs, true);
+		return true;
+	}
+
 	// Synchronize now
 	return processChanges();
 }
@@ -72,7 +193,13 @@ void PreviewsSynchronizer::stopAndCleanup()
 {
 	if (_workerThread.joinable())
 	{
-		_cancelWorking = true;
+		{
+			std::lock_guard<std::mutex> autolock(_mutex);
+			_cancelWorking = true;
+		}
+
+		// The worker may be waiting for a retry to come due
+		_passCondition.notify_all();
 		_workerThread.join();
 	}
 
@@ -89,177 +216,793 @@ void PreviewsSynchronizer::stopAndCleanup()
 		delete _previewsDatabaseFile;
 		_previewsDatabaseFile = nullptr;
 	}
+
+	_jobPrioritizer->setFallback(nullptr);
+	delete _orderPrioritizer;
+	_orderPrioritizer = nullptr;
 }
 
 bool PreviewsSynchronizer::fileHasChanged(Watcher* watcher, const IFile* file)
 {
-	auto workerFuture = _workerPromise.get_future();
-	auto status       = workerFuture.wait_for(std::chrono::milliseconds(0));
+	if (_state != Synchronizing)
+		return false;
 
-	if (_workerThread.joinable() && status == std::future_status::ready)
+	// However many changes arrive during a pass, they're picked up by one
+	// diff as soon as it completes rather than on a later poll.
 	{
-		_workerThread.join();
-	}
-	else
-	{
-		return false;
+		std::lock_guard<std::mutex> autolock(_mutex);
+		if (_passRunning)
+		{
+			_changesPending = true;
+			_passCondition.notify_all();
+			return true;
+		}
 	}
 
+	// Wakeups which find nothing to do don't start a worker, so there may be
+	// no thread to wait on.
+	if (_workerThread.joinable())
+		_workerThread.join();
+
 	processChanges();
 
 	return true;
 }
 
+void PreviewsSynchronizer::requestPreview(const uuid_t& uuid)
+{
+	_jobPrioritizer->request(uuid);
+
+	// The running pass takes it next, if it's part of the pass
+	std::lock_guard<std::mutex> autolock(_mutex);
+	_requestedUuids.push_back(uuid);
+}
+
 bool PreviewsSynchronizer::processChanges()
 {
-	Logger::get().log(Logger::INFO, "Processing changes");
+	std::map<uuid_t, SyncAction>* uuidActions = collectChanges();
 
-	CHECK(_previewsDatabase->reopen());
+	// With nothing to do now but retries to come, the worker just waits for them
+	int64_t retryAt;
+	if (uuidActions || _cachedPreviews->earliestRetry(retryAt))
+		startPass(uuidActions, false);
 
-	std::map<uuid_t, SyncAction>* uuidActions = new std::map<uuid_t, SyncAction>;
-	CHECK(_previewsDatabase->checkEntriesAgainstCachedPreviews(*_cachedPreviews, *uuidActions));
+	return true;
+}
+
+void PreviewsSynchronizer::startPass(std::map<uuid_t, SyncAction>* entries, bool followUp)
+{
+	if (entries && entries->size() > kBulkLoadThreshold)
+		_previewsDatabase->loadAllEntries();
 
-	if (uuidActions->size() > 0)
+	// Kick off the worker thread
 	{
-		// This little lovely allows us to call this->processedUuid from the worker thread.
-		auto uuidProcessCallback = std::bind(&PreviewsSynchronizer::processedUuid,
-			this, std::placeholders::_1);
-		auto errorProcessingCallback = std::bind(&PreviewsSynchronizer::errorProcessingUuid,
-			this, std::placeholders::_1, std::placeholders::_2);
+		std::lock_guard<std::mutex> autolock(_mutex);
+		_changesPending = followUp;
+		_passRunning = true;
+	}
 
-		Logger::get().log(Logger::INFO, "%u changes found. Processing...", uuidActions->size());
+	_cancelWorking = false;
+	_workerThread = std::thread(&PreviewsSynchronizer::synchronizeChanges, this, entries);
+}
 
-		// Kick off the worker thread
-		_workerPromise = std::promise<bool>();
-		_cancelWorking = false;
-		_workerThread  = std::thread(&PreviewsSynchronizer::crunchAndUpload, this,
-			uuidActions, uuidProcessCallback, errorProcessingCallback);
-	}
+std::map<uuid_t, SyncAction>* PreviewsSynchronizer::resumeJobs()
+{
+	std::vector<SyncJob> jobs;
+	if (!_cachedPreviews->dueJobs(RetryPolicy::currentTimeMs(), jobs) || jobs.empty())
+		return nullptr;
 
-	return true;
+	Logger::get().log(Logger::INFO, "Resuming %u unfinished jobs", static_cast<uint32_t>(jobs.size()));
+
+	std::map<uuid_t, SyncAction>* entries = new std::map<uuid_t, SyncAction>;
+	for (const SyncJob& job : jobs)
+		(*entries)[job.uuid] = job.action;
+
+	return entries;
 }
 
-void PreviewsSynchronizer::crunchAndUpload(std::map<uuid_t, SyncAction>* entries, SuccessCallbackFunc processedUuidCallback,
-		 ErrorCallbackFunc processingErrorCallback)
+std::map<uuid_t, SyncAction>* PreviewsSynchronizer::collectChanges()
 {
-	if (!entries)
+	std::map<uuid_t, SyncAction>* uuidActions = new std::map<uuid_t, SyncAction>;
+
+	// The connection stays open between wakeups, so an unchanged data version
+	// means nothing has been committed since the last diff.
+	if (_previewsDatabase->hasChanged())
 	{
-		_workerPromise.set_value(true);
-		return;
+		Logger::get().log(Logger::INFO, "Processing changes");
+
+		// The whole pass, worker included, reads from one copy of previews.db. If
+		// the copy can't be taken the pass reads the live database as before.
+		if (_settings->get(IEnlightenSettings::SnapshotPreviewsDatabase, 1) != 0 &&
+			!_previewsDatabase->beginSnapshot())
+		{
+			Logger::get().log(Logger::WARNING, "Reading the live previews database");
+		}
+
+		std::map<uuid_t, SyncAction> changes;
+		std::map<uuid_t, std::string> digests;
+		if (!_previewsDatabase->checkChangedEntriesAgainstCachedPreviews(*_cachedPreviews, changes, &digests))
+		{
+			_previewsDatabase->endSnapshot();
+			delete uuidActions;
+			return nullptr;
+		}
+
+		// Journalled before any work starts, so a restart resumes the pass instead
+		// of relying on a diff to find it again. Changes which can't be journalled
+		// are processed all the same, but aren't retried.
+		if (!changes.empty() && !_cachedPreviews->journalJobs(changes, digests))
+		{
+			Logger::get().log(Logger::WARNING, "Processing changes without journalling them");
+			uuidActions->swap(changes);
+		}
+	}
+	else
+	{
+		Logger::get().log(Logger::DEBUG, "Previews database is unchanged");
 	}
 
-	auto it = entries->begin();
-	for (; it != entries->end() && !_cancelWorking; it++)
+	// The pass is whatever the journal has due: what was just diffed and any
+	// earlier failures whose backoff is over. Jobs still backing off stay out,
+	// even when a full diff finds them again.
+	std::vector<SyncJob> dueJobs;
+	_cachedPreviews->dueJobs(RetryPolicy::currentTimeMs(), dueJobs);
+	for (const SyncJob& job : dueJobs)
+		uuidActions->insert(std::make_pair(job.uuid, job.action));
+
+	if (uuidActions->empty())
 	{
-		Logger::get().log(Logger::INFO, "Crunching uuid %s", it->first.c_str());
+		_previewsDatabase->endSnapshot();
+		delete uuidActions;
+		return nullptr;
+	}
+
+	Logger::get().log(Logger::INFO, "%u changes found. Processing...",
+		static_cast<uint32_t>(uuidActions->size()));
 
-		// load it
-		const PreviewEntry* entry;
+	return uuidActions;
+}
+
+void PreviewsSynchronizer::synchronizeChanges(std::map<uuid_t, SyncAction>* entries)
+{
+	// This little lovely allows us to call this->processedUuid from the worker thread.
+	auto uuidProcessCallback = std::bind(&PreviewsSynchronizer::processedUuid,
+		this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+	auto errorProcessingCallback = std::bind(&PreviewsSynchronizer::errorProcessingUuid,
+		this, std::placeholders::_1, std::placeholders::_2);
+
+	while (true)
+	{
+		if (entries)
 		{
-			std::lock_guard<std::mutex> autolock(_mutex);
-			entry =  _previewsDatabase->entryForUuid(it->first);
+			crunchAndUpload(*entries, uuidProcessCallback, errorProcessingCallback);
+
+			// Delete the memory holding the entries
+			delete entries;
+			entries = nullptr;
 		}
 
-		if (!entry)
+		int64_t passEnded = RetryPolicy::currentTimeMs();
+
+		// Checked and cleared together with fileHasChanged's check, so a change
+		// either lands in the follow-up pass or finds no pass running. Failed
+		// jobs are waited for here, and a change arriving meanwhile is diffed
+		// along with whatever retries are due by then.
 		{
-			processingErrorCallback(it->first, "Failed to find entry '"+ it->first +"' in database");
-			continue;
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			bool retryDue = false;
+			int64_t retryAt;
+			while (!_cancelWorking && !_changesPending && _cachedPreviews->earliestRetry(retryAt))
+			{
+				int64_t waitMs = std::max(retryAt, passEnded + kMinRetryIntervalMs) -
+					RetryPolicy::currentTimeMs();
+				if (waitMs <= 0)
+				{
+					retryDue = true;
+					break;
+				}
+
+				_passCondition.wait_for(lock, std::chrono::milliseconds(waitMs));
+			}
+
+			if (_cancelWorking || (!_changesPending && !retryDue))
+			{
+				_passRunning = false;
+				break;
+			}
+
+			_changesPending = false;
 		}
 
-		std::string basePath = pathOfPreviewsDatabaseFile();
+		Logger::get().log(Logger::INFO, "Following up on changes and retries");
+		entries = collectChanges();
+	}
+}
+
+// One uuid on its way through the pipeline. Removals carry no image and go
+// straight from the readers to the uploaders.
+struct PreviewsSynchronizer::PipelineItem
+{
+	uuid_t uuid;
+	SyncAction action;
+	std::string cachedDigest;
+	PreviewEntry entry;
+
+	std::shared_ptr<uint8_t> extractedJpeg;
+	uint32_t extractedJpegSize;
+
+	// Decoded at 1/decodeScale of the size, smaller when memory is short
+	uint32_t decodeScale;
 
-		LrPrev prev;
-		const std::string& filePath = basePath + entry->filePathRelativeToRoot();
-		if (!prev.initialiseWithFile(filePath.c_str()))
+	std::shared_ptr<Jpeg> crunchedJpeg;
+
+	// Covers whichever of the buffers above the item holds at the time
+	MemoryReservation memory;
+};
+
+struct PreviewsSynchronizer::SyncPipeline
+{
+	SyncPipeline(uint32_t maxInFlight) :
+		nextIndex(0), uploadQueue(maxInFlight), inFlight(0), maxInFlight(maxInFlight),
+		pendingCrunches(0), activeReaders(0)
+	{
+	}
+
+	// In priority order. Readers claim jobs in order, except for requested
+	// previews, which are looked up and claimed out of turn.
+	std::vector<std::pair<uuid_t, SyncAction>> work;
+	std::unordered_map<uuid_t, size_t> indexOfUuid;
+	std::unique_ptr<std::atomic<bool>[]> claimed;
+	std::atomic<size_t> nextIndex;
+
+	// Every item holds a slot from being read until it's uploaded or dropped,
+	// so the upload queue has room for all of them and crunch tasks never
+	// block an executor worker on it.
+	BoundedQueue<PipelineItem> uploadQueue;
+
+	std::mutex mutex;
+	std::condition_variable slotReleased;
+	std::condition_variable crunchingFinished;
+	uint32_t inFlight;
+	uint32_t maxInFlight;
+
+	// The upload queue is closed once every reader is done and every crunch
+	// task they submitted has run
+	uint32_t pendingCrunches;
+	uint32_t activeReaders;
+
+	CrunchParameters parameters;
+	SuccessCallbackFunc processedUuidCallback;
+	ErrorCallbackFunc processingErrorCallback;
+};
+
+void PreviewsSynchronizer::crunchAndUpload(const std::map<uuid_t, SyncAction>& entries, SuccessCallbackFunc processedUuidCallback,
+		 ErrorCallbackFunc processingErrorCallback)
+{
+	// Previews are read and uploaded by this pass's own threads, which mostly
+	// wait on disk and network. Crunching is handed to the shared executor, so
+	// however many catalogs are syncing the CPU bound work runs a thread per core.
+	// Enough uploaders are started for the highest the limit can go; the
+	// limiters decide how many of them are busy at once.
+	//
+	// That leaves each catalog with its watcher thread and the worker thread
+	// running this pass, plus for the length of the pass kReadWorkers (2)
+	// readers and up to kMaxUploadConcurrency (16) uploaders.
+	uint32_t readWorkers   = stageWorkers(kReadWorkers, entries.size());
+	uint32_t uploadWorkers = stageWorkers(_uploadLimiter->maxLimit(), entries.size());
+
+	SyncPipeline pipeline((_crunchLimiter->maxLimit() + _uploadLimiter->maxLimit()) * kQueueDepthPerWorker);
+	pipeline.work.assign(entries.begin(), entries.end());
+	pipeline.activeReaders = readWorkers;
+	prioritizeWork(pipeline);
+
+	pipeline.parameters.basePath         = pathOfPreviewsDatabaseFile();
+	pipeline.parameters.longestDimension = _settings->get(IEnlightenSettings::PreviewLongestDimension, 220);
+	pipeline.parameters.quality          = _settings->get(IEnlightenSettings::PreviewQuality, 40);
+	pipeline.processedUuidCallback       = processedUuidCallback;
+	pipeline.processingErrorCallback     = processingErrorCallback;
+
+	Logger::get().log(Logger::INFO, "Processing with %u readers, %u crunches and %u uploads at once, %u previews in flight",
+		readWorkers, _crunchLimiter->limit(), _uploadLimiter->limit(), pipeline.maxInFlight);
+
+	std::vector<std::thread> workers;
+	for (uint32_t i = 0; i < readWorkers; ++i)
+		workers.push_back(std::thread(&PreviewsSynchronizer::readStage, this, &pipeline));
+	for (uint32_t i = 0; i < uploadWorkers; ++i)
+		workers.push_back(std::thread(&PreviewsSynchronizer::uploadStage, this, &pipeline));
+
+	for (auto& worker : workers)
+		worker.join();
+
+	// Crunch tasks still queued after a cancel reference the pipeline
+	{
+		std::unique_lock<std::mutex> lock(pipeline.mutex);
+		pipeline.crunchingFinished.wait(lock, [&pipeline]()
 		{
-			processingErrorCallback(it->first, "Failed to load LrPrev for entry '"+ it->first +"'");
+			return pipeline.activeReaders == 0 && pipeline.pendingCrunches == 0;
+		});
+	}
+
+	Logger::get().log(Logger::INFO, "Done crunching");
+
+	Logger::get().log(Logger::DEBUG, "Memory budget: %llu of %llu bytes reserved, peak %llu",
+		static_cast<unsigned long long>(MemoryBudget::get().reserved()),
+		static_cast<unsigned long long>(MemoryBudget::get().capacity()),
+		static_cast<unsigned long long>(MemoryBudget::get().peakReserved()));
+
+	ConcurrencyStats uploads = _uploadLimiter->stats();
+	Logger::get().log(Logger::INFO, "Upload limit %u: median %.0f ms, p95 %.0f ms, %.0f bytes/s, %.0f%% errors",
+		uploads.limit, uploads.p50LatencyMs, uploads.p95LatencyMs, uploads.throughput,
+		uploads.errorRate * 100.0);
+
+	// Record the tail of the batch before the next diff reads the cache
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		_cachedPreviewsWriter->flush();
+		_previewsDatabase->endSnapshot();
+
+		// A cancelled pass leaves its jobs for the next run to resume
+		if (!_cancelWorking)
+			_cachedPreviews->purgeFinishedJobs();
+	}
+}
+
+void PreviewsSynchronizer::prioritizeWork(SyncPipeline& pipeline)
+{
+	std::vector<double> priorities;
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+
+		// Requests from before the pass are covered by the ordering
+		_requestedUuids.clear();
+
+		if (!_jobPrioritizer->preparePass())
+			Logger::get().log(Logger::WARNING, "Failed to prioritize jobs, processing in uuid order");
+
+		priorities.reserve(pipeline.work.size());
+		for (const auto& job : pipeline.work)
+			priorities.push_back(_jobPrioritizer->priorityForUuid(job.first));
+	}
+
+	std::vector<size_t> order(pipeline.work.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+
+	std::stable_sort(order.begin(), order.end(), [&priorities](size_t a, size_t b)
+	{
+		return priorities[a] > priorities[b];
+	});
+
+	std::vector<std::pair<uuid_t, SyncAction>> work;
+	work.reserve(order.size());
+	for (size_t i : order)
+		work.push_back(pipeline.work[i]);
+	pipeline.work.swap(work);
+
+	pipeline.claimed.reset(new std::atomic<bool>[pipeline.work.size()]);
+	pipeline.indexOfUuid.reserve(pipeline.work.size());
+	for (size_t i = 0; i < pipeline.work.size(); ++i)
+	{
+		pipeline.claimed[i] = false;
+		pipeline.indexOfUuid[pipeline.work[i].first] = i;
+	}
+}
+
+bool PreviewsSynchronizer::claimNextJob(SyncPipeline* pipeline, size_t& index, bool& requested)
+{
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		while (!_requestedUuids.empty())
+		{
+			auto it = pipeline->indexOfUuid.find(_requestedUuids.front());
+			_requestedUuids.pop_front();
+
+			if (it != pipeline->indexOfUuid.end() && !pipeline->claimed[it->second].exchange(true))
+			{
+				index = it->second;
+				requested = true;
+				return true;
+			}
+		}
+	}
+
+	requested = false;
+	while ((index = pipeline->nextIndex.fetch_add(1)) < pipeline->work.size())
+	{
+		if (!pipeline->claimed[index].exchange(true))
+			return true;
+	}
+
+	return false;
+}
+
+ConcurrencyStats PreviewsSynchronizer::crunchConcurrency() const
+{
+	return _crunchLimiter->stats();
+}
+
+ConcurrencyStats PreviewsSynchronizer::uploadConcurrency() const
+{
+	return _uploadLimiter->stats();
+}
+
+IJobPrioritizer* PreviewsSynchronizer::createOrderPrioritizer(const std::string& file)
+{
+	switch (_settings->get(IEnlightenSettings::SyncJobOrder, static_cast<int32_t>(JobOrder_CaptureTime)))
+	{
+	case JobOrder_CaptureTime:
+		return new CaptureTimePrioritizer(_previewsDatabase,
+			CaptureTimePrioritizer::catalogFileForPreviewsDatabase(file));
+	case JobOrder_PyramidTime:
+		return new PyramidTimePrioritizer(_previewsDatabase);
+	default:
+		return nullptr;
+	}
+}
+
+void PreviewsSynchronizer::readStage(SyncPipeline* pipeline)
+{
+	size_t index;
+	bool requested;
+	while (!_cancelWorking && claimNextJob(pipeline, index, requested))
+	{
+		auto item = std::make_shared<PipelineItem>();
+		item->uuid = pipeline->work[index].first;
+		item->action = pipeline->work[index].second;
+		item->extractedJpegSize = 0;
+		item->decodeScale = 1;
+		item->memory = MemoryReservation(MemoryBudget::get());
+
+		if (!readPreview(*item, pipeline->parameters, pipeline->processingErrorCallback))
 			continue;
+
+		if (item->action != SyncAction_Remove &&
+			!reserveCrunchMemory(*item, pipeline->parameters))
+		{
+			break;
 		}
 
-		int32_t previewLongestDimension = _settings->get(IEnlightenSettings::PreviewLongestDimension, 220);
-		int32_t previewQuality          = _settings->get(IEnlightenSettings::PreviewQuality, 40);
+		if (!acquirePipelineSlot(pipeline))
+			break;
 
-		uint32_t desiredLevel = entry->closestLevelToDimension(static_cast<float>(previewLongestDimension));
-		if (desiredLevel == PreviewEntry::INVALID_LEVEL_INDEX)
 		{
-			processingErrorCallback(it->first, "No appropriate of levels exist for entry '"+ it->first +"'");
-			continue;
+			std::lock_guard<std::mutex> autolock(_mutex);
+			_cachedPreviews->markJobInFlight(item->uuid);
 		}
 
-		uint32_t jpegSize;
-		uint8_t* jpegData = prev.extractFromLevel(desiredLevel, jpegSize);
-		if (!jpegData)
+		if (item->action == SyncAction_Remove)
 		{
-			processingErrorCallback(it->first, "Failed to extract Jpeg data for entry '"+ it->first +"'");
+			if (!pipeline->uploadQueue.push(std::move(*item)))
+				releasePipelineSlot(pipeline);
+
 			continue;
 		}
 
-		Jpeg sourceJpeg(jpegData, jpegSize, false);
-		Jpeg targetJpeg;
-
-		// Crunch it
-		if (_cancelWorking)
+		if (!_crunchLimiter->acquire(_cancelWorking))
 		{
+			releasePipelineSlot(pipeline);
 			break;
 		}
 
-		JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
-		bool crunched = cruncher.reencodeJpeg(previewLongestDimension, previewQuality);
-		free(jpegData);
+		{
+			std::lock_guard<std::mutex> autolock(pipeline->mutex);
+			++pipeline->pendingCrunches;
+		}
 
-		if (!crunched)
+		// A requested preview jumps the executor's queue as well
+		Executor::Priority priority = requested ? Executor::PriorityHigh : Executor::PriorityNormal;
+		if (!Executor::get().submit(_executorGroup, priority, std::bind(&PreviewsSynchronizer::crunchTask,
+			this, pipeline, item, std::chrono::steady_clock::now())))
 		{
-			processingErrorCallback(it->first, "Failed to reencode Jpeg data for entry '"+ it->first +"'");
-			continue;
+			_crunchLimiter->release();
+			releasePipelineSlot(pipeline);
+			finishCrunching(pipeline, false);
 		}
+	}
 
-		// Upload it
-		if (_cancelWorking)
+	finishCrunching(pipeline, true);
+}
+
+void PreviewsSynchronizer::crunchTask(SyncPipeline* pipeline, std::shared_ptr<PipelineItem> item,
+	std::chrono::steady_clock::time_point submitted)
+{
+	// Runs on an executor worker. A cancelled pass still has its queued tasks
+	// run, but they only give their slots back.
+	bool crunched = !_cancelWorking &&
+		crunchPreview(*item, pipeline->parameters, pipeline->processingErrorCallback);
+
+	// Timed from submission, as waiting for a worker is what too many
+	// crunches at once costs. A preview which won't crunch says nothing
+	// about load, so isn't counted as an error.
+	if (crunched)
+		_crunchLimiter->recordSample(millisecondsSince(submitted), 1, true);
+
+	_crunchLimiter->release();
+
+	if (!crunched || !pipeline->uploadQueue.push(std::move(*item)))
+		releasePipelineSlot(pipeline);
+
+	finishCrunching(pipeline, false);
+}
+
+void PreviewsSynchronizer::uploadStage(SyncPipeline* pipeline)
+{
+	PipelineItem item;
+	while (pipeline->uploadQueue.pop(item) && !_cancelWorking)
+	{
+		// Permits are only held while uploading, so an uploader waiting on an
+		// empty queue doesn't count towards the limit being reached
+		if (!_uploadLimiter->acquire(_cancelWorking))
 		{
+			releasePipelineSlot(pipeline);
 			break;
 		}
 
-		IAwsRequest* request = _aws->createRequestForDestination(_awsDestinationIdentifier);
-		if (request)
-		{
-			Logger::get().log(Logger::INFO, "%s - %d", it->first.c_str(), it->second);
+		uploadPreview(item, pipeline->processedUuidCallback);
+		_uploadLimiter->release();
+
+		// Don't hold on to the image while waiting for the next one
+		item = PipelineItem();
+		releasePipelineSlot(pipeline);
+	}
 
-			std::string key = entry->filePathRelativeToRoot();
+	if (_cancelWorking)
+		pipeline->uploadQueue.close();
+}
+
+bool PreviewsSynchronizer::acquirePipelineSlot(SyncPipeline* pipeline)
+{
+	std::unique_lock<std::mutex> lock(pipeline->mutex);
 
-			// Replace the extension
-			size_t extensionIndex = key.rfind(".lrprev");
-			if (extensionIndex != std::string::npos)
+	while (pipeline->inFlight >= pipeline->maxInFlight)
+	{
+		if (_cancelWorking)
+			return false;
+
+		pipeline->slotReleased.wait_for(lock, std::chrono::milliseconds(kSlotWaitMs));
+	}
+
+	++pipeline->inFlight;
+	return true;
+}
+
+void PreviewsSynchronizer::releasePipelineSlot(SyncPipeline* pipeline)
+{
+	{
+		std::lock_guard<std::mutex> autolock(pipeline->mutex);
+		--pipeline->inFlight;
+	}
+
+	pipeline->slotReleased.notify_one();
+}
+
+void PreviewsSynchronizer::finishCrunching(SyncPipeline* pipeline, bool readerDone)
+{
+	// Everything happens under the lock, as the pipeline may go as soon as
+	// it's released
+	std::lock_guard<std::mutex> autolock(pipeline->mutex);
+
+	if (readerDone)
+		--pipeline->activeReaders;
+	else
+		--pipeline->pendingCrunches;
+
+	if (pipeline->activeReaders == 0 && pipeline->pendingCrunches == 0)
+	{
+		pipeline->uploadQueue.close();
+		pipeline->crunchingFinished.notify_all();
+	}
+}
+
+bool PreviewsSynchronizer::readPreview(PipelineItem& item, const CrunchParameters& parameters,
+	ErrorCallbackFunc processingErrorCallback)
+{
+	const std::string uuidString = item.uuid.toString();
+
+	// The cached digest names the object that was uploaded last time, which
+	// is the one a Remove or an Update has to delete.
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		_cachedPreviews->digestForUuid(item.uuid, item.cachedDigest);
+	}
+
+	if (item.action == SyncAction_Remove)
+	{
+		// Nothing needs crunching, only the uploaded object's key. Caches written
+		// before digests were recorded fall back to whatever previews.db still has.
+		item.entry = PreviewEntry(item.uuid, item.cachedDigest, std::vector<PreviewEntryLevel>());
+		if (item.cachedDigest.empty())
+		{
+			bool entryFound;
 			{
-				key.replace(extensionIndex, strlen(".lrprev"), ".jpg");
+				std::lock_guard<std::mutex> autolock(_mutex);
+				entryFound = _previewsDatabase->entryForUuid(item.uuid, item.entry);
 			}
 
-			SyncAction action  = it->second;
-			bool requestResult = false;
-			switch(action)
+			// Without a digest from either, there's no key to remove by. Retrying
+			// can't change that, so the uuid is only dropped from the cache.
+			if (!entryFound)
 			{
-				case SyncAction_Add:
-				{
-					AwsPut put;
+				Logger::get().log(Logger::WARNING, "No digest for '%s', dropping it from the cache "
+					"without removing its preview", uuidString.c_str());
+				item.entry = PreviewEntry(item.uuid, std::string(), std::vector<PreviewEntryLevel>());
+			}
+		}
 
-					uint32_t compressedSize;
-					put.data = targetJpeg.compressedData(compressedSize);
-					put.dataSize = compressedSize;
+		return true;
+	}
 
-					requestResult = request->putObject(key, put);
-					break;
-				}
-				case SyncAction_Remove:
-				{
-					requestResult = request->removeObject(key);
-					break;
-				}
-				case SyncAction_Update:
-				{
-					break;
-				}
-			}
+	// load it
+	bool entryFound;
+	{
+		std::lock_guard<std::mutex> autolock(_mutex);
+		entryFound = _previewsDatabase->entryForUuid(item.uuid, item.entry);
+	}
 
-			if (!requestResult)
+	if (!entryFound)
+	{
+		processingErrorCallback(item.uuid, "Failed to find entry '"+ uuidString +"' in database");
+		return false;
+	}
+
+	LrPrev prev;
+	const std::string& filePath = parameters.basePath + item.entry.filePathRelativeToRoot();
+	if (!prev.initialiseWithFile(filePath.c_str()))
+	{
+		processingErrorCallback(item.uuid, "Failed to load LrPrev for entry '"+ uuidString +"'");
+		return false;
+	}
+
+	// The level is somewhere in the file, so the file's size covers it until
+	// the level's own size is known. A cancelled wait isn't an error.
+	if (!item.memory.grow(File(filePath).fileSize(), _cancelWorking))
+		return false;
+
+	uint32_t desiredLevel = item.entry.closestLevelToDimension(static_cast<float>(parameters.longestDimension));
+	if (desiredLevel == PreviewEntry::INVALID_LEVEL_INDEX)
+	{
+		processingErrorCallback(item.uuid, "No appropriate of levels exist for entry '"+ uuidString +"'");
+		return false;
+	}
+
+	uint8_t* jpegData = prev.extractFromLevel(desiredLevel, item.extractedJpegSize);
+	if (!jpegData)
+	{
+		processingErrorCallback(item.uuid, "Failed to extract Jpeg data for entry '"+ uuidString +"'");
+		return false;
+	}
+
+	item.extractedJpeg = std::shared_ptr<uint8_t>(jpegData, free);
+	item.memory.shrinkTo(item.extractedJpegSize);
+
+	return true;
+}
+
+bool PreviewsSynchronizer::reserveCrunchMemory(PipelineItem& item, const CrunchParameters& parameters)
+{
+	// A Jpeg which can't be read fails when it's crunched, and is reported then
+	uint32_t width, height, components;
+	Jpeg sourceJpeg(item.extractedJpeg.get(), item.extractedJpegSize, false);
+	if (!sourceJpeg.readDimensions(width, height, components))
+		return true;
+
+	// The resized image and its compressed copy are small next to the decode
+	uint64_t longestDimension = static_cast<uint64_t>(std::max(parameters.longestDimension, 1));
+	uint64_t targetBytes = 2 * longestDimension * longestDimension * components;
+
+	// Full size first. When that doesn't fit, a smaller decode is as good as
+	// long as it still covers the size the preview is crunched down to.
+	uint64_t decodeBytes = 0;
+	for (uint32_t scale = 1; scale <= kMaxDecodeScaleDenominator; scale *= 2)
+	{
+		uint64_t scaledWidth  = (width + scale - 1) / scale;
+		uint64_t scaledHeight = (height + scale - 1) / scale;
+		if (scale > 1 && std::max(scaledWidth, scaledHeight) < longestDimension)
+			break;
+
+		item.decodeScale = scale;
+		decodeBytes = scaledWidth * scaledHeight * components + targetBytes;
+		if (item.memory.tryGrow(decodeBytes))
+			return true;
+	}
+
+	// Nothing fits yet, so wait for room for the smallest. The source is let go
+	// of while waiting, as waiting while holding memory could leave every reader
+	// holding some and waiting for more.
+	Logger::get().log(Logger::DEBUG, "Waiting for memory to crunch %s at 1/%u scale",
+		item.uuid.toString().c_str(), item.decodeScale);
+
+	uint64_t sourceBytes = item.memory.bytes();
+	item.memory.release();
+
+	return item.memory.grow(sourceBytes + decodeBytes, _cancelWorking);
+}
+
+bool PreviewsSynchronizer::crunchPreview(PipelineItem& item, const CrunchParameters& parameters,
+	ErrorCallbackFunc processingErrorCallback)
+{
+	Logger::get().log(Logger::INFO, "Crunching uuid %s", item.uuid.toString().c_str());
+
+	Jpeg sourceJpeg(item.extractedJpeg.get(), item.extractedJpegSize, false);
+	sourceJpeg.setScaleDenominator(item.decodeScale);
+	item.crunchedJpeg = std::make_shared<Jpeg>();
+
+	// Crunch it
+	JpegCruncher cruncher(&sourceJpeg, item.crunchedJpeg.get());
+	cruncher.setCrunchMode(JpegCruncher::CrunchModeYCbCr);
+	cruncher.setOrientation(item.entry.orientation());
+	bool crunched = cruncher.reencodeJpeg(parameters.longestDimension, parameters.quality);
+
+	// The source isn't needed downstream
+	item.extractedJpeg.reset();
+	item.extractedJpegSize = 0;
+
+	if (!crunched)
+	{
+		item.memory.release();
+		processingErrorCallback(item.uuid, "Failed to reencode Jpeg data for entry '"+
+			item.uuid.toString() +"'");
+		return false;
+	}
+
+	// Only the crunched copy is held until it's uploaded
+	uint32_t crunchedSize;
+	item.crunchedJpeg->compressedData(crunchedSize);
+	item.memory.shrinkTo(crunchedSize);
+
+	return true;
+}
+
+void PreviewsSynchronizer::uploadPreview(const PipelineItem& item,
+	SuccessCallbackFunc processedUuidCallback)
+{
+	Logger::get().log(Logger::INFO, "%s - %d", item.uuid.toString().c_str(), item.action);
+
+	// A removal with no key to remove by only has the cache to clear
+	if (item.action == SyncAction_Remove && item.entry.digest().empty())
+	{
+		processedUuidCallback(item.uuid, SyncAction_Remove, std::string());
+		return;
+	}
+
+	// While the destination is down its jobs are put off, not failed
+	CircuitBreaker& breaker = CircuitBreaker::forDestination(_awsDestinationIdentifier);
+	if (!breaker.allowRequest())
+	{
+		int64_t retryAt = std::max(breaker.reopensAt(),
+			RetryPolicy::currentTimeMs() + kMinRetryIntervalMs);
+
+		std::lock_guard<std::mutex> autolock(_mutex);
+		_cachedPreviews->deferJob(item.uuid, retryAt);
+		return;
+	}
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	uint32_t uploadedBytes = 0;
+
+	bool succeeded;
+	if (item.action == SyncAction_Remove)
+	{
+		succeeded = removeObjectForEntry(item.entry);
+	}
+	else
+	{
+		succeeded = false;
+
+		// Upload it
+		IAwsRequest* request = _aws->createRequestForDestination(_awsDestinationIdentifier);
+		if (request)
+		{
+			AwsPut put;
+
+			uint32_t compressedSize;
+			put.data = item.crunchedJpeg->compressedData(compressedSize);
+			put.dataSize = compressedSize;
+			uploadedBytes = compressedSize;
+
+			succeeded = request->putObject(objectKeyForEntry(item.entry), put);
+			if (!succeeded)
 			{
 				Logger::get().log(Logger::ERROR, "Request failed! Status code: %u",
 					request->statusCode());
@@ -267,17 +1010,59 @@ void PreviewsSynchronizer::crunchAndUpload(std::map<uuid_t, SyncAction>* entries
 
 			_aws->freeRequest(request);
 		}
+	}
 
-		// Notify done
-		processedUuidCallback(it->first);
+	_uploadLimiter->recordSample(millisecondsSince(started), uploadedBytes, succeeded);
+
+	if (!succeeded)
+	{
+		breaker.recordFailure();
+		failJob(item.uuid, kUploadRetryPolicy);
+		return;
 	}
 
-	Logger::get().log(Logger::INFO, "Done crunching");
+	breaker.recordSuccess();
+
+	// The digest is part of the key, so an edited photo's old preview is
+	// a separate object which has to go. Failing that only leaves it behind.
+	if (item.action == SyncAction_Update && !item.cachedDigest.empty() &&
+		item.cachedDigest != item.entry.digest())
+	{
+		PreviewEntry previousEntry(item.uuid, item.cachedDigest, std::vector<PreviewEntryLevel>());
+		removeObjectForEntry(previousEntry);
+	}
+
+	// Notify done
+	processedUuidCallback(item.uuid, item.action, item.entry.digest());
+}
+
+uint32_t PreviewsSynchronizer::stageWorkers(uint32_t wanted, size_t numberOfEntries) const
+{
+	// Readers and uploaders mostly wait on disk and network, so the core count
+	// has no bearing on how many there are. There's no point in more of them
+	// than previews to go round, though.
+	uint32_t numberOfWorkers = std::min<uint32_t>(wanted, kMaxStageWorkers);
+	numberOfWorkers = std::min<size_t>(numberOfWorkers, numberOfEntries);
 
-	// Delete the memory holding the entries
-	delete entries;
+	return std::max<uint32_t>(numberOfWorkers, 1);
+}
+
+bool PreviewsSynchronizer::removeObjectForEntry(const PreviewEntry& entry)
+{
+	IAwsRequest* request = _aws->createRequestForDestination(_awsDestinationIdentifier);
+	if (!request)
+		return false;
+
+	bool removed = request->removeObject(objectKeyForEntry(entry));
+	if (!removed)
+	{
+		Logger::get().log(Logger::ERROR, "Request failed! Status code: %u",
+			request->statusCode());
+	}
+
+	_aws->freeRequest(request);
 
-	_workerPromise.set_value(true);
+	return removed;
 }
 
 std::string PreviewsSynchronizer::pathOfPreviewsDatabaseFile()
@@ -290,16 +1075,41 @@ std::string PreviewsSynchronizer::pathOfPreviewsDatabaseFile()
 	return fullFilePath.substr(0, idx+1);
 }
 
-void PreviewsSynchronizer::processedUuid(const uuid_t& uuid)
+void PreviewsSynchronizer::processedUuid(const uuid_t& uuid, SyncAction action,
+	const std::string& digest)
 {
 	std::lock_guard<std::mutex> autolock(_mutex);
-	_cachedPreviews->markAsCached(uuid);
+
+	_cachedPreviewsWriter->add(uuid, action, digest);
 }
 
 void PreviewsSynchronizer::errorProcessingUuid(const uuid_t& uuid, const std::string& error)
 {
-	std::lock_guard<std::mutex> autolock(_mutex);
 	Logger::get().log(Logger::DEBUG, "%s", error.c_str());
+
+	failJob(uuid, kProcessingRetryPolicy);
+}
+
+void PreviewsSynchronizer::failJob(const uuid_t& uuid, const RetryPolicy& policy)
+{
+	std::lock_guard<std::mutex> autolock(_mutex);
+
+	// Changes which couldn't be journalled aren't retried
+	SyncJob job;
+	if (!_cachedPreviews->jobForUuid(uuid, job))
+		return;
+
+	if (!policy.shouldRetry(job.retries))
+	{
+		Logger::get().log(Logger::WARNING, "Giving up on %s after %u retries",
+			uuid.toString().c_str(), job.retries);
+
+		_cachedPreviews->markJobDeadLettered(uuid);
+		return;
+	}
+
+	_cachedPreviews->markJobFailed(uuid,
+		RetryPolicy::currentTimeMs() + policy.delayForRetry(job.retries));
 }
 } // lib
 } // enlighten
@@ -0,0 +1,119 @@
+#include "uuid.h"
+
+namespace enlighten
+{
+namespace lib
+{
+namespace
+{
+	bool isSeparatorIndex(size_t charIdx)
+	{
+		return charIdx == 8 || charIdx == 13 || charIdx == 18 || charIdx == 23;
+	}
+}
+
+int hexValue(char character)
+{
+	if (character >= '0' && character <= '9')
+		return character - '0';
+	if (character >= 'A' && character <= 'F')
+		return character - 'A' + 10;
+	if (character >= 'a' && character <= 'f')
+		return character - 'a' + 10;
+
+	return -1;
+}
+
+const size_t Uuid::kStringLength;
+
+Uuid::Uuid() : _high(0), _low(0)
+{
+}
+
+Uuid::Uuid(const std::string& string) : _high(0), _low(0)
+{
+	fromString(string, *this);
+}
+
+bool Uuid::fromString(const char* string, size_t length, Uuid& uuid)
+{
+	// Only the canonical 8-4-4-4-12 form is accepted, which is what Lightroom writes.
+	if (!string || length != kStringLength)
+		return false;
+
+	uint64_t halves[2] = { 0, 0 };
+	uint32_t nibbleIdx = 0;
+
+	for (size_t charIdx = 0; charIdx < kStringLength; ++charIdx)
+	{
+		if (isSeparatorIndex(charIdx))
+		{
+			if (string[charIdx] != '-')
+				return false;
+
+			continue;
+		}
+
+		int value = hexValue(string[charIdx]);
+		if (value < 0)
+			return false;
+
+		uint64_t& half = halves[nibbleIdx / 16];
+		half = (half << 4) | static_cast<uint64_t>(value);
+		++nibbleIdx;
+	}
+
+	uuid._high = halves[0];
+	uuid._low  = halves[1];
+
+	return true;
+}
+
+bool Uuid::fromString(const std::string& string, Uuid& uuid)
+{
+	return fromString(string.c_str(), string.length(), uuid);
+}
+
+std::string Uuid::toString() const
+{
+	char buffer[kStringLength + 1];
+	format(buffer);
+
+	return std::string(buffer, kStringLength);
+}
+
+void Uuid::format(char* buffer) const
+{
+	static const char* kHexDigits = "0123456789ABCDEF";
+
+	uint32_t nibbleIdx = 0;
+	for (size_t charIdx = 0; charIdx < kStringLength; ++charIdx)
+	{
+		if (isSeparatorIndex(charIdx))
+		{
+			buffer[charIdx] = '-';
+			continue;
+		}
+
+		uint64_t half = nibbleIdx < 16 ? _high : _low;
+		uint32_t shift = (15 - (nibbleIdx % 16)) * 4;
+		buffer[charIdx] = kHexDigits[(half >> shift) & 0xF];
+		++nibbleIdx;
+	}
+
+	buffer[kStringLength] = '\0';
+}
+
+bool Uuid::isNil() const
+{
+	return _high == 0 && _low == 0;
+}
+
+size_t Uuid::hash() const
+{
+	// Most uuids are random already; the multiply spreads sequential ones.
+	uint64_t mixed = (_high ^ (_low * 0x9E3779B97F4A7C15ull)) * 0xC2B2AE3D27D4EB4Full;
+	return static_cast<size_t>(mixed ^ (mixed >> 32));
+}
+} // lib
+} // enlighten
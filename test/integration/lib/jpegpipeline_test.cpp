@@ -37,3 +37,51 @@ TEST(JpegPipelineTest, ProcessJpegFromLrCat)
 	EXPECT_TRUE(targetJpeg.writeToFile(destinationFile));
 }
 
+
+TEST(JpegPipelineTest, ProcessJpegFromLrCatInYCbCrMode)
+{
+	const char* destinationFile = "temp/JpegPipelineTest_ProcessJpegFromLrCatInYCbCrMode.jpg";
+
+	LrPrev lrprev;
+	ASSERT_TRUE(lrprev.initialiseWithFile(lrPrevFile));
+
+	uint32_t dataSize;
+	uint8_t* bytes = lrprev.extractFromLevel(3, dataSize);
+
+	ASSERT_TRUE(bytes != nullptr);
+	ASSERT_TRUE(dataSize != 0);
+
+	Jpeg sourceJpeg(bytes, dataSize, false);
+	Jpeg targetJpeg;
+
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setCrunchMode(JpegCruncher::CrunchModeYCbCr);
+	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
+
+	EXPECT_TRUE(targetJpeg.writeToFile(destinationFile));
+}
+
+TEST(JpegPipelineTest, ProcessRotatedJpegFromLrCatInYCbCrMode)
+{
+	const char* destinationFile = "temp/JpegPipelineTest_ProcessRotatedJpegFromLrCatInYCbCrMode.jpg";
+
+	LrPrev lrprev;
+	ASSERT_TRUE(lrprev.initialiseWithFile(lrPrevFile));
+
+	uint32_t dataSize;
+	uint8_t* bytes = lrprev.extractFromLevel(3, dataSize);
+
+	ASSERT_TRUE(bytes != nullptr);
+	ASSERT_TRUE(dataSize != 0);
+
+	Jpeg sourceJpeg(bytes, dataSize, false);
+	Jpeg targetJpeg;
+
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setCrunchMode(JpegCruncher::CrunchModeYCbCr);
+	cruncher.setOrientation(Orientation_Rotate90);
+	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
+
+	EXPECT_LT(targetJpeg.width(), targetJpeg.height());
+	EXPECT_TRUE(targetJpeg.writeToFile(destinationFile));
+}
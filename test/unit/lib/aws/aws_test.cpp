@@ -2,6 +2,7 @@
 #include "gtest/gtest.h"
 
 #include "aws/aws.h"
+#include "settings.h"
 
 using namespace enlighten::lib;
 
@@ -92,3 +93,29 @@ TEST_F(AwsTest, ShouldFailCreateRequestForUninitialisedDestination)
 	EXPECT_TRUE(request == nullptr);
 }
 
+
+TEST(AwsConfigTest, ShouldReadUploadBandwidthFromSettings)
+{
+	EnlightenSettings settings;
+	settings.set(IEnlightenSettings::UploadKilobytesPerSecond, 512);
+	settings.set(IEnlightenSettings::UploadSchedule, std::string("09:00-17:00=64"));
+
+	AwsConfig config;
+	config.readSettings(&settings);
+
+	EXPECT_EQ(512u, config.uploadKilobytesPerSecond);
+	EXPECT_EQ("09:00-17:00=64", config.uploadSchedule);
+}
+
+TEST(AwsConfigTest, ShouldKeepUploadBandwidthWhenNotSet)
+{
+	EnlightenSettings settings;
+
+	AwsConfig config;
+	config.uploadKilobytesPerSecond = 256;
+	config.uploadSchedule = "22:00-06:00=0";
+	config.readSettings(&settings);
+
+	EXPECT_EQ(256u, config.uploadKilobytesPerSecond);
+	EXPECT_EQ("22:00-06:00=0", config.uploadSchedule);
+}
@@ -5,13 +5,36 @@
 #include "aws/awsrequest.h"
 #include "aws/aws.h"
 
+#include "bandwidthlimiter.h"
 #include "logger.h"
 
 #include <thread>
 #include <chrono>
+#include <vector>
 
 using namespace enlighten::lib;
 
+namespace enlighten
+{
+namespace lib
+{
+class AwsRequestCallbacks
+{
+public:
+	static void beginPut(AwsRequest& request, const AwsPut& put)
+	{
+		request._currentReadData = &put;
+		request._transferredData = 0;
+	}
+
+	static size_t read(AwsRequest& request, char* buffer, size_t bufferSize)
+	{
+		return AwsRequest::readCallback(buffer, 1, bufferSize, &request);
+	}
+};
+} // lib
+} // enlighten
+
 namespace
 {
 	AwsAccessProfile accessProfile = {
@@ -26,6 +49,33 @@ namespace
 
 	uint8_t rawBytes[] = { 'H','E','L','L','O' };
 
+	// Repeats every 251 bytes, so reading from the wrong offset can't match by chance
+	std::vector<uint8_t> patternedBody(size_t size)
+	{
+		std::vector<uint8_t> body(size);
+		for (size_t i = 0; i < size; ++i)
+			body[i] = static_cast<uint8_t>(i % 251);
+
+		return body;
+	}
+
+	// Reads the body as curl would, a buffer at a time until it's all gone
+	std::vector<uint8_t> readBody(AwsRequest& request, size_t bufferSize,
+		std::vector<size_t>& readSizes)
+	{
+		std::vector<uint8_t> body;
+		std::vector<char> buffer(bufferSize);
+
+		size_t read;
+		while ((read = AwsRequestCallbacks::read(request, &buffer[0], bufferSize)) > 0)
+		{
+			readSizes.push_back(read);
+			body.insert(body.end(), buffer.begin(), buffer.begin() + read);
+		}
+
+		return body;
+	}
+
 	class AwsRequestTest : public testing::Test
 	{
 	public:
@@ -333,3 +383,42 @@ TEST_F(AwsRequestTest, ShouldReturnNullResponseIfNotComplete)
 	EXPECT_NE(AwsRequest::StateComplete, request->state());
 	EXPECT_TRUE(nullptr == request->response());
 }
+
+TEST_F(AwsRequestTest, ShouldReadABodyLargerThanOneBuffer)
+{
+	std::vector<uint8_t> data = patternedBody(40000);
+
+	AwsPut largePut;
+	largePut.data = &data[0];
+	largePut.dataSize = data.size();
+
+	BandwidthLimiter::get().setRate(0);
+	AwsRequestCallbacks::beginPut(*request, largePut);
+
+	std::vector<size_t> readSizes;
+	std::vector<uint8_t> body = readBody(*request, 16 * 1024, readSizes);
+
+	EXPECT_EQ(3, readSizes.size());
+	EXPECT_TRUE(body == data);
+}
+
+TEST_F(AwsRequestTest, ShouldReadEveryByteWhenBandwidthIsGrantedInPart)
+{
+	std::vector<uint8_t> data = patternedBody(40000);
+
+	AwsPut largePut;
+	largePut.data = &data[0];
+	largePut.dataSize = data.size();
+
+	// Slow enough that reads are handed a fraction of their buffer
+	BandwidthLimiter::get().setRate(64 * 1024);
+	AwsRequestCallbacks::beginPut(*request, largePut);
+
+	std::vector<size_t> readSizes;
+	std::vector<uint8_t> body = readBody(*request, 16 * 1024, readSizes);
+
+	BandwidthLimiter::get().setRate(0);
+
+	EXPECT_GT(readSizes.size(), 3);
+	EXPECT_TRUE(body == data);
+}
@@ -0,0 +1,93 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "bandwidthlimiter.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace enlighten::lib;
+
+TEST(BandwidthScheduleTest, ShouldUseTheDefaultOutsideItsWindows)
+{
+	BandwidthSchedule schedule;
+	ASSERT_TRUE(schedule.parse("09:00-18:00=128"));
+
+	EXPECT_EQ(128 * 1024, schedule.bytesPerSecondAt(9 * 60, 5));
+	EXPECT_EQ(128 * 1024, schedule.bytesPerSecondAt(17 * 60 + 59, 5));
+	EXPECT_EQ(5, schedule.bytesPerSecondAt(18 * 60, 5));
+	EXPECT_EQ(5, schedule.bytesPerSecondAt(8 * 60 + 59, 5));
+}
+
+TEST(BandwidthScheduleTest, ShouldWrapWindowsPastMidnight)
+{
+	BandwidthSchedule schedule;
+	ASSERT_TRUE(schedule.parse("09:00-18:00=128, 23:00-07:00=0"));
+
+	EXPECT_EQ(0, schedule.bytesPerSecondAt(23 * 60, 5));
+	EXPECT_EQ(0, schedule.bytesPerSecondAt(0, 5));
+	EXPECT_EQ(0, schedule.bytesPerSecondAt(6 * 60 + 59, 5));
+	EXPECT_EQ(5, schedule.bytesPerSecondAt(7 * 60, 5));
+}
+
+TEST(BandwidthScheduleTest, ShouldPreferTheFirstMatchingWindow)
+{
+	BandwidthSchedule schedule;
+	ASSERT_TRUE(schedule.parse("12:00-13:00=64,00:00-00:00=256"));
+
+	EXPECT_EQ(64 * 1024, schedule.bytesPerSecondAt(12 * 60 + 30, 0));
+	EXPECT_EQ(256 * 1024, schedule.bytesPerSecondAt(15 * 60, 0));
+}
+
+TEST(BandwidthScheduleTest, ShouldRejectMalformedSchedules)
+{
+	BandwidthSchedule schedule;
+	ASSERT_TRUE(schedule.parse("09:00-18:00=128"));
+
+	EXPECT_FALSE(schedule.parse("09:00-18:00"));
+	EXPECT_FALSE(schedule.parse("25:00-18:00=128"));
+	EXPECT_FALSE(schedule.parse("09:00-18:00=128 please"));
+
+	// A failed parse leaves the schedule as it was
+	EXPECT_FALSE(schedule.empty());
+
+	EXPECT_TRUE(schedule.parse(""));
+	EXPECT_TRUE(schedule.empty());
+}
+
+TEST(BandwidthLimiterTest, ShouldGrantEverythingWhenUnlimited)
+{
+	BandwidthLimiter limiter;
+	limiter.setRate(0);
+
+	EXPECT_EQ(1 << 30, limiter.take(1 << 30, 0));
+	EXPECT_EQ(0, limiter.currentRate());
+}
+
+TEST(BandwidthLimiterTest, ShouldPaceToTheRate)
+{
+	BandwidthLimiter limiter;
+	limiter.setRate(256 * 1024);
+
+	// The bucket starts empty, so this is all paced
+	auto started = std::chrono::steady_clock::now();
+
+	uint64_t taken = 0;
+	while (taken < 64 * 1024)
+		taken += limiter.take(std::min<uint64_t>(16 * 1024, 64 * 1024 - taken), 1000);
+
+	double elapsedMs = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - started).count();
+
+	EXPECT_EQ(64 * 1024, taken);
+	EXPECT_GE(elapsedMs, 200.0);
+	EXPECT_LT(elapsedMs, 1000.0);
+}
+
+TEST(BandwidthLimiterTest, ShouldGiveUpWhenNothingComesInTime)
+{
+	BandwidthLimiter limiter;
+	limiter.setRate(1);
+
+	EXPECT_EQ(0, limiter.take(1024, 10));
+}
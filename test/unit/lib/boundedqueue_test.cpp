@@ -0,0 +1,122 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "boundedqueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace enlighten::lib;
+
+TEST(BoundedQueueTest, ShouldPopItemsInTheOrderTheyWerePushed)
+{
+	BoundedQueue<int> queue(4);
+
+	EXPECT_TRUE(queue.push(1));
+	EXPECT_TRUE(queue.push(2));
+	EXPECT_EQ(2, queue.size());
+
+	int item = 0;
+	EXPECT_TRUE(queue.pop(item));
+	EXPECT_EQ(1, item);
+	EXPECT_TRUE(queue.pop(item));
+	EXPECT_EQ(2, item);
+	EXPECT_EQ(0, queue.size());
+}
+
+TEST(BoundedQueueTest, ShouldDrainBeforeFailingOnceClosed)
+{
+	BoundedQueue<int> queue(4);
+	EXPECT_TRUE(queue.push(1));
+	queue.close();
+
+	EXPECT_FALSE(queue.push(2));
+
+	int item = 0;
+	EXPECT_TRUE(queue.pop(item));
+	EXPECT_EQ(1, item);
+	EXPECT_FALSE(queue.pop(item));
+}
+
+TEST(BoundedQueueTest, ShouldBlockPushesWhileFull)
+{
+	BoundedQueue<int> queue(1);
+	EXPECT_TRUE(queue.push(1));
+
+	std::atomic<bool> pushed(false);
+	std::thread producer([&]()
+	{
+		queue.push(2);
+		pushed = true;
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_FALSE(pushed);
+
+	int item = 0;
+	EXPECT_TRUE(queue.pop(item));
+	producer.join();
+
+	EXPECT_TRUE(pushed);
+	EXPECT_EQ(1, queue.size());
+}
+
+TEST(BoundedQueueTest, ShouldWakeBlockedThreadsWhenClosed)
+{
+	BoundedQueue<int> queue(1);
+
+	std::thread consumer([&]()
+	{
+		int item = 0;
+		EXPECT_FALSE(queue.pop(item));
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	queue.close();
+	consumer.join();
+}
+
+TEST(BoundedQueueTest, ShouldDeliverEveryItemAcrossManyThreads)
+{
+	const int itemsPerProducer = 1000;
+	const int numberOfProducers = 4;
+
+	BoundedQueue<int> queue(8);
+	std::atomic<long> total(0);
+	std::atomic<int> received(0);
+
+	std::vector<std::thread> consumers;
+	for (int i = 0; i < 3; ++i)
+	{
+		consumers.push_back(std::thread([&]()
+		{
+			int item;
+			while (queue.pop(item))
+			{
+				total += item;
+				++received;
+			}
+		}));
+	}
+
+	std::vector<std::thread> producers;
+	for (int i = 0; i < numberOfProducers; ++i)
+	{
+		producers.push_back(std::thread([&]()
+		{
+			for (int j = 1; j <= itemsPerProducer; ++j)
+				queue.push(j);
+		}));
+	}
+
+	for (auto& producer : producers)
+		producer.join();
+	queue.close();
+	for (auto& consumer : consumers)
+		consumer.join();
+
+	EXPECT_EQ(numberOfProducers * itemsPerProducer, received);
+	EXPECT_EQ(numberOfProducers * (itemsPerProducer * (itemsPerProducer + 1) / 2), total);
+}
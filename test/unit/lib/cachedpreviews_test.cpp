@@ -4,6 +4,7 @@
 #include "cachedpreviews.h"
 #include "settings.h"
 #include "file.h"
+#include "sqlite3.h"
 
 #include <chrono>
 
@@ -13,6 +14,8 @@ namespace
 {
 	std::string CachedPreviewsTest_PathToCachedPreviewsRoot = "temp/";
 
+	const std::string fakeDigest = "07cc63f155500a902b21fef7be6585b5";
+
 	class MockSettings : public IEnlightenSettings
 	{
 	public:
@@ -91,11 +94,11 @@ TEST_F(CachedPreviewsTest, ShouldMarkPreviewAsCached)
 		testing::Matcher<const std::string&>(testing::_)))
 			.WillRepeatedly(testing::DoDefault());
 
-	enlighten::lib::uuid_t uuid = "123456-789ABCDEF";
+	enlighten::lib::uuid_t uuid("12345678-9ABC-4DEF-8123-456789ABCDEF");
 
 	CachedPreviews previews(&settings);
 	EXPECT_TRUE(previews.loadOrCreateDatabase());
-	EXPECT_TRUE(previews.markAsCached(uuid));
+	EXPECT_TRUE(previews.markAsCached(uuid, fakeDigest));
 }
 
 TEST_F(CachedPreviewsTest, ShouldReturnTrueIfPreviewIsAlreadyCached)
@@ -104,11 +107,11 @@ TEST_F(CachedPreviewsTest, ShouldReturnTrueIfPreviewIsAlreadyCached)
 		testing::Matcher<const std::string&>(testing::_)))
 			.WillRepeatedly(testing::DoDefault());
 
-	enlighten::lib::uuid_t uuid = "123456-789ABCDEF";
+	enlighten::lib::uuid_t uuid("12345678-9ABC-4DEF-8123-456789ABCDEF");
 
 	CachedPreviews previews(&settings);
 	EXPECT_TRUE(previews.loadOrCreateDatabase());
-	EXPECT_TRUE(previews.markAsCached(uuid));
+	EXPECT_TRUE(previews.markAsCached(uuid, fakeDigest));
 
 	EXPECT_TRUE(previews.isInCache(uuid));
 }
@@ -119,7 +122,7 @@ TEST_F(CachedPreviewsTest, ShouldReturnFalseIfPreviewNotInCache)
 		testing::Matcher<const std::string&>(testing::_)))
 			.WillRepeatedly(testing::DoDefault());
 
-	enlighten::lib::uuid_t uuid = "123456-789ABCDEF";
+	enlighten::lib::uuid_t uuid("12345678-9ABC-4DEF-8123-456789ABCDEF");
 
 	CachedPreviews previews(&settings);
 	EXPECT_TRUE(previews.loadOrCreateDatabase());
@@ -133,16 +136,16 @@ TEST_F(CachedPreviewsTest, ShouldCacheManyUuids)
 		testing::Matcher<const std::string&>(testing::_)))
 			.WillRepeatedly(testing::DoDefault());
 
-	enlighten::lib::uuid_t uuid1 = "123456-789ABCDEF";
-	enlighten::lib::uuid_t uuid2 = "56789A-789ABCDEF";
-	enlighten::lib::uuid_t uuid3 = "FEDCBA-12345ADBE";
-	enlighten::lib::uuid_t uuid4 = "ABCDEF-123456789"; // not in cache
+	enlighten::lib::uuid_t uuid1("12345678-9ABC-4DEF-8123-456789ABCDEF");
+	enlighten::lib::uuid_t uuid2("56789ABC-DEF0-4123-8456-789ABCDEF012");
+	enlighten::lib::uuid_t uuid3("FEDCBA98-7654-4321-8FED-CBA987654321");
+	enlighten::lib::uuid_t uuid4("ABCDEF12-3456-4789-8ABC-DEF123456789"); // not in cache
 
 	CachedPreviews previews(&settings);
 	EXPECT_TRUE(previews.loadOrCreateDatabase());
-	EXPECT_TRUE(previews.markAsCached(uuid1));
-	EXPECT_TRUE(previews.markAsCached(uuid2));
-	EXPECT_TRUE(previews.markAsCached(uuid3));
+	EXPECT_TRUE(previews.markAsCached(uuid1, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid2, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid3, fakeDigest));
 
 	EXPECT_TRUE(previews.isInCache(uuid1));
 	EXPECT_TRUE(previews.isInCache(uuid2));
@@ -156,15 +159,15 @@ TEST_F(CachedPreviewsTest, ShouldReturnNumberOfCachedPreviews)
 		testing::Matcher<const std::string&>(testing::_)))
 			.WillRepeatedly(testing::DoDefault());
 
-	enlighten::lib::uuid_t uuid1 = "123456-789ABCDEF";
-	enlighten::lib::uuid_t uuid2 = "56789A-789ABCDEF";
-	enlighten::lib::uuid_t uuid3 = "FEDCBA-12345ADBE";
+	enlighten::lib::uuid_t uuid1("12345678-9ABC-4DEF-8123-456789ABCDEF");
+	enlighten::lib::uuid_t uuid2("56789ABC-DEF0-4123-8456-789ABCDEF012");
+	enlighten::lib::uuid_t uuid3("FEDCBA98-7654-4321-8FED-CBA987654321");
 
 	CachedPreviews previews(&settings);
 	EXPECT_TRUE(previews.loadOrCreateDatabase());
-	EXPECT_TRUE(previews.markAsCached(uuid1));
-	EXPECT_TRUE(previews.markAsCached(uuid2));
-	EXPECT_TRUE(previews.markAsCached(uuid3));
+	EXPECT_TRUE(previews.markAsCached(uuid1, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid2, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid3, fakeDigest));
 
 	EXPECT_EQ(3, previews.numberOfCachedPreviews());
 }
@@ -177,15 +180,428 @@ TEST_F(CachedPreviewsTest, ShouldGenerateProxySetForCachedEntries)
 		testing::Matcher<const std::string&>(testing::_)))
 			.WillRepeatedly(testing::DoDefault());
 
-	enlighten::lib::uuid_t uuid1 = "123456-789ABCDEF";
-	enlighten::lib::uuid_t uuid2 = "56789A-789ABCDEF";
+	enlighten::lib::uuid_t uuid1("12345678-9ABC-4DEF-8123-456789ABCDEF");
+	enlighten::lib::uuid_t uuid2("56789ABC-DEF0-4123-8456-789ABCDEF012");
 
 	CachedPreviews previews(&settings);
 	EXPECT_TRUE(previews.loadOrCreateDatabase());
-	EXPECT_TRUE(previews.markAsCached(uuid1));
-	EXPECT_TRUE(previews.markAsCached(uuid2));
+	EXPECT_TRUE(previews.markAsCached(uuid1, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid2, fakeDigest));
 
 	previews.generateProxy(entries);
 
 	EXPECT_EQ(2, entries.size());
 }
+
+TEST_F(CachedPreviewsTest, ShouldWalkCachedUuidsInOrderOnce)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t uuid1("FEDCBA98-7654-4321-8FED-CBA987654321");
+	enlighten::lib::uuid_t uuid2("12345678-9ABC-4DEF-8123-456789ABCDEF");
+	enlighten::lib::uuid_t uuid3("56789ABC-DEF0-4123-8456-789ABCDEF012");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_TRUE(previews.markAsCached(uuid1, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid2, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid3, fakeDigest));
+	EXPECT_TRUE(previews.markAsCached(uuid2, fakeDigest));
+
+	ICachedUuidCursor* cursor = previews.createOrderedCursor();
+	ASSERT_TRUE(cursor != nullptr);
+
+	enlighten::lib::uuid_t uuid;
+	std::string digest;
+	EXPECT_TRUE(cursor->next(uuid, digest));
+	EXPECT_EQ(uuid2, uuid);
+	EXPECT_EQ(fakeDigest, digest);
+	EXPECT_TRUE(cursor->next(uuid, digest));
+	EXPECT_EQ(uuid3, uuid);
+	EXPECT_TRUE(cursor->next(uuid, digest));
+	EXPECT_EQ(uuid1, uuid);
+	EXPECT_FALSE(cursor->next(uuid, digest));
+
+	delete cursor;
+}
+
+TEST_F(CachedPreviewsTest, ShouldReplaceTheDigestOfACachedPreview)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t uuid("12345678-9ABC-4DEF-8123-456789ABCDEF");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+	std::string digest;
+	EXPECT_FALSE(previews.digestForUuid(uuid, digest));
+
+	EXPECT_TRUE(previews.markAsCached(uuid, fakeDigest));
+	EXPECT_TRUE(previews.digestForUuid(uuid, digest));
+	EXPECT_EQ(fakeDigest, digest);
+
+	EXPECT_TRUE(previews.markAsCached(uuid, "ffcc63f155500a902b21fef7be6585b5"));
+	EXPECT_TRUE(previews.digestForUuid(uuid, digest));
+	EXPECT_EQ("ffcc63f155500a902b21fef7be6585b5", digest);
+	EXPECT_EQ(1, previews.numberOfCachedPreviews());
+}
+
+TEST_F(CachedPreviewsTest, ShouldRemoveAPreviewFromTheCache)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t uuid("12345678-9ABC-4DEF-8123-456789ABCDEF");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_TRUE(previews.markAsCached(uuid, fakeDigest));
+
+	EXPECT_TRUE(previews.removeFromCache(uuid));
+	EXPECT_FALSE(previews.isInCache(uuid));
+	EXPECT_EQ(0, previews.numberOfCachedPreviews());
+}
+
+TEST_F(CachedPreviewsTest, ShouldAddADigestColumnToAnOlderCache)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	// The checked in cache predates digests
+	{
+		File file(CachedPreviews::databaseFileName());
+		EXPECT_TRUE(file.duplicate((CachedPreviewsTest_PathToCachedPreviewsRoot +
+			CachedPreviews::databaseFileName()).c_str()));
+	}
+
+	enlighten::lib::uuid_t uuid("12345678-9ABC-4DEF-8123-456789ABCDEF");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_TRUE(previews.markAsCached(uuid, fakeDigest));
+
+	std::string digest;
+	EXPECT_TRUE(previews.digestForUuid(uuid, digest));
+	EXPECT_EQ(fakeDigest, digest);
+}
+
+TEST_F(CachedPreviewsTest, ShouldMigrateAnUnversionedCacheToAUuidPrimaryKey)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	const std::string filePath = CachedPreviewsTest_PathToCachedPreviewsRoot +
+		CachedPreviews::databaseFileName();
+
+	// Older caches could record the same uuid more than once
+	{
+		sqlite3* db = nullptr;
+		ASSERT_EQ(SQLITE_OK, sqlite3_open(filePath.c_str(), &db));
+		EXPECT_EQ(SQLITE_OK, sqlite3_exec(db,
+			"CREATE TABLE PreviewsCache(uuid TEXT NOT NULL);"
+			"INSERT INTO PreviewsCache VALUES ('12345678-9ABC-4DEF-8123-456789ABCDEF');"
+			"INSERT INTO PreviewsCache VALUES ('12345678-9ABC-4DEF-8123-456789ABCDEF');"
+			"INSERT INTO PreviewsCache VALUES ('3829E5FC-8E6C-4A93-9E8C-EAB0E0E2A3BF')",
+			NULL, NULL, NULL));
+		sqlite3_close(db);
+	}
+
+	{
+		CachedPreviews previews(&settings);
+		EXPECT_TRUE(previews.loadOrCreateDatabase());
+		EXPECT_EQ(2, previews.numberOfCachedPreviews());
+		EXPECT_TRUE(previews.isInCache(enlighten::lib::uuid_t("12345678-9ABC-4DEF-8123-456789ABCDEF")));
+	}
+
+	sqlite3* db = nullptr;
+	ASSERT_EQ(SQLITE_OK, sqlite3_open(filePath.c_str(), &db));
+
+	sqlite3_stmt* statement = nullptr;
+	ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &statement, NULL));
+	ASSERT_EQ(SQLITE_ROW, sqlite3_step(statement));
+	EXPECT_EQ(5, sqlite3_column_int(statement, 0));
+	sqlite3_finalize(statement);
+
+	// WITHOUT ROWID tables have no rowid to select
+	statement = nullptr;
+	EXPECT_NE(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT rowid FROM PreviewsCache", -1,
+		&statement, NULL));
+	sqlite3_finalize(statement);
+
+	sqlite3_close(db);
+}
+
+TEST_F(CachedPreviewsTest, ShouldReopenACacheAtTheCurrentSchemaVersion)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t uuid("12345678-9ABC-4DEF-8123-456789ABCDEF");
+
+	{
+		CachedPreviews previews(&settings);
+		EXPECT_TRUE(previews.loadOrCreateDatabase());
+		EXPECT_TRUE(previews.markAsCached(uuid, fakeDigest));
+	}
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_EQ(1, previews.numberOfCachedPreviews());
+
+	std::string digest;
+	EXPECT_TRUE(previews.digestForUuid(uuid, digest));
+	EXPECT_EQ(fakeDigest, digest);
+}
+
+TEST_F(CachedPreviewsTest, ShouldApplyABatchOfUpdatesInOneGo)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t kept("12345678-9ABC-4DEF-8123-456789ABCDEF");
+	enlighten::lib::uuid_t removed("3829E5FC-8E6C-4A93-9E8C-EAB0E0E2A3BF");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_TRUE(previews.markAsCached(removed, fakeDigest));
+
+	std::vector<CachedPreviewUpdate> updates = {
+		{ kept, SyncAction_Add, "" },
+		{ kept, SyncAction_Update, fakeDigest },
+		{ removed, SyncAction_Remove, fakeDigest }
+	};
+	EXPECT_TRUE(previews.applyUpdates(updates));
+
+	EXPECT_EQ(1, previews.numberOfCachedPreviews());
+	EXPECT_FALSE(previews.isInCache(removed));
+
+	std::string digest;
+	EXPECT_TRUE(previews.digestForUuid(kept, digest));
+	EXPECT_EQ(fakeDigest, digest);
+}
+
+TEST_F(CachedPreviewsTest, ShouldJournalJobsUntilTheyAreDone)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t uploaded("12345678-9ABC-4DEF-8123-456789ABCDEF");
+	enlighten::lib::uuid_t failed("3829E5FC-8E6C-4A93-9E8C-EAB0E0E2A3BF");
+
+	{
+		CachedPreviews previews(&settings);
+		EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+		std::map<enlighten::lib::uuid_t, SyncAction> jobs = {
+			{ uploaded, SyncAction_Add },
+			{ failed, SyncAction_Update }
+		};
+		EXPECT_TRUE(previews.journalJobs(jobs));
+		EXPECT_TRUE(previews.markJobInFlight(uploaded));
+		EXPECT_TRUE(previews.markJobFailed(failed, 0));
+		EXPECT_TRUE(previews.markJobFailed(failed, 0));
+
+		std::vector<CachedPreviewUpdate> updates = { { uploaded, SyncAction_Add, fakeDigest } };
+		EXPECT_TRUE(previews.applyUpdates(updates));
+		EXPECT_TRUE(previews.purgeFinishedJobs());
+	}
+
+	// The journal outlives the connection
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+	std::vector<SyncJob> unfinished;
+	EXPECT_TRUE(previews.unfinishedJobs(unfinished));
+	ASSERT_EQ(1, unfinished.size());
+	EXPECT_EQ(failed, unfinished[0].uuid);
+	EXPECT_EQ(SyncAction_Update, unfinished[0].action);
+	EXPECT_EQ(SyncJobState_Failed, unfinished[0].state);
+	EXPECT_EQ(2, unfinished[0].retries);
+
+	// Diffing a job again starts it over
+	std::map<enlighten::lib::uuid_t, SyncAction> jobs = { { failed, SyncAction_Add } };
+	EXPECT_TRUE(previews.journalJobs(jobs));
+
+	unfinished.clear();
+	EXPECT_TRUE(previews.unfinishedJobs(unfinished));
+	ASSERT_EQ(1, unfinished.size());
+	EXPECT_EQ(SyncJobState_Pending, unfinished[0].state);
+	EXPECT_EQ(0, unfinished[0].retries);
+}
+
+TEST_F(CachedPreviewsTest, ShouldHoldFailedJobsBackUntilTheirRetryIsDue)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t pending("12345678-9ABC-4DEF-8123-456789ABCDEF");
+	enlighten::lib::uuid_t failed("3829E5FC-8E6C-4A93-9E8C-EAB0E0E2A3BF");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+	std::map<enlighten::lib::uuid_t, SyncAction> jobs = {
+		{ pending, SyncAction_Add },
+		{ failed, SyncAction_Add }
+	};
+	std::map<enlighten::lib::uuid_t, std::string> digests = {
+		{ pending, "07cc63f155500a902b21fef7be6585b5" },
+		{ failed, "07cc63f155500a902b21fef7be6585b5" }
+	};
+	EXPECT_TRUE(previews.journalJobs(jobs, digests));
+	EXPECT_TRUE(previews.markJobFailed(failed, 5000));
+
+	std::vector<SyncJob> due;
+	EXPECT_TRUE(previews.dueJobs(1000, due));
+	ASSERT_EQ(1, due.size());
+	EXPECT_EQ(pending, due[0].uuid);
+
+	int64_t retryAt;
+	EXPECT_TRUE(previews.earliestRetry(retryAt));
+	EXPECT_EQ(0, retryAt);
+
+	// Diffing the same change again doesn't cut its backoff short
+	EXPECT_TRUE(previews.journalJobs(jobs, digests));
+
+	SyncJob job;
+	EXPECT_TRUE(previews.jobForUuid(failed, job));
+	EXPECT_EQ(SyncJobState_Failed, job.state);
+	EXPECT_EQ(1, job.retries);
+	EXPECT_EQ(5000, job.retryAt);
+	EXPECT_EQ("07cc63f155500a902b21fef7be6585b5", job.digest);
+
+	due.clear();
+	EXPECT_TRUE(previews.dueJobs(5000, due));
+	EXPECT_EQ(2, due.size());
+}
+
+TEST_F(CachedPreviewsTest, ShouldRestartFailedJobsWhenTheirDigestChanges)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t failed("3829E5FC-8E6C-4A93-9E8C-EAB0E0E2A3BF");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+	std::map<enlighten::lib::uuid_t, SyncAction> jobs = { { failed, SyncAction_Add } };
+	std::map<enlighten::lib::uuid_t, std::string> digests = {
+		{ failed, "07cc63f155500a902b21fef7be6585b5" }
+	};
+	EXPECT_TRUE(previews.journalJobs(jobs, digests));
+	EXPECT_TRUE(previews.markJobFailed(failed, 5000));
+
+	// The photo was edited meanwhile, so the new preview goes now
+	digests[failed] = "ffcc63f155500a902b21fef7be6585b5";
+	EXPECT_TRUE(previews.journalJobs(jobs, digests));
+
+	std::vector<SyncJob> due;
+	EXPECT_TRUE(previews.dueJobs(1000, due));
+	ASSERT_EQ(1, due.size());
+	EXPECT_EQ(SyncJobState_Pending, due[0].state);
+	EXPECT_EQ(0, due[0].retries);
+	EXPECT_EQ("ffcc63f155500a902b21fef7be6585b5", due[0].digest);
+}
+
+TEST_F(CachedPreviewsTest, ShouldKeepDeadLetteredJobsUntilRequeued)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t failed("3829E5FC-8E6C-4A93-9E8C-EAB0E0E2A3BF");
+
+	{
+		CachedPreviews previews(&settings);
+		EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+		std::map<enlighten::lib::uuid_t, SyncAction> jobs = { { failed, SyncAction_Add } };
+		std::map<enlighten::lib::uuid_t, std::string> digests = {
+			{ failed, "07cc63f155500a902b21fef7be6585b5" }
+		};
+		EXPECT_TRUE(previews.journalJobs(jobs, digests));
+		EXPECT_TRUE(previews.markJobFailed(failed, 0));
+		EXPECT_TRUE(previews.markJobDeadLettered(failed));
+		EXPECT_TRUE(previews.purgeFinishedJobs());
+
+		// Given up on, so neither retried nor diffed back in as it was
+		EXPECT_TRUE(previews.journalJobs(jobs, digests));
+
+		int64_t retryAt;
+		EXPECT_FALSE(previews.earliestRetry(retryAt));
+
+		std::vector<SyncJob> unfinished;
+		EXPECT_TRUE(previews.unfinishedJobs(unfinished));
+		EXPECT_TRUE(unfinished.empty());
+	}
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+	std::vector<SyncJob> deadLettered;
+	EXPECT_TRUE(previews.deadLetteredJobs(deadLettered));
+	ASSERT_EQ(1, deadLettered.size());
+	EXPECT_EQ(failed, deadLettered[0].uuid);
+	EXPECT_EQ(1, deadLettered[0].retries);
+
+	EXPECT_TRUE(previews.requeueDeadLetteredJobs());
+
+	std::vector<SyncJob> due;
+	EXPECT_TRUE(previews.dueJobs(0, due));
+	ASSERT_EQ(1, due.size());
+	EXPECT_EQ(SyncJobState_Pending, due[0].state);
+	EXPECT_EQ(0, due[0].retries);
+
+	deadLettered.clear();
+	EXPECT_TRUE(previews.deadLetteredJobs(deadLettered));
+	EXPECT_TRUE(deadLettered.empty());
+}
+
+TEST_F(CachedPreviewsTest, ShouldRequeueDeadLetteredJobsWhenTheirDigestChanges)
+{
+	EXPECT_CALL(settings, get(IEnlightenSettings::CachedDatabasePath,
+		testing::Matcher<const std::string&>(testing::_)))
+			.WillRepeatedly(testing::DoDefault());
+
+	enlighten::lib::uuid_t failed("3829E5FC-8E6C-4A93-9E8C-EAB0E0E2A3BF");
+
+	CachedPreviews previews(&settings);
+	EXPECT_TRUE(previews.loadOrCreateDatabase());
+
+	std::map<enlighten::lib::uuid_t, SyncAction> jobs = { { failed, SyncAction_Add } };
+	std::map<enlighten::lib::uuid_t, std::string> digests = {
+		{ failed, "07cc63f155500a902b21fef7be6585b5" }
+	};
+	EXPECT_TRUE(previews.journalJobs(jobs, digests));
+	EXPECT_TRUE(previews.markJobFailed(failed, 0));
+	EXPECT_TRUE(previews.markJobDeadLettered(failed));
+
+	// A rewritten preview is a new job, whatever became of the old one
+	digests[failed] = "ffcc63f155500a902b21fef7be6585b5";
+	EXPECT_TRUE(previews.journalJobs(jobs, digests));
+
+	std::vector<SyncJob> due;
+	EXPECT_TRUE(previews.dueJobs(0, due));
+	ASSERT_EQ(1, due.size());
+	EXPECT_EQ(failed, due[0].uuid);
+	EXPECT_EQ(SyncJobState_Pending, due[0].state);
+	EXPECT_EQ(0, due[0].retries);
+
+	std::vector<SyncJob> deadLettered;
+	EXPECT_TRUE(previews.deadLetteredJobs(deadLettered));
+	EXPECT_TRUE(deadLettered.empty());
+}
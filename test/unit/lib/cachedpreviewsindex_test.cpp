@@ -0,0 +1,112 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "cachedpreviewsindex.h"
+
+using namespace enlighten::lib;
+
+namespace
+{
+	const std::string fakeDigest = "07cc63f155500a902b21fef7be6585b5";
+
+	enlighten::lib::uuid_t uuidWithIndex(uint32_t index)
+	{
+		char uuidString[37];
+		snprintf(uuidString, sizeof(uuidString), "12345678-9ABC-4DEF-8123-%012X", index);
+		return enlighten::lib::uuid_t(uuidString);
+	}
+}
+
+TEST(CachedPreviewsIndexTest, ShouldStartEmpty)
+{
+	CachedPreviewsIndex index;
+
+	EXPECT_EQ(0, index.numberOfEntries());
+	EXPECT_FALSE(index.contains(uuidWithIndex(0)));
+}
+
+TEST(CachedPreviewsIndexTest, ShouldFindInsertedUuids)
+{
+	CachedPreviewsIndex index;
+	index.insert(uuidWithIndex(1), fakeDigest);
+	index.insert(uuidWithIndex(2), "");
+
+	EXPECT_EQ(2, index.numberOfEntries());
+	EXPECT_TRUE(index.contains(uuidWithIndex(1)));
+	EXPECT_FALSE(index.contains(uuidWithIndex(3)));
+
+	std::string digest;
+	EXPECT_TRUE(index.digestForUuid(uuidWithIndex(1), digest));
+	EXPECT_EQ(fakeDigest, digest);
+	EXPECT_TRUE(index.digestForUuid(uuidWithIndex(2), digest));
+	EXPECT_EQ("", digest);
+}
+
+TEST(CachedPreviewsIndexTest, ShouldReplaceTheDigestOfAnExistingUuid)
+{
+	CachedPreviewsIndex index;
+	index.insert(uuidWithIndex(1), "");
+	index.insert(uuidWithIndex(1), fakeDigest);
+
+	EXPECT_EQ(1, index.numberOfEntries());
+
+	std::string digest;
+	EXPECT_TRUE(index.digestForUuid(uuidWithIndex(1), digest));
+	EXPECT_EQ(fakeDigest, digest);
+}
+
+TEST(CachedPreviewsIndexTest, ShouldForgetRemovedUuids)
+{
+	CachedPreviewsIndex index;
+	index.insert(uuidWithIndex(1), fakeDigest);
+	index.remove(uuidWithIndex(1));
+
+	EXPECT_EQ(0, index.numberOfEntries());
+	EXPECT_FALSE(index.contains(uuidWithIndex(1)));
+
+	std::string digest;
+	EXPECT_FALSE(index.digestForUuid(uuidWithIndex(1), digest));
+}
+
+TEST(CachedPreviewsIndexTest, ShouldKeepFindingUuidsAsTheFilterGrows)
+{
+	const uint32_t numberOfUuids = 10000;
+
+	CachedPreviewsIndex index;
+	for (uint32_t i = 0; i < numberOfUuids; i += 2)
+		index.insert(uuidWithIndex(i), fakeDigest);
+
+	uint32_t found = 0;
+	for (uint32_t i = 0; i < numberOfUuids; ++i)
+	{
+		if (index.contains(uuidWithIndex(i)))
+			++found;
+	}
+
+	EXPECT_EQ(numberOfUuids / 2, index.numberOfEntries());
+	EXPECT_EQ(numberOfUuids / 2, found);
+}
+
+TEST(CachedPreviewsIndexTest, ShouldCopyUuidsIntoAProxySet)
+{
+	CachedPreviewsIndex index;
+	index.insert(uuidWithIndex(1), fakeDigest);
+	index.insert(uuidWithIndex(2), fakeDigest);
+
+	std::set<enlighten::lib::uuid_t> uuids;
+	index.copyUuids(uuids);
+
+	EXPECT_EQ(2, uuids.size());
+	EXPECT_EQ(1, uuids.count(uuidWithIndex(2)));
+}
+
+TEST(CachedPreviewsIndexTest, ShouldBeEmptyOnceCleared)
+{
+	CachedPreviewsIndex index;
+	index.reserve(5000);
+	index.insert(uuidWithIndex(1), fakeDigest);
+	index.clear();
+
+	EXPECT_EQ(0, index.numberOfEntries());
+	EXPECT_FALSE(index.contains(uuidWithIndex(1)));
+}
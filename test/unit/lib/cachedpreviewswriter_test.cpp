@@ -0,0 +1,114 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "cachedpreviewswriter.h"
+
+#include <thread>
+
+using namespace enlighten::lib;
+
+namespace
+{
+	const std::string fakeDigest = "07cc63f155500a902b21fef7be6585b5";
+
+	class MockCachedPreviews : public ICachedPreviews
+	{
+	public:
+		MOCK_CONST_METHOD0(numberOfCachedPreviews, uint32_t());
+
+		MOCK_CONST_METHOD1(generateProxy, bool(std::set<enlighten::lib::uuid_t>&));
+		MOCK_CONST_METHOD0(createOrderedCursor, ICachedUuidCursor*());
+		MOCK_CONST_METHOD1(isInCache, bool(const enlighten::lib::uuid_t&));
+		MOCK_CONST_METHOD2(digestForUuid, bool(const enlighten::lib::uuid_t&, std::string&));
+		MOCK_METHOD2(markAsCached, bool(const enlighten::lib::uuid_t&, const std::string&));
+		MOCK_METHOD1(removeFromCache, bool(const enlighten::lib::uuid_t&));
+		MOCK_METHOD1(applyUpdates, bool(const std::vector<CachedPreviewUpdate>&));
+	};
+
+	enlighten::lib::uuid_t uuidWithIndex(uint32_t index)
+	{
+		char uuidString[37];
+		snprintf(uuidString, sizeof(uuidString), "12345678-9ABC-4DEF-8123-%012X", index);
+		return enlighten::lib::uuid_t(uuidString);
+	}
+}
+
+TEST(CachedPreviewsWriterTest, ShouldHoldUpdatesUntilTheBatchIsFull)
+{
+	MockCachedPreviews cache;
+	CachedPreviewsWriter writer(&cache, 3, 60000);
+
+	EXPECT_CALL(cache, applyUpdates(testing::SizeIs(3)))
+		.Times(1)
+		.WillOnce(testing::Return(true));
+
+	EXPECT_TRUE(writer.add(uuidWithIndex(0), SyncAction_Add, fakeDigest));
+	EXPECT_TRUE(writer.add(uuidWithIndex(1), SyncAction_Update, fakeDigest));
+	EXPECT_EQ(2, writer.numberOfPendingUpdates());
+
+	EXPECT_TRUE(writer.add(uuidWithIndex(2), SyncAction_Remove, fakeDigest));
+	EXPECT_EQ(0, writer.numberOfPendingUpdates());
+}
+
+TEST(CachedPreviewsWriterTest, ShouldWriteABatchOnceItsOldestUpdateIsTooOld)
+{
+	MockCachedPreviews cache;
+	CachedPreviewsWriter writer(&cache, 100, 1);
+
+	EXPECT_CALL(cache, applyUpdates(testing::SizeIs(2)))
+		.Times(1)
+		.WillOnce(testing::Return(true));
+
+	EXPECT_TRUE(writer.add(uuidWithIndex(0), SyncAction_Add, fakeDigest));
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	EXPECT_TRUE(writer.add(uuidWithIndex(1), SyncAction_Add, fakeDigest));
+
+	EXPECT_EQ(0, writer.numberOfPendingUpdates());
+}
+
+TEST(CachedPreviewsWriterTest, ShouldWritePendingUpdatesWhenFlushed)
+{
+	MockCachedPreviews cache;
+	CachedPreviewsWriter writer(&cache, 100, 60000);
+
+	std::vector<CachedPreviewUpdate> written;
+	EXPECT_CALL(cache, applyUpdates(testing::_))
+		.Times(1)
+		.WillOnce(testing::DoAll(testing::SaveArg<0>(&written), testing::Return(true)));
+
+	EXPECT_TRUE(writer.add(uuidWithIndex(7), SyncAction_Remove, fakeDigest));
+	EXPECT_TRUE(writer.flush());
+
+	ASSERT_EQ(1, written.size());
+	EXPECT_EQ(uuidWithIndex(7), written[0].uuid);
+	EXPECT_EQ(SyncAction_Remove, written[0].action);
+	EXPECT_EQ(fakeDigest, written[0].digest);
+
+	// Nothing left to write
+	EXPECT_TRUE(writer.flush());
+}
+
+TEST(CachedPreviewsWriterTest, ShouldFlushWhenDestroyed)
+{
+	MockCachedPreviews cache;
+
+	EXPECT_CALL(cache, applyUpdates(testing::SizeIs(1)))
+		.Times(1)
+		.WillOnce(testing::Return(true));
+
+	CachedPreviewsWriter writer(&cache, 100, 60000);
+	EXPECT_TRUE(writer.add(uuidWithIndex(0), SyncAction_Add, fakeDigest));
+}
+
+TEST(CachedPreviewsWriterTest, ShouldDropABatchWhichFailedToWrite)
+{
+	MockCachedPreviews cache;
+	CachedPreviewsWriter writer(&cache, 1, 60000);
+
+	EXPECT_CALL(cache, applyUpdates(testing::_))
+		.Times(1)
+		.WillOnce(testing::Return(false));
+
+	EXPECT_FALSE(writer.add(uuidWithIndex(0), SyncAction_Add, fakeDigest));
+	EXPECT_EQ(0, writer.numberOfPendingUpdates());
+}
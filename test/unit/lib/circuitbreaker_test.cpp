@@ -0,0 +1,85 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "circuitbreaker.h"
+#include "retrypolicy.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace enlighten::lib;
+
+TEST(CircuitBreakerTest, ShouldAllowRequestsWhileClosed)
+{
+	CircuitBreaker breaker(3, 50, 200);
+
+	breaker.recordFailure();
+	breaker.recordFailure();
+
+	EXPECT_FALSE(breaker.isOpen());
+	EXPECT_TRUE(breaker.allowRequest());
+	EXPECT_EQ(0, breaker.reopensAt());
+}
+
+TEST(CircuitBreakerTest, ShouldOpenAfterEnoughFailuresInARow)
+{
+	CircuitBreaker breaker(3, 10000, 20000);
+
+	breaker.recordFailure();
+	breaker.recordFailure();
+	breaker.recordSuccess();
+	breaker.recordFailure();
+	breaker.recordFailure();
+	EXPECT_FALSE(breaker.isOpen());
+
+	int64_t failedAt = RetryPolicy::currentTimeMs();
+	breaker.recordFailure();
+
+	EXPECT_TRUE(breaker.isOpen());
+	EXPECT_FALSE(breaker.allowRequest());
+	EXPECT_GE(breaker.reopensAt(), failedAt + 10000);
+}
+
+TEST(CircuitBreakerTest, ShouldLetOneTrialThroughAfterCoolingDown)
+{
+	CircuitBreaker breaker(1, 50, 200);
+
+	breaker.recordFailure();
+	EXPECT_FALSE(breaker.allowRequest());
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(80));
+
+	EXPECT_TRUE(breaker.allowRequest());
+	EXPECT_FALSE(breaker.allowRequest());
+
+	breaker.recordSuccess();
+	EXPECT_FALSE(breaker.isOpen());
+	EXPECT_TRUE(breaker.allowRequest());
+	EXPECT_TRUE(breaker.allowRequest());
+}
+
+TEST(CircuitBreakerTest, ShouldWaitLongerWhenTheTrialFails)
+{
+	CircuitBreaker breaker(1, 50, 80);
+
+	breaker.recordFailure();
+	std::this_thread::sleep_for(std::chrono::milliseconds(80));
+	ASSERT_TRUE(breaker.allowRequest());
+
+	int64_t failedAt = RetryPolicy::currentTimeMs();
+	breaker.recordFailure();
+
+	// Doubled, but no further than the cap
+	EXPECT_TRUE(breaker.isOpen());
+	EXPECT_GE(breaker.reopensAt(), failedAt + 80);
+	EXPECT_LE(breaker.reopensAt(), RetryPolicy::currentTimeMs() + 80);
+	EXPECT_FALSE(breaker.allowRequest());
+}
+
+TEST(CircuitBreakerTest, ShouldShareABreakerPerDestination)
+{
+	CircuitBreaker& first = CircuitBreaker::forDestination("CircuitBreakerTest-first");
+
+	EXPECT_EQ(&first, &CircuitBreaker::forDestination("CircuitBreakerTest-first"));
+	EXPECT_NE(&first, &CircuitBreaker::forDestination("CircuitBreakerTest-second"));
+}
@@ -0,0 +1,147 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "concurrencylimiter.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace enlighten::lib;
+
+namespace
+{
+	// Runs a window's worth of samples with the limit fully used
+	void runSaturatedWindow(ConcurrencyLimiter& limiter, double latencyMs, bool succeeded = true)
+	{
+		std::atomic<bool> cancel(false);
+
+		uint32_t limit = limiter.limit();
+		for (uint32_t i = 0; i < limit; ++i)
+			ASSERT_TRUE(limiter.acquire(cancel));
+
+		uint32_t samples = std::max<uint32_t>(10, 2 * limit);
+		for (uint32_t i = 0; i < samples; ++i)
+			limiter.recordSample(latencyMs, 1000, succeeded);
+
+		for (uint32_t i = 0; i < limit; ++i)
+			limiter.release();
+	}
+}
+
+TEST(ConcurrencyLimiterTest, ShouldClampTheInitialLimit)
+{
+	EXPECT_EQ(2, ConcurrencyLimiter(0, 2, 8).limit());
+	EXPECT_EQ(8, ConcurrencyLimiter(20, 2, 8).limit());
+	EXPECT_EQ(4, ConcurrencyLimiter(4, 2, 8).limit());
+}
+
+TEST(ConcurrencyLimiterTest, ShouldBlockAtTheLimitUntilReleased)
+{
+	ConcurrencyLimiter limiter(1, 1, 1);
+	std::atomic<bool> cancel(false);
+
+	ASSERT_TRUE(limiter.acquire(cancel));
+
+	std::atomic<bool> acquired(false);
+	std::thread waiter([&]()
+	{
+		acquired = limiter.acquire(cancel);
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_FALSE(acquired);
+
+	limiter.release();
+	waiter.join();
+	EXPECT_TRUE(acquired);
+	EXPECT_EQ(1, limiter.stats().inUse);
+}
+
+TEST(ConcurrencyLimiterTest, ShouldGiveUpWaitingWhenCancelled)
+{
+	ConcurrencyLimiter limiter(1, 1, 1);
+	std::atomic<bool> cancel(false);
+
+	ASSERT_TRUE(limiter.acquire(cancel));
+
+	cancel = true;
+	EXPECT_FALSE(limiter.acquire(cancel));
+}
+
+TEST(ConcurrencyLimiterTest, ShouldGrowWhileLatencyHolds)
+{
+	ConcurrencyLimiter limiter(2, 1, 4);
+
+	runSaturatedWindow(limiter, 100.0);
+	EXPECT_EQ(3, limiter.limit());
+
+	runSaturatedWindow(limiter, 100.0);
+	runSaturatedWindow(limiter, 100.0);
+	runSaturatedWindow(limiter, 100.0);
+	EXPECT_EQ(4, limiter.limit());
+}
+
+TEST(ConcurrencyLimiterTest, ShouldNotGrowWhenTheLimitIsntReached)
+{
+	ConcurrencyLimiter limiter(4, 1, 8);
+
+	for (int i = 0; i < 10; ++i)
+		limiter.recordSample(100.0, 1000, true);
+
+	EXPECT_EQ(4, limiter.limit());
+}
+
+TEST(ConcurrencyLimiterTest, ShouldShrinkWhenLatencyRises)
+{
+	ConcurrencyLimiter limiter(8, 1, 8);
+
+	runSaturatedWindow(limiter, 100.0);
+	EXPECT_EQ(8, limiter.limit());
+
+	// Half as fast again: the extra time is queueing, so the limit follows
+	runSaturatedWindow(limiter, 150.0);
+	EXPECT_EQ(5, limiter.limit());
+
+	ConcurrencyStats stats = limiter.stats();
+	EXPECT_DOUBLE_EQ(150.0, stats.p50LatencyMs);
+	EXPECT_DOUBLE_EQ(100.0 * 1.02, stats.baselineLatencyMs);
+}
+
+TEST(ConcurrencyLimiterTest, ShouldHalveOnErrors)
+{
+	ConcurrencyLimiter limiter(8, 1, 8);
+
+	runSaturatedWindow(limiter, 100.0, false);
+	EXPECT_EQ(4, limiter.limit());
+	EXPECT_DOUBLE_EQ(1.0, limiter.stats().errorRate);
+
+	runSaturatedWindow(limiter, 100.0, false);
+	runSaturatedWindow(limiter, 100.0, false);
+	runSaturatedWindow(limiter, 100.0, false);
+	EXPECT_EQ(1, limiter.limit());
+}
+
+TEST(ConcurrencyLimiterTest, ShouldReportLatencyPercentiles)
+{
+	ConcurrencyLimiter limiter(1, 1, 1);
+
+	for (int i = 1; i <= 10; ++i)
+		limiter.recordSample(i * 10.0, 1000, true);
+
+	ConcurrencyStats stats = limiter.stats();
+	EXPECT_DOUBLE_EQ(50.0, stats.p50LatencyMs);
+	EXPECT_DOUBLE_EQ(100.0, stats.p95LatencyMs);
+	EXPECT_DOUBLE_EQ(0.0, stats.errorRate);
+	EXPECT_GT(stats.throughput, 0.0);
+}
+
+TEST(ConcurrencyLimiterTest, ShouldStayPutWhenFixed)
+{
+	ConcurrencyLimiter limiter(3, 3, 3);
+
+	runSaturatedWindow(limiter, 100.0);
+	runSaturatedWindow(limiter, 1000.0, false);
+
+	EXPECT_EQ(3, limiter.limit());
+}
@@ -0,0 +1,214 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "executor.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace enlighten::lib;
+
+namespace
+{
+	// Holds an executor's only worker until released, so tasks can be queued
+	// up behind it in a known order
+	class Gate
+	{
+	public:
+		Gate() : _open(false), _entered(false) {}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_entered = true;
+			_changed.notify_all();
+			_changed.wait(lock, [this]() { return _open; });
+		}
+
+		void waitUntilEntered()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_changed.wait(lock, [this]() { return _entered; });
+		}
+
+		void open()
+		{
+			std::lock_guard<std::mutex> autolock(_mutex);
+			_open = true;
+			_changed.notify_all();
+		}
+
+	private:
+		bool _open;
+		bool _entered;
+		std::mutex _mutex;
+		std::condition_variable _changed;
+	};
+
+	bool waitFor(const std::atomic<uint32_t>& counter, uint32_t expected)
+	{
+		for (int i = 0; i < 500 && counter != expected; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		return counter == expected;
+	}
+}
+
+TEST(ExecutorTest, ShouldRunSubmittedTasks)
+{
+	Executor executor(4);
+	Executor::GroupId group = executor.createGroup();
+
+	std::atomic<uint32_t> ran(0);
+	for (int i = 0; i < 100; ++i)
+		EXPECT_TRUE(executor.submit(group, Executor::PriorityNormal, [&ran]() { ++ran; }));
+
+	EXPECT_TRUE(waitFor(ran, 100));
+}
+
+TEST(ExecutorTest, ShouldHaveAtLeastOneWorker)
+{
+	Executor executor(0);
+	EXPECT_EQ(1, executor.numberOfWorkers());
+}
+
+TEST(ExecutorTest, ShouldNotAcceptTasksForUnknownGroups)
+{
+	Executor executor(1);
+	Executor::GroupId group = executor.createGroup();
+	executor.removeGroup(group);
+
+	EXPECT_FALSE(executor.submit(group, Executor::PriorityNormal, []() {}));
+}
+
+TEST(ExecutorTest, ShouldRunHigherPriorityTasksFirst)
+{
+	Executor executor(1);
+	Executor::GroupId group = executor.createGroup();
+
+	Gate gate;
+	executor.submit(group, Executor::PriorityNormal, [&gate]() { gate.wait(); });
+	gate.waitUntilEntered();
+
+	std::mutex mutex;
+	std::vector<int> order;
+	std::atomic<uint32_t> ran(0);
+	auto record = [&](int value)
+	{
+		return [&, value]()
+		{
+			std::lock_guard<std::mutex> autolock(mutex);
+			order.push_back(value);
+			++ran;
+		};
+	};
+
+	executor.submit(group, Executor::PriorityLow, record(Executor::PriorityLow));
+	executor.submit(group, Executor::PriorityNormal, record(Executor::PriorityNormal));
+	executor.submit(group, Executor::PriorityHigh, record(Executor::PriorityHigh));
+	gate.open();
+
+	ASSERT_TRUE(waitFor(ran, 3));
+	EXPECT_THAT(order, ::testing::ElementsAre(Executor::PriorityHigh, Executor::PriorityNormal,
+		Executor::PriorityLow));
+}
+
+TEST(ExecutorTest, ShouldTakeTurnsBetweenGroups)
+{
+	Executor executor(1);
+	Executor::GroupId busyGroup = executor.createGroup();
+	Executor::GroupId quietGroup = executor.createGroup();
+
+	Gate gate;
+	executor.submit(busyGroup, Executor::PriorityNormal, [&gate]() { gate.wait(); });
+	gate.waitUntilEntered();
+
+	std::mutex mutex;
+	std::vector<Executor::GroupId> order;
+	std::atomic<uint32_t> ran(0);
+	auto record = [&](Executor::GroupId group)
+	{
+		return [&, group]()
+		{
+			std::lock_guard<std::mutex> autolock(mutex);
+			order.push_back(group);
+			++ran;
+		};
+	};
+
+	// The busy group queues all of its work before the quiet one gets a look in
+	for (int i = 0; i < 3; ++i)
+		executor.submit(busyGroup, Executor::PriorityNormal, record(busyGroup));
+	executor.submit(quietGroup, Executor::PriorityNormal, record(quietGroup));
+	gate.open();
+
+	ASSERT_TRUE(waitFor(ran, 4));
+	EXPECT_THAT(order, ::testing::ElementsAre(quietGroup, busyGroup, busyGroup, busyGroup));
+}
+
+TEST(ExecutorTest, ShouldShareTasksSubmittedFromWorkers)
+{
+	Executor executor(4);
+	Executor::GroupId group = executor.createGroup();
+
+	std::mutex mutex;
+	std::set<std::thread::id> threads;
+	std::atomic<uint32_t> ran(0);
+
+	// Spawned work is queued like any other, so idle workers pick it up
+	executor.submit(group, Executor::PriorityNormal, [&]()
+	{
+		for (int i = 0; i < 64; ++i)
+		{
+			executor.submit(group, Executor::PriorityNormal, [&]()
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+				std::lock_guard<std::mutex> autolock(mutex);
+				threads.insert(std::this_thread::get_id());
+				++ran;
+			});
+		}
+	});
+
+	ASSERT_TRUE(waitFor(ran, 64));
+	EXPECT_GT(threads.size(), 1);
+}
+
+TEST(ExecutorTest, ShouldQueueTasksSubmittedFromWorkersByPriority)
+{
+	Executor executor(1);
+	Executor::GroupId group = executor.createGroup();
+
+	std::mutex mutex;
+	std::vector<int> order;
+	std::atomic<uint32_t> ran(0);
+
+	auto record = [&](int value)
+	{
+		return [&, value]()
+		{
+			std::lock_guard<std::mutex> autolock(mutex);
+			order.push_back(value);
+			++ran;
+		};
+	};
+
+	// The only worker is busy with the submitting task, so all three wait
+	// in the queues until it returns
+	executor.submit(group, Executor::PriorityNormal, [&]()
+	{
+		executor.submit(group, Executor::PriorityLow, record(Executor::PriorityLow));
+		executor.submit(group, Executor::PriorityNormal, record(Executor::PriorityNormal));
+		executor.submit(group, Executor::PriorityHigh, record(Executor::PriorityHigh));
+	});
+
+	ASSERT_TRUE(waitFor(ran, 3));
+	EXPECT_THAT(order, ::testing::ElementsAre(Executor::PriorityHigh, Executor::PriorityNormal,
+		Executor::PriorityLow));
+}
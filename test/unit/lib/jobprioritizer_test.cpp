@@ -0,0 +1,93 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "jobprioritizer.h"
+#include "previewsdatabase.h"
+
+using namespace enlighten::lib;
+
+namespace
+{
+	static const char* JobPrioritizer_ValidPreviewFile =
+		"catalogs/Lightroom 5 Catalog Previews.lrdata/previews.db";
+
+	// Captured at 17:50, 17:57 and 18:09 respectively
+	const enlighten::lib::uuid_t firstCaptured("3829E5FC-7F3F-4B22-94F3-FB5E2C796026");
+	const enlighten::lib::uuid_t secondCaptured("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C");
+	const enlighten::lib::uuid_t thirdCaptured("6A2B9912-3868-45E4-AE0D-7EA73F66FF63");
+
+	class FixedPrioritizer : public IJobPrioritizer
+	{
+	public:
+		bool preparePass() { return true; }
+		double priorityForUuid(const enlighten::lib::uuid_t& uuid) const
+		{
+			return uuid == firstCaptured ? 1.0 : 0.0;
+		}
+	};
+}
+
+TEST(JobPrioritizerTest, ShouldFindTheCatalogForAPreviewsDatabase)
+{
+	EXPECT_EQ("catalogs/Lightroom 5 Catalog.lrcat",
+		CaptureTimePrioritizer::catalogFileForPreviewsDatabase(JobPrioritizer_ValidPreviewFile));
+	EXPECT_EQ("", CaptureTimePrioritizer::catalogFileForPreviewsDatabase("previews.db"));
+}
+
+TEST(JobPrioritizerTest, ShouldPrioritizeByPyramidTime)
+{
+	PreviewsDatabase database;
+	ASSERT_TRUE(database.initialiseWithFile(JobPrioritizer_ValidPreviewFile));
+
+	PyramidTimePrioritizer prioritizer(&database);
+	EXPECT_TRUE(prioritizer.preparePass());
+
+	EXPECT_GT(prioritizer.priorityForUuid(thirdCaptured), prioritizer.priorityForUuid(firstCaptured));
+	EXPECT_EQ(0.0, prioritizer.priorityForUuid(enlighten::lib::uuid_t("12345678-9ABC-4DEF-8123-456789ABCDEF")));
+}
+
+TEST(JobPrioritizerTest, ShouldPrioritizeByCaptureTime)
+{
+	PreviewsDatabase database;
+	ASSERT_TRUE(database.initialiseWithFile(JobPrioritizer_ValidPreviewFile));
+
+	CaptureTimePrioritizer prioritizer(&database,
+		CaptureTimePrioritizer::catalogFileForPreviewsDatabase(JobPrioritizer_ValidPreviewFile));
+	EXPECT_TRUE(prioritizer.preparePass());
+
+	EXPECT_GT(prioritizer.priorityForUuid(thirdCaptured), prioritizer.priorityForUuid(secondCaptured));
+	EXPECT_GT(prioritizer.priorityForUuid(secondCaptured), prioritizer.priorityForUuid(firstCaptured));
+}
+
+TEST(JobPrioritizerTest, ShouldFallBackToPyramidTimeWithoutACatalog)
+{
+	PreviewsDatabase database;
+	ASSERT_TRUE(database.initialiseWithFile(JobPrioritizer_ValidPreviewFile));
+
+	CaptureTimePrioritizer prioritizer(&database, "catalogs/Missing Catalog.lrcat");
+	EXPECT_TRUE(prioritizer.preparePass());
+
+	// Both were rendered at the same time, after the first
+	EXPECT_EQ(prioritizer.priorityForUuid(thirdCaptured), prioritizer.priorityForUuid(secondCaptured));
+	EXPECT_GT(prioritizer.priorityForUuid(secondCaptured), prioritizer.priorityForUuid(firstCaptured));
+}
+
+TEST(JobPrioritizerTest, ShouldPutTheLatestRequestsFirst)
+{
+	FixedPrioritizer fallback;
+	RequestedPrioritizer prioritizer;
+	prioritizer.setFallback(&fallback);
+	EXPECT_TRUE(prioritizer.preparePass());
+
+	EXPECT_GT(prioritizer.priorityForUuid(firstCaptured), prioritizer.priorityForUuid(secondCaptured));
+
+	prioritizer.request(secondCaptured);
+	prioritizer.request(thirdCaptured);
+
+	EXPECT_GT(prioritizer.priorityForUuid(thirdCaptured), prioritizer.priorityForUuid(secondCaptured));
+	EXPECT_GT(prioritizer.priorityForUuid(secondCaptured), prioritizer.priorityForUuid(firstCaptured));
+
+	// Asking again moves it back to the front
+	prioritizer.request(secondCaptured);
+	EXPECT_GT(prioritizer.priorityForUuid(secondCaptured), prioritizer.priorityForUuid(thirdCaptured));
+}
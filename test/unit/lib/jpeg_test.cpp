@@ -118,6 +118,39 @@ TEST_F(JpegTest, ShouldDecompressAJpeg)
 	EXPECT_EQ(512, jpeg.height());
 }
 
+TEST_F(JpegTest, ShouldReadDimensionsWithoutDecompressing)
+{
+	loadTestAsset();
+
+	Jpeg jpeg(jpegBytes, byteSize, false);
+
+	uint32_t width, height, components;
+	EXPECT_TRUE(jpeg.readDimensions(width, height, components));
+	EXPECT_EQ(512, width);
+	EXPECT_EQ(512, height);
+	EXPECT_EQ(3, components);
+
+	EXPECT_TRUE(jpeg.rawBytes() == nullptr);
+	EXPECT_EQ(0, jpeg.width());
+}
+
+TEST_F(JpegTest, ShouldDecompressAJpegScaledDown)
+{
+	loadTestAsset();
+
+	Jpeg jpeg(jpegBytes, byteSize, false);
+
+	EXPECT_FALSE(jpeg.setScaleDenominator(3));
+	EXPECT_TRUE(jpeg.setScaleDenominator(4));
+
+	// Scaled images only come out whole
+	EXPECT_FALSE(jpeg.decompressPlanar());
+	EXPECT_TRUE(jpeg.decompress());
+
+	EXPECT_EQ(128, jpeg.width());
+	EXPECT_EQ(128, jpeg.height());
+}
+
 TEST_F(JpegTest, ShouldFailDecompressWhenNoSourceSet)
 {
 	Jpeg jpeg;
@@ -184,6 +217,83 @@ TEST_F(JpegTest, ShouldFailCompressWhenContainsDecompressedData)
 	EXPECT_FALSE(jpeg.compress(50));
 }
 
+TEST_F(JpegTest, ShouldDecompressAJpegToPlanes)
+{
+	loadTestAsset();
+
+	Jpeg jpeg(jpegBytes, byteSize, false);
+
+	EXPECT_TRUE(jpeg.decompressPlanar());
+	EXPECT_TRUE(jpeg.rawBytes() == nullptr);
+	ASSERT_EQ(3, jpeg.numberOfPlanes());
+
+	EXPECT_EQ(512, jpeg.width());
+	EXPECT_EQ(512, jpeg.height());
+
+	// The test asset is 4:2:2
+	const JpegPlane* luma = jpeg.plane(0);
+	ASSERT_TRUE(luma != nullptr);
+	EXPECT_EQ(512, luma->width);
+	EXPECT_EQ(512, luma->height);
+
+	const JpegPlane* chroma = jpeg.plane(1);
+	ASSERT_TRUE(chroma != nullptr);
+	EXPECT_EQ(256, chroma->width);
+	EXPECT_EQ(512, chroma->height);
+
+	EXPECT_TRUE(jpeg.plane(3) == nullptr);
+}
+
+TEST_F(JpegTest, ShouldFailDecompressToPlanesWhenAlreadyDecompressed)
+{
+	loadTestAsset();
+
+	Jpeg jpeg(jpegBytes, byteSize, false);
+	EXPECT_TRUE(jpeg.decompress());
+	EXPECT_FALSE(jpeg.decompressPlanar());
+}
+
+TEST_F(JpegTest, ShouldCompressFromPlanes)
+{
+	loadTestAsset();
+
+	Jpeg source(jpegBytes, byteSize, false);
+	ASSERT_TRUE(source.decompressPlanar());
+
+	JpegPlane planes[3] = { *source.plane(0), *source.plane(1), *source.plane(2) };
+
+	Jpeg jpeg;
+	EXPECT_TRUE(jpeg.fromPlanes(planes, 3, source.width(), source.height()));
+	EXPECT_TRUE(jpeg.compress(40));
+
+	uint32_t compressedDataSize;
+	const uint8_t* compressedData = jpeg.compressedData(compressedDataSize);
+	ASSERT_TRUE(compressedData != nullptr);
+	EXPECT_GT(compressedDataSize, 0);
+
+	// And it should decode back to the same dimensions
+	Jpeg roundTrip(const_cast<uint8_t*>(compressedData), compressedDataSize, true);
+	EXPECT_TRUE(roundTrip.decompress());
+	EXPECT_EQ(512, roundTrip.width());
+	EXPECT_EQ(512, roundTrip.height());
+}
+
+TEST_F(JpegTest, ShouldFailToCreateFromPlanesWithInvalidArguments)
+{
+	loadTestAsset();
+
+	Jpeg source(jpegBytes, byteSize, false);
+	ASSERT_TRUE(source.decompressPlanar());
+
+	JpegPlane planes[3] = { *source.plane(0), *source.plane(1), *source.plane(2) };
+
+	Jpeg jpeg;
+	EXPECT_FALSE(jpeg.fromPlanes(nullptr, 3, 512, 512));
+	EXPECT_FALSE(jpeg.fromPlanes(planes, 2, 512, 512));
+	EXPECT_FALSE(jpeg.fromPlanes(planes, 3, 0, 512));
+	EXPECT_FALSE(jpeg.fromPlanes(planes, 3, 512, 0));
+}
+
 TEST_F(JpegTest, ShouldReturnNumberOfComponents)
 {
 	loadTestAsset();
@@ -17,6 +17,7 @@ class MockJpeg : public IJpeg
 {
 public:
 	MOCK_METHOD0(decompress, bool());
+	MOCK_METHOD0(decompressPlanar, bool());
 	MOCK_METHOD1(compress, bool(uint32_t));
 
 	MOCK_CONST_METHOD0(components, uint32_t());
@@ -24,7 +25,11 @@ public:
 	MOCK_CONST_METHOD0(height, uint32_t());
 	MOCK_CONST_METHOD0(rawBytes, const uint8_t*());
 
+	MOCK_CONST_METHOD0(numberOfPlanes, uint32_t());
+	MOCK_CONST_METHOD1(plane, const JpegPlane*(uint32_t));
+
 	MOCK_METHOD4(fromRawBytes, bool(uint8_t*,uint32_t,uint32_t,uint32_t));
+	MOCK_METHOD4(fromPlanes, bool(const JpegPlane*,uint32_t,uint32_t,uint32_t));
 	MOCK_CONST_METHOD1(compressedData, const uint8_t*(uint32_t&));
 
 	MOCK_METHOD1(writeToFile, bool(const char*));
@@ -42,6 +47,18 @@ public:
 		jpegBytes = (uint8_t*)malloc(jpegRawSize);
 		memset(jpegBytes, 0, jpegRawSize);
 
+		// 4:2:0 planes for the same image
+		lumaPlane.width  = sourceW;
+		lumaPlane.height = sourceH;
+		lumaPlane.horizontalSampling = 2;
+		lumaPlane.verticalSampling   = 2;
+		chromaPlane.width  = sourceW / 2;
+		chromaPlane.height = sourceH / 2;
+		chromaPlane.horizontalSampling = 1;
+		chromaPlane.verticalSampling   = 1;
+		lumaPlane.rowStride = chromaPlane.rowStride = sourceW;
+		lumaPlane.bytes = chromaPlane.bytes = jpegBytes;
+
 		// Source jpeg
 		ON_CALL(sourceJpeg, decompress())
 			.WillByDefault(testing::Return(true));
@@ -68,6 +85,8 @@ public:
 
 protected:
 	uint8_t* jpegBytes;
+	JpegPlane lumaPlane;
+	JpegPlane chromaPlane;
 
 	MockJpeg sourceJpeg;
 	MockJpeg targetJpeg;
@@ -88,3 +107,146 @@ TEST_F(JpegCruncherTest, ShouldReencodeToGivenDimensionAndQualityLevel)
 
 	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
 }
+
+TEST_F(JpegCruncherTest, ShouldReencodePlanesInYCbCrMode)
+{
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setCrunchMode(JpegCruncher::CrunchModeYCbCr);
+
+	EXPECT_CALL(sourceJpeg, decompressPlanar())
+		.WillOnce(testing::Return(true));
+	EXPECT_CALL(sourceJpeg, decompress()).Times(0);
+	EXPECT_CALL(sourceJpeg, numberOfPlanes())
+		.WillRepeatedly(testing::Return(3));
+	EXPECT_CALL(sourceJpeg, plane(0))
+		.WillRepeatedly(testing::Return(&lumaPlane));
+	EXPECT_CALL(sourceJpeg, plane(testing::Gt(0)))
+		.WillRepeatedly(testing::Return(&chromaPlane));
+
+	EXPECT_CALL(targetJpeg, fromPlanes(testing::_, 3, 200, 100))
+		.WillOnce(testing::Invoke([](const JpegPlane* planes, uint32_t, uint32_t, uint32_t)
+		{
+			EXPECT_EQ(200, planes[0].width);
+			EXPECT_EQ(100, planes[0].height);
+			EXPECT_EQ(100, planes[1].width);
+			EXPECT_EQ(50,  planes[1].height);
+			return true;
+		}));
+	EXPECT_CALL(targetJpeg, fromRawBytes(testing::_, testing::_, testing::_, testing::_)).Times(0);
+	EXPECT_CALL(targetJpeg, compress(40));
+
+	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
+}
+
+TEST_F(JpegCruncherTest, ShouldFallBackToRGBWhenPlanesAreUnavailable)
+{
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setCrunchMode(JpegCruncher::CrunchModeYCbCr);
+
+	EXPECT_CALL(sourceJpeg, decompressPlanar())
+		.WillOnce(testing::Return(false));
+	EXPECT_CALL(sourceJpeg, decompress()).Times(1);
+
+	EXPECT_CALL(targetJpeg, fromRawBytes(testing::_, 200, 100, 3));
+	EXPECT_CALL(targetJpeg, compress(40));
+
+	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
+}
+
+TEST_F(JpegCruncherTest, ShouldSwapDimensionsWhenRotating)
+{
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setOrientation(Orientation_Rotate90);
+
+	EXPECT_CALL(targetJpeg, fromRawBytes(testing::_, 100, 200, 3));
+	EXPECT_CALL(targetJpeg, compress(40));
+
+	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
+}
+
+TEST_F(JpegCruncherTest, ShouldNotSwapDimensionsWhenFlipping)
+{
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setOrientation(Orientation_FlipVertical);
+
+	EXPECT_CALL(targetJpeg, fromRawBytes(testing::_, 200, 100, 3));
+	EXPECT_CALL(targetJpeg, compress(40));
+
+	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
+}
+
+TEST_F(JpegCruncherTest, ShouldRotatePixelsWhenNoResizeIsNeeded)
+{
+	// Tag each source pixel with its coordinates
+	for (uint32_t y = 0; y < 200; ++y)
+	{
+		for (uint32_t x = 0; x < 400; ++x)
+		{
+			uint8_t* pixel = jpegBytes + (y * 400 + x) * 3;
+			pixel[0] = x & 0xFF;
+			pixel[1] = y;
+			pixel[2] = x >> 8;
+		}
+	}
+
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setOrientation(Orientation_Rotate90);
+
+	EXPECT_CALL(targetJpeg, fromRawBytes(testing::_, 200, 400, 3))
+		.WillOnce(testing::Invoke([](uint8_t* bytes, uint32_t width, uint32_t, uint32_t components)
+		{
+			// Rotating clockwise moves source (x, y) to (sourceHeight-1-y, x)
+			const uint8_t* topRight = bytes + (199 * components);
+			EXPECT_EQ(0, topRight[0]);
+			EXPECT_EQ(0, topRight[1]);
+
+			const uint8_t* pixel = bytes + (10 * width + 194) * components;
+			EXPECT_EQ(10, pixel[0]);
+			EXPECT_EQ(5, pixel[1]);
+
+			const uint8_t* bottomLeft = bytes + (399 * width) * components;
+			EXPECT_EQ(399 & 0xFF, bottomLeft[0]);
+			EXPECT_EQ(199, bottomLeft[1]);
+			EXPECT_EQ(399 >> 8, bottomLeft[2]);
+			return true;
+		}));
+	EXPECT_CALL(targetJpeg, compress(40));
+
+	EXPECT_TRUE(cruncher.reencodeJpeg(400, 40));
+}
+
+TEST_F(JpegCruncherTest, ShouldSwapPlaneSamplingWhenRotatingPlanes)
+{
+	JpegCruncher cruncher(&sourceJpeg, &targetJpeg);
+	cruncher.setCrunchMode(JpegCruncher::CrunchModeYCbCr);
+	cruncher.setOrientation(Orientation_Rotate270);
+
+	// 4:2:2 chroma
+	chromaPlane.verticalSampling = 1;
+	lumaPlane.verticalSampling = 1;
+	chromaPlane.height = 200;
+
+	EXPECT_CALL(sourceJpeg, decompressPlanar())
+		.WillOnce(testing::Return(true));
+	EXPECT_CALL(sourceJpeg, numberOfPlanes())
+		.WillRepeatedly(testing::Return(3));
+	EXPECT_CALL(sourceJpeg, plane(0))
+		.WillRepeatedly(testing::Return(&lumaPlane));
+	EXPECT_CALL(sourceJpeg, plane(testing::Gt(0)))
+		.WillRepeatedly(testing::Return(&chromaPlane));
+
+	EXPECT_CALL(targetJpeg, fromPlanes(testing::_, 3, 100, 200))
+		.WillOnce(testing::Invoke([](const JpegPlane* planes, uint32_t, uint32_t, uint32_t)
+		{
+			EXPECT_EQ(100, planes[0].width);
+			EXPECT_EQ(200, planes[0].height);
+			EXPECT_EQ(100, planes[1].width);
+			EXPECT_EQ(100, planes[1].height);
+			EXPECT_EQ(1, planes[1].horizontalSampling);
+			EXPECT_EQ(2, planes[0].verticalSampling);
+			return true;
+		}));
+	EXPECT_CALL(targetJpeg, compress(40));
+
+	EXPECT_TRUE(cruncher.reencodeJpeg(200, 40));
+}
@@ -0,0 +1,122 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "memorybudget.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace enlighten::lib;
+
+TEST(MemoryBudgetTest, ShouldReserveUpToTheCapacity)
+{
+	MemoryBudget budget(100);
+
+	EXPECT_TRUE(budget.tryReserve(60));
+	EXPECT_TRUE(budget.tryReserve(40));
+	EXPECT_FALSE(budget.tryReserve(1));
+	EXPECT_EQ(100, budget.reserved());
+
+	budget.release(50);
+	EXPECT_TRUE(budget.tryReserve(50));
+	EXPECT_EQ(100, budget.peakReserved());
+}
+
+TEST(MemoryBudgetTest, ShouldLetAnOversizedReservationThroughWhenNothingElseIsHeld)
+{
+	MemoryBudget budget(100);
+
+	EXPECT_TRUE(budget.tryReserve(500));
+	EXPECT_FALSE(budget.tryReserve(1));
+
+	budget.release(500);
+	EXPECT_EQ(0, budget.reserved());
+}
+
+TEST(MemoryBudgetTest, ShouldWaitForMemoryToBeReleased)
+{
+	MemoryBudget budget(100);
+	std::atomic<bool> cancel(false);
+
+	ASSERT_TRUE(budget.tryReserve(80));
+
+	std::atomic<bool> reserved(false);
+	std::thread waiter([&]()
+	{
+		reserved = budget.reserve(50, cancel);
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_FALSE(reserved);
+
+	// Those waiting go first
+	budget.release(40);
+	waiter.join();
+	EXPECT_TRUE(reserved);
+	EXPECT_EQ(90, budget.reserved());
+}
+
+TEST(MemoryBudgetTest, ShouldNotLetTryReserveJumpTheQueue)
+{
+	MemoryBudget budget(100);
+	std::atomic<bool> cancel(false);
+
+	ASSERT_TRUE(budget.tryReserve(90));
+
+	std::thread waiter([&]()
+	{
+		budget.reserve(50, cancel);
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_FALSE(budget.tryReserve(5));
+
+	cancel = true;
+	waiter.join();
+	EXPECT_TRUE(budget.tryReserve(5));
+}
+
+TEST(MemoryBudgetTest, ShouldGiveUpWaitingWhenCancelled)
+{
+	MemoryBudget budget(100);
+	std::atomic<bool> cancel(true);
+
+	ASSERT_TRUE(budget.tryReserve(100));
+	EXPECT_FALSE(budget.reserve(1, cancel));
+	EXPECT_EQ(100, budget.reserved());
+}
+
+TEST(MemoryBudgetTest, ShouldReleaseAReservationWhenItGoes)
+{
+	MemoryBudget budget(100);
+	std::atomic<bool> cancel(false);
+
+	{
+		MemoryReservation reservation(budget);
+		EXPECT_TRUE(reservation.grow(30, cancel));
+		EXPECT_TRUE(reservation.tryGrow(30));
+		EXPECT_EQ(60, reservation.bytes());
+
+		reservation.shrinkTo(20);
+		EXPECT_EQ(20, budget.reserved());
+
+		// Moving hands the bytes over rather than releasing them
+		MemoryReservation moved(std::move(reservation));
+		EXPECT_EQ(0, reservation.bytes());
+		EXPECT_EQ(20, moved.bytes());
+		EXPECT_EQ(20, budget.reserved());
+	}
+
+	EXPECT_EQ(0, budget.reserved());
+}
+
+TEST(MemoryBudgetTest, ShouldNotReserveWithoutABudget)
+{
+	std::atomic<bool> cancel(false);
+	MemoryReservation reservation;
+
+	EXPECT_FALSE(reservation.grow(10, cancel));
+	EXPECT_FALSE(reservation.tryGrow(10));
+	EXPECT_EQ(0, reservation.bytes());
+}
@@ -10,7 +10,7 @@ class PreviewEntryTest : public testing::Test
 public:
 	PreviewEntryTest()
 	{
-		fakeUuid   = "3829E5FC-7F3F-4B22-94F3-FB5E2C796026";
+		fakeUuid   = uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026");
 		fakeDigest = "07cc63f155500a902b21fef7be6585b5";
 
 		fakeLevels.push_back(PreviewEntryLevel(1, 67.0f));
@@ -20,7 +20,7 @@ public:
 	}
 
 protected:
-	std::string fakeUuid;
+	uuid_t fakeUuid;
 	std::string fakeDigest;
 	std::vector<PreviewEntryLevel> fakeLevels;
 };
@@ -57,3 +57,17 @@ TEST_F(PreviewEntryTest, ShouldReturnAnInvalidLevelIndexIfNoSuitableDimensionExi
 
 	EXPECT_EQ(PreviewEntry::INVALID_LEVEL_INDEX, level);
 }
+
+TEST_F(PreviewEntryTest, ShouldDefaultToNormalOrientation)
+{
+	PreviewEntry entry(fakeUuid, fakeDigest, fakeLevels);
+
+	EXPECT_EQ(Orientation_Normal, entry.orientation());
+}
+
+TEST_F(PreviewEntryTest, ShouldReturnOrientation)
+{
+	PreviewEntry entry(fakeUuid, fakeDigest, fakeLevels, Orientation_Rotate90);
+
+	EXPECT_EQ(Orientation_Rotate90, entry.orientation());
+}
@@ -0,0 +1,109 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "previewentrystore.h"
+
+#include <cstdio>
+
+using namespace enlighten::lib;
+
+class PreviewEntryStoreTest : public testing::Test
+{
+public:
+	PreviewEntryStoreTest()
+	{
+		fakeUuid   = uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026");
+		fakeDigest = "07cc63f155500a902b21fef7be6585b5";
+
+		fakeLevels.push_back(PreviewEntryLevel(1, 67.0f));
+		fakeLevels.push_back(PreviewEntryLevel(2, 134.0f));
+		fakeLevels.push_back(PreviewEntryLevel(3, 543.0f));
+	}
+
+	static uuid_t uuidForIndex(uint32_t index)
+	{
+		char buffer[37];
+		snprintf(buffer, sizeof(buffer), "%08X-0000-4000-8000-%012X", index, index * 7);
+		return uuid_t(buffer);
+	}
+
+protected:
+	uuid_t fakeUuid;
+	std::string fakeDigest;
+	std::vector<PreviewEntryLevel> fakeLevels;
+};
+
+TEST_F(PreviewEntryStoreTest, ShouldReturnAnInsertedEntry)
+{
+	PreviewEntryStore store;
+	EXPECT_TRUE(store.insert(fakeUuid, fakeDigest, Orientation_Rotate90, fakeLevels));
+
+	PreviewEntry entry;
+	ASSERT_TRUE(store.entryForUuid(fakeUuid, entry));
+	EXPECT_EQ(fakeUuid, entry.uuid());
+	EXPECT_EQ(fakeDigest, entry.digest());
+	EXPECT_EQ(Orientation_Rotate90, entry.orientation());
+	EXPECT_EQ(3, entry.numberOfLevels());
+	EXPECT_EQ(2, entry.closestLevelToDimension(100.0f));
+	EXPECT_EQ("3/3829/3829E5FC-7F3F-4B22-94F3-FB5E2C796026-07cc63f155500a902b21fef7be6585b5.lrprev",
+		entry.filePathRelativeToRoot());
+}
+
+TEST_F(PreviewEntryStoreTest, ShouldRejectMalformedKeys)
+{
+	PreviewEntryStore store;
+	EXPECT_FALSE(store.insert(uuid_t(), fakeDigest, Orientation_Normal, fakeLevels));
+	EXPECT_FALSE(store.insert(fakeUuid, "07cc63f1", Orientation_Normal, fakeLevels));
+	EXPECT_FALSE(store.insert(fakeUuid, "07cc63f155500a902b21fef7be6585bz", Orientation_Normal, fakeLevels));
+	EXPECT_EQ(0, store.numberOfEntries());
+	EXPECT_FALSE(store.contains(fakeUuid));
+}
+
+TEST_F(PreviewEntryStoreTest, ShouldReplaceAnExistingEntry)
+{
+	PreviewEntryStore store;
+	EXPECT_TRUE(store.insert(fakeUuid, fakeDigest, Orientation_Normal, fakeLevels));
+
+	std::vector<PreviewEntryLevel> fewerLevels(fakeLevels.begin(), fakeLevels.begin() + 1);
+	EXPECT_TRUE(store.insert(fakeUuid, "ffcc63f155500a902b21fef7be6585b5", Orientation_Rotate180, fewerLevels));
+
+	PreviewEntry entry;
+	ASSERT_TRUE(store.entryForUuid(fakeUuid, entry));
+	EXPECT_EQ("ffcc63f155500a902b21fef7be6585b5", entry.digest());
+	EXPECT_EQ(Orientation_Rotate180, entry.orientation());
+	EXPECT_EQ(1, entry.numberOfLevels());
+
+	std::vector<PreviewEntryLevel> moreLevels(fakeLevels);
+	moreLevels.push_back(PreviewEntryLevel(4, 1068.0f));
+	EXPECT_TRUE(store.insert(fakeUuid, fakeDigest, Orientation_Normal, moreLevels));
+
+	ASSERT_TRUE(store.entryForUuid(fakeUuid, entry));
+	EXPECT_EQ(4, entry.numberOfLevels());
+	EXPECT_EQ(1, store.numberOfEntries());
+}
+
+TEST_F(PreviewEntryStoreTest, ShouldFindEveryEntryAfterGrowing)
+{
+	PreviewEntryStore store;
+
+	const uint32_t kNumberOfEntries = 5000;
+	for (uint32_t entryIdx = 0; entryIdx < kNumberOfEntries; ++entryIdx)
+	{
+		std::vector<PreviewEntryLevel> levels(1, PreviewEntryLevel(entryIdx % 7, 100.0f));
+		ASSERT_TRUE(store.insert(uuidForIndex(entryIdx), fakeDigest, Orientation_Normal, levels));
+	}
+
+	EXPECT_EQ(kNumberOfEntries, store.numberOfEntries());
+
+	PreviewEntry entry;
+	for (uint32_t entryIdx = 0; entryIdx < kNumberOfEntries; ++entryIdx)
+	{
+		ASSERT_TRUE(store.entryForUuid(uuidForIndex(entryIdx), entry));
+		EXPECT_EQ(uuidForIndex(entryIdx), entry.uuid());
+		EXPECT_EQ(entryIdx % 7, entry.closestLevelToDimension(50.0f));
+	}
+
+	store.clear();
+	EXPECT_EQ(0, store.numberOfEntries());
+	EXPECT_FALSE(store.contains(uuidForIndex(0)));
+}
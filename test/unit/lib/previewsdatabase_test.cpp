@@ -4,6 +4,9 @@
 #include "previewsdatabase.h"
 #include "previewentry.h"
 #include "cachedpreviews.h"
+#include "file.h"
+
+#include "sqlite3.h"
 
 using namespace enlighten::lib;
 
@@ -18,14 +21,55 @@ namespace
 		MOCK_CONST_METHOD0(numberOfCachedPreviews, uint32_t());
 
 		MOCK_CONST_METHOD1(generateProxy, bool(std::set<enlighten::lib::uuid_t>&));
+		MOCK_CONST_METHOD0(createOrderedCursor, ICachedUuidCursor*());
 		MOCK_CONST_METHOD1(isInCache, bool(const enlighten::lib::uuid_t&));
-		MOCK_METHOD1(markAsCached, bool(const enlighten::lib::uuid_t&));
+		MOCK_CONST_METHOD2(digestForUuid, bool(const enlighten::lib::uuid_t&, std::string&));
+		MOCK_METHOD2(markAsCached, bool(const enlighten::lib::uuid_t&, const std::string&));
+		MOCK_METHOD1(removeFromCache, bool(const enlighten::lib::uuid_t&));
+		MOCK_METHOD1(applyUpdates, bool(const std::vector<CachedPreviewUpdate>&));
+	};
+
+	class FakeCachedUuidCursor : public ICachedUuidCursor
+	{
+	public:
+		FakeCachedUuidCursor(bool (*buildCache)(std::set<enlighten::lib::uuid_t>&))
+		{
+			// Caches built from uuids alone have no digests recorded
+			std::set<enlighten::lib::uuid_t> uuids;
+			buildCache(uuids);
+
+			for (auto& uuid : uuids)
+				_digests.insert(std::make_pair(uuid, std::string()));
+
+			_iterator = _digests.begin();
+		}
+
+		FakeCachedUuidCursor(bool (*buildCache)(std::map<enlighten::lib::uuid_t, std::string>&))
+		{
+			buildCache(_digests);
+			_iterator = _digests.begin();
+		}
+
+		bool next(enlighten::lib::uuid_t& uuid, std::string& digest)
+		{
+			if (_iterator == _digests.end())
+				return false;
+
+			uuid   = _iterator->first;
+			digest = _iterator->second;
+			++_iterator;
+			return true;
+		}
+
+	private:
+		std::map<enlighten::lib::uuid_t, std::string> _digests;
+		std::map<enlighten::lib::uuid_t, std::string>::const_iterator _iterator;
 	};
 
 	bool buildMockCache_AddAction(std::set<enlighten::lib::uuid_t>& uuids)
 	{
 		// Mock only 1 uuid in the cache
-		uuids.insert("3829E5FC-7F3F-4B22-94F3-FB5E2C796026");
+		uuids.insert(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"));
 
 		return true;
 	}
@@ -33,18 +77,59 @@ namespace
 	bool buildMockCache_RemoveAction(std::set<enlighten::lib::uuid_t>& uuids)
 	{
 		// These uuids exist in the test data and will be ignored
-		uuids.insert("3829E5FC-7F3F-4B22-94F3-FB5E2C796026");
-		uuids.insert("6A2B9912-3868-45E4-AE0D-7EA73F66FF63");
-		uuids.insert("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C");
+		uuids.insert(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"));
+		uuids.insert(enlighten::lib::uuid_t("6A2B9912-3868-45E4-AE0D-7EA73F66FF63"));
+		uuids.insert(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"));
 
 		// Mock entries in the cache which don't exist in the test data - this
 		// will trigger 'removals'
-		uuids.insert("3829E5FC");
-		uuids.insert("ABCDEF12");
-		uuids.insert("3456789A");
+		uuids.insert(enlighten::lib::uuid_t("3829E5FC-0000-4000-8000-000000000001"));
+		uuids.insert(enlighten::lib::uuid_t("ABCDEF12-0000-4000-8000-000000000002"));
+		uuids.insert(enlighten::lib::uuid_t("3456789A-0000-4000-8000-000000000003"));
+
+		return true;
+	}
+
+	bool buildMockCache_NoAction(std::set<enlighten::lib::uuid_t>& uuids)
+	{
+		// Everything in the test data is already cached
+		uuids.insert(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"));
+		uuids.insert(enlighten::lib::uuid_t("6A2B9912-3868-45E4-AE0D-7EA73F66FF63"));
+		uuids.insert(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"));
+
+		return true;
+	}
+
+	bool buildMockCache_UpdateAction(std::map<enlighten::lib::uuid_t, std::string>& digests)
+	{
+		// One preview was uploaded with an older digest, and one before digests were recorded
+		digests[enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026")] = "ffcc63f155500a902b21fef7be6585b5";
+		digests[enlighten::lib::uuid_t("6A2B9912-3868-45E4-AE0D-7EA73F66FF63")] = "07cc63f155500a902b21fef7be6585b5";
+		digests[enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C")] = "";
 
 		return true;
 	}
+
+	// Writes through a separate connection, as Lightroom would
+	bool executeOnDatabase(const std::string& database, const char* query)
+	{
+		sqlite3* db = nullptr;
+		bool executed = sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READWRITE, NULL) == SQLITE_OK &&
+			sqlite3_exec(db, query, NULL, NULL, NULL) == SQLITE_OK;
+
+		sqlite3_close(db);
+		return executed;
+	}
+
+	std::string duplicateValidPreviewFile()
+	{
+		std::string duplicatedDatabaseName = "temp/previewsdatabase_duplicate.db";
+
+		File file(PreviewsDatabase_ValidPreviewFile);
+		file.duplicate(duplicatedDatabaseName.c_str());
+
+		return duplicatedDatabaseName;
+	}
 }
 
 TEST(PreviewsDatabase, ShouldFailToInitialiseWithAnInvalidFile)
@@ -92,7 +177,30 @@ TEST(PreviewsDatabase, ShouldReturnAUuidForAValidDatabaseIndex)
 	EXPECT_TRUE(previews.uuidForIndex(2, uuid));
 
 	// TODO: Should we hardcode expectations for test data?
-	EXPECT_EQ(uuid, "B089021B-7ACE-4A62-BD32-85A6C6AD5B9C");
+	EXPECT_EQ("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C", uuid.toString());
+}
+
+TEST(PreviewsDatabase, ShouldReturnAUuidForEveryDatabaseIndex)
+{
+	PreviewsDatabase previews;
+	previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile);
+
+	std::set<enlighten::lib::uuid_t> uuids;
+	for (uint32_t index = 0; index < previews.numberOfPreviewEntries(); ++index)
+	{
+		enlighten::lib::uuid_t uuid;
+		EXPECT_TRUE(previews.uuidForIndex(index, uuid));
+		uuids.insert(uuid);
+	}
+
+	EXPECT_EQ(3, uuids.size());
+
+	// And again after the uuids have been invalidated
+	EXPECT_TRUE(previews.reopen());
+
+	enlighten::lib::uuid_t uuid;
+	EXPECT_TRUE(previews.uuidForIndex(2, uuid));
+	EXPECT_EQ("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C", uuid.toString());
 }
 
 TEST(PreviewsDatabase, ShouldFailWithAnInvalidDatabaseIndex)
@@ -102,7 +210,7 @@ TEST(PreviewsDatabase, ShouldFailWithAnInvalidDatabaseIndex)
 
 	enlighten::lib::uuid_t uuid;
 	EXPECT_FALSE(previews.uuidForIndex(99, uuid));
-	EXPECT_TRUE(uuid.empty());
+	EXPECT_TRUE(uuid.isNil());
 }
 
 TEST(PreviewsDatabase, ShouldReturnAPreviewEntryForAValidUuid)
@@ -110,12 +218,79 @@ TEST(PreviewsDatabase, ShouldReturnAPreviewEntryForAValidUuid)
 	PreviewsDatabase previews;
 	previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile);
 
-	enlighten::lib::uuid_t uuid = "B089021B-7ACE-4A62-BD32-85A6C6AD5B9C";
+	enlighten::lib::uuid_t uuid("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C");
+
+	PreviewEntry entry;
+	ASSERT_TRUE(previews.entryForUuid(uuid, entry));
+
+	EXPECT_EQ(entry.digest(), "07cc63f155500a902b21fef7be6585b5");
+	EXPECT_EQ(entry.orientation(), Orientation_Normal);
+
+	// The second lookup is served from the store
+	PreviewEntry cachedEntry;
+	ASSERT_TRUE(previews.entryForUuid(uuid, cachedEntry));
+	EXPECT_EQ(entry.uuid(), cachedEntry.uuid());
+	EXPECT_EQ(entry.digest(), cachedEntry.digest());
+	EXPECT_EQ(entry.numberOfLevels(), cachedEntry.numberOfLevels());
+}
+
+TEST(PreviewsDatabase, ShouldReturnPreviewEntriesForManyUuids)
+{
+	PreviewsDatabase previews;
+	previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile);
+
+	const char* uuids[] =
+	{
+		"3829E5FC-7F3F-4B22-94F3-FB5E2C796026",
+		"6A2B9912-3868-45E4-AE0D-7EA73F66FF63",
+		"B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"
+	};
+
+	for (auto uuid : uuids)
+	{
+		PreviewEntry entry;
+		ASSERT_TRUE(previews.entryForUuid(enlighten::lib::uuid_t(uuid), entry));
+		EXPECT_EQ(uuid, entry.uuid().toString());
+		EXPECT_GT(entry.numberOfLevels(), 0);
+	}
+
+	// Statements must survive a reopen of the connection
+	EXPECT_TRUE(previews.reopen());
+
+	enlighten::lib::uuid_t uuid;
+	EXPECT_TRUE(previews.uuidForIndex(0, uuid));
+	EXPECT_TRUE(previews.uuidForIndex(1, uuid));
+}
+
+TEST(PreviewsDatabase, ShouldLoadAllEntries)
+{
+	PreviewsDatabase previews;
+	previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile);
+
+	EXPECT_TRUE(previews.loadAllEntries());
+
+	PreviewEntry entry;
+	ASSERT_TRUE(previews.entryForUuid(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"), entry));
+	EXPECT_EQ("07cc63f155500a902b21fef7be6585b5", entry.digest());
+	EXPECT_EQ(7, entry.numberOfLevels());
+	EXPECT_EQ(3, entry.closestLevelToDimension(220.0f));
 
-	const PreviewEntry* entry = previews.entryForUuid(uuid);
-	ASSERT_TRUE(entry != nullptr);
+	ASSERT_TRUE(previews.entryForUuid(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"), entry));
+	EXPECT_EQ(6, entry.numberOfLevels());
 
-	EXPECT_EQ(entry->digest(), "07cc63f155500a902b21fef7be6585b5");
+	// Loading again refreshes the existing entries
+	EXPECT_TRUE(previews.loadAllEntries());
+	ASSERT_TRUE(previews.entryForUuid(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"), entry));
+	EXPECT_EQ(6, entry.numberOfLevels());
+}
+
+TEST(PreviewsDatabase, ShouldNotReturnAPreviewEntryForAUuidContainingQuotes)
+{
+	PreviewsDatabase previews;
+	previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile);
+
+	PreviewEntry entry;
+	EXPECT_FALSE(previews.entryForUuid(enlighten::lib::uuid_t("B089021B' OR '1'='1"), entry));
 }
 
 TEST(PreviewsDatabase, ShouldReturnNewEntriesWithAddAction)
@@ -125,9 +300,9 @@ TEST(PreviewsDatabase, ShouldReturnNewEntriesWithAddAction)
 
 	MockCachedPreviews mockCache;
 
-	EXPECT_CALL(mockCache, generateProxy(testing::_))
+	EXPECT_CALL(mockCache, createOrderedCursor())
 		.Times(1)
-		.WillOnce(testing::Invoke(buildMockCache_AddAction));
+		.WillOnce(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_AddAction));
 
 	std::map<enlighten::lib::uuid_t, SyncAction> entries;
 	EXPECT_TRUE(previews.checkEntriesAgainstCachedPreviews(mockCache, entries));
@@ -146,9 +321,9 @@ TEST(PreviewsDatabase, ShouldReturnNonExistentOldEntriesWithRemoveAction)
 
 	MockCachedPreviews mockCache;
 
-	EXPECT_CALL(mockCache, generateProxy(testing::_))
+	EXPECT_CALL(mockCache, createOrderedCursor())
 		.Times(1)
-		.WillOnce(testing::Invoke(buildMockCache_RemoveAction));
+		.WillOnce(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_RemoveAction));
 
 	std::map<enlighten::lib::uuid_t, SyncAction> entries;
 	EXPECT_TRUE(previews.checkEntriesAgainstCachedPreviews(mockCache, entries));
@@ -159,3 +334,247 @@ TEST(PreviewsDatabase, ShouldReturnNonExistentOldEntriesWithRemoveAction)
 		EXPECT_EQ(SyncAction_Remove, entry.second);
 	}
 }
+
+TEST(PreviewsDatabase, ShouldEmitActionsInUuidOrder)
+{
+	PreviewsDatabase previews;
+	previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile);
+
+	MockCachedPreviews mockCache;
+
+	EXPECT_CALL(mockCache, createOrderedCursor())
+		.Times(1)
+		.WillOnce(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_RemoveAction));
+
+	std::vector<std::pair<enlighten::lib::uuid_t, SyncAction>> actions;
+	EXPECT_TRUE(previews.diffAgainstCachedPreviews(mockCache,
+		[&actions](const enlighten::lib::uuid_t& uuid, SyncAction action, const std::string&)
+	{
+		actions.push_back(std::make_pair(uuid, action));
+	}));
+
+	ASSERT_EQ(3, actions.size());
+	EXPECT_EQ("3456789A-0000-4000-8000-000000000003", actions[0].first.toString());
+	EXPECT_EQ("3829E5FC-0000-4000-8000-000000000001", actions[1].first.toString());
+	EXPECT_EQ("ABCDEF12-0000-4000-8000-000000000002", actions[2].first.toString());
+
+	for (auto& action : actions)
+		EXPECT_EQ(SyncAction_Remove, action.second);
+}
+
+TEST(PreviewsDatabase, ShouldReturnChangedDigestsWithUpdateAction)
+{
+	PreviewsDatabase previews;
+	previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile);
+
+	MockCachedPreviews mockCache;
+
+	EXPECT_CALL(mockCache, createOrderedCursor())
+		.Times(1)
+		.WillOnce(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_UpdateAction));
+
+	std::map<enlighten::lib::uuid_t, SyncAction> entries;
+	EXPECT_TRUE(previews.checkEntriesAgainstCachedPreviews(mockCache, entries));
+
+	ASSERT_EQ(1, entries.size());
+	EXPECT_EQ("3829E5FC-7F3F-4B22-94F3-FB5E2C796026", entries.begin()->first.toString());
+	EXPECT_EQ(SyncAction_Update, entries.begin()->second);
+}
+
+TEST(PreviewsDatabase, ShouldReturnAnUpdateWhenADigestChangesSinceTheLastCheck)
+{
+	std::string databaseName = duplicateValidPreviewFile();
+
+	PreviewsDatabase previews;
+	ASSERT_TRUE(previews.initialiseWithFile(databaseName));
+
+	MockCachedPreviews mockCache;
+
+	EXPECT_CALL(mockCache, createOrderedCursor())
+		.Times(1)
+		.WillOnce(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_NoAction));
+	EXPECT_CALL(mockCache, digestForUuid(testing::_, testing::_))
+		.WillRepeatedly(testing::DoAll(
+			testing::SetArgReferee<1>(std::string("07cc63f155500a902b21fef7be6585b5")),
+			testing::Return(true)));
+
+	std::map<enlighten::lib::uuid_t, SyncAction> entries;
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	EXPECT_EQ(0, entries.size());
+
+	// Lightroom rebuilds the pyramid of an edited photo under a new digest
+	EXPECT_TRUE(executeOnDatabase(databaseName, "UPDATE Pyramid SET "
+		"digest='ffcc63f155500a902b21fef7be6585b5',pyramidFileTimeStamp=pyramidFileTimeStamp+1000 "
+		"WHERE uuid='B089021B-7ACE-4A62-BD32-85A6C6AD5B9C'"));
+
+	EXPECT_TRUE(previews.hasChanged());
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	ASSERT_EQ(1, entries.size());
+	EXPECT_EQ("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C", entries.begin()->first.toString());
+	EXPECT_EQ(SyncAction_Update, entries.begin()->second);
+
+	File file(databaseName);
+	EXPECT_TRUE(file.remove());
+}
+
+TEST(PreviewsDatabase, ShouldNotServeStaleEntriesOnceTheDatabaseChanges)
+{
+	std::string databaseName = duplicateValidPreviewFile();
+
+	PreviewsDatabase previews;
+	ASSERT_TRUE(previews.initialiseWithFile(databaseName));
+
+	MockCachedPreviews mockCache;
+
+	EXPECT_CALL(mockCache, createOrderedCursor())
+		.Times(1)
+		.WillOnce(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_NoAction));
+	EXPECT_CALL(mockCache, digestForUuid(testing::_, testing::_))
+		.WillRepeatedly(testing::Return(false));
+
+	std::map<enlighten::lib::uuid_t, SyncAction> entries;
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	EXPECT_FALSE(previews.hasChanged());
+
+	enlighten::lib::uuid_t uuid("3829E5FC-7F3F-4B22-94F3-FB5E2C796026");
+
+	PreviewEntry entry;
+	ASSERT_TRUE(previews.entryForUuid(uuid, entry));
+	EXPECT_EQ("07cc63f155500a902b21fef7be6585b5", entry.digest());
+
+	EXPECT_TRUE(executeOnDatabase(databaseName, "UPDATE ImageCacheEntry SET "
+		"digest='ffcc63f155500a902b21fef7be6585b5' WHERE uuid='3829E5FC-7F3F-4B22-94F3-FB5E2C796026'"));
+
+	EXPECT_TRUE(previews.hasChanged());
+
+	PreviewEntry changedEntry;
+	ASSERT_TRUE(previews.entryForUuid(uuid, changedEntry));
+	EXPECT_EQ("ffcc63f155500a902b21fef7be6585b5", changedEntry.digest());
+
+	File file(databaseName);
+	EXPECT_TRUE(file.remove());
+}
+
+TEST(PreviewsDatabase, ShouldOnlyReportChangesCommittedSinceTheLastCheck)
+{
+	std::string databaseName = duplicateValidPreviewFile();
+
+	PreviewsDatabase previews;
+	ASSERT_TRUE(previews.initialiseWithFile(databaseName));
+
+	MockCachedPreviews mockCache;
+
+	EXPECT_CALL(mockCache, createOrderedCursor())
+		.Times(1)
+		.WillOnce(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_NoAction));
+	EXPECT_CALL(mockCache, digestForUuid(testing::_, testing::_))
+		.WillRepeatedly(testing::Return(false));
+
+	std::map<enlighten::lib::uuid_t, SyncAction> entries;
+	EXPECT_TRUE(previews.hasChanged());
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	EXPECT_EQ(0, entries.size());
+	EXPECT_FALSE(previews.hasChanged());
+
+	// Add a new preview, only it should be visited
+	EXPECT_TRUE(executeOnDatabase(databaseName, "INSERT INTO Pyramid SELECT "
+		"'C0FFEE00-0000-4000-8000-000000000001',digest,colorProfile,fileTimeStamp,quality,"
+		"croppedWidth,croppedHeight,pyramidFileTimeStamp,fingerprint,fromProxy FROM Pyramid "
+		"WHERE uuid='3829E5FC-7F3F-4B22-94F3-FB5E2C796026'"));
+
+	EXPECT_TRUE(previews.hasChanged());
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	ASSERT_EQ(1, entries.size());
+	EXPECT_EQ("C0FFEE00-0000-4000-8000-000000000001", entries.begin()->first.toString());
+	EXPECT_EQ(SyncAction_Add, entries.begin()->second);
+	EXPECT_FALSE(previews.hasChanged());
+
+	File file(databaseName);
+	EXPECT_TRUE(file.remove());
+}
+
+TEST(PreviewsDatabase, ShouldFallBackToAFullDiffWhenRowsAreRemoved)
+{
+	std::string databaseName = duplicateValidPreviewFile();
+
+	PreviewsDatabase previews;
+	ASSERT_TRUE(previews.initialiseWithFile(databaseName));
+
+	MockCachedPreviews mockCache;
+
+	EXPECT_CALL(mockCache, createOrderedCursor())
+		.Times(2)
+		.WillRepeatedly(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_NoAction));
+
+	std::map<enlighten::lib::uuid_t, SyncAction> entries;
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	EXPECT_EQ(0, entries.size());
+
+	EXPECT_TRUE(executeOnDatabase(databaseName,
+		"DELETE FROM Pyramid WHERE uuid='6A2B9912-3868-45E4-AE0D-7EA73F66FF63'"));
+
+	EXPECT_TRUE(previews.hasChanged());
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	ASSERT_EQ(1, entries.size());
+	EXPECT_EQ("6A2B9912-3868-45E4-AE0D-7EA73F66FF63", entries.begin()->first.toString());
+	EXPECT_EQ(SyncAction_Remove, entries.begin()->second);
+
+	File file(databaseName);
+	EXPECT_TRUE(file.remove());
+}
+
+TEST(PreviewsDatabase, ShouldReadEntriesFromASnapshot)
+{
+	PreviewsDatabase previews;
+	ASSERT_TRUE(previews.initialiseWithFile(PreviewsDatabase_ValidPreviewFile));
+
+	EXPECT_FALSE(previews.isReadingSnapshot());
+	EXPECT_TRUE(previews.beginSnapshot());
+	EXPECT_TRUE(previews.isReadingSnapshot());
+
+	EXPECT_EQ(3, previews.numberOfPreviewEntries());
+
+	PreviewEntry entry;
+	EXPECT_TRUE(previews.entryForUuid(
+		enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"), entry));
+	EXPECT_EQ("07cc63f155500a902b21fef7be6585b5", entry.digest());
+
+	previews.endSnapshot();
+	EXPECT_FALSE(previews.isReadingSnapshot());
+}
+
+TEST(PreviewsDatabase, ShouldNotSeeWritesCommittedAfterTheSnapshot)
+{
+	std::string databaseName = duplicateValidPreviewFile();
+
+	PreviewsDatabase previews;
+	ASSERT_TRUE(previews.initialiseWithFile(databaseName));
+
+	MockCachedPreviews mockCache;
+
+	EXPECT_CALL(mockCache, createOrderedCursor())
+		.Times(2)
+		.WillRepeatedly(testing::ReturnNew<FakeCachedUuidCursor>(buildMockCache_NoAction));
+
+	ASSERT_TRUE(previews.beginSnapshot());
+
+	EXPECT_TRUE(executeOnDatabase(databaseName,
+		"DELETE FROM Pyramid WHERE uuid='6A2B9912-3868-45E4-AE0D-7EA73F66FF63'"));
+
+	std::map<enlighten::lib::uuid_t, SyncAction> entries;
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	EXPECT_EQ(0, entries.size());
+
+	previews.endSnapshot();
+
+	// The removal landed after the snapshot's data version, so the next pass sees it
+	EXPECT_TRUE(previews.hasChanged());
+	ASSERT_TRUE(previews.beginSnapshot());
+	EXPECT_TRUE(previews.checkChangedEntriesAgainstCachedPreviews(mockCache, entries));
+	ASSERT_EQ(1, entries.size());
+	EXPECT_EQ(SyncAction_Remove, entries.begin()->second);
+	previews.endSnapshot();
+
+	File file(databaseName);
+	EXPECT_TRUE(file.remove());
+}
@@ -6,6 +6,7 @@
 #include "settings.h"
 #include "file.h"
 #include "cachedpreviews.h"
+#include "memorybudget.h"
 #include "synchronizers/previewssynchronizer.h"
 #include <chrono>
 
@@ -142,6 +143,68 @@ TEST_F(PreviewsSynchronizerTest, ShouldStartStopSynchronizingFile)
 	EXPECT_TRUE(sync.stopSynchronizingFile());
 }
 
+TEST_F(PreviewsSynchronizerTest, ShouldCrunchWithSeveralWorkers)
+{
+	settings.set(IEnlightenSettings::CrunchWorkerCount, 3);
+	settings.set(IEnlightenSettings::UploadWorkerCount, 2);
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(3);
+	EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile, ""));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+}
+
+TEST_F(PreviewsSynchronizerTest, ShouldKeepToTheConfiguredWorkersWhenNotAdaptive)
+{
+	settings.set(IEnlightenSettings::CrunchWorkerCount, 3);
+	settings.set(IEnlightenSettings::UploadWorkerCount, 2);
+	settings.set(IEnlightenSettings::AdaptiveConcurrency, 0);
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(3);
+	EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile, ""));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+
+	EXPECT_EQ(3, sync.crunchConcurrency().limit);
+	EXPECT_EQ(2, sync.uploadConcurrency().limit);
+	EXPECT_EQ(0, sync.uploadConcurrency().inUse);
+}
+
+TEST_F(PreviewsSynchronizerTest, ShouldSynchronizeWithinATightMemoryBudget)
+{
+	// The budget is process wide, so put it back afterwards
+	uint64_t previousCapacity = MemoryBudget::get().capacity();
+
+	settings.set(IEnlightenSettings::MemoryBudgetMegabytes, 1);
+	{
+		PreviewsSynchronizer sync(&settings, &fakeAws);
+
+		EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+			.Times(3);
+		EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile, ""));
+
+		// Wait around awhile
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+
+		EXPECT_TRUE(sync.stopSynchronizingFile());
+	}
+
+	EXPECT_EQ(1024 * 1024, MemoryBudget::get().capacity());
+	EXPECT_EQ(0, MemoryBudget::get().reserved());
+
+	MemoryBudget::get().setCapacity(previousCapacity);
+}
+
 TEST_F(PreviewsSynchronizerTest, ShouldFailStopSynchronizingFileIfNotStarted)
 {
 	PreviewsSynchronizer sync(&settings, &fakeAws);
@@ -208,6 +271,238 @@ TEST_F(PreviewsSynchronizerTest, ShouldNotProcessPreviewsIfAlreadyProcessing)
 	EXPECT_TRUE(sync.stopSynchronizingFile());
 }
 
+TEST_F(PreviewsSynchronizerTest, ShouldFollowUpOnChangesMadeWhileProcessing)
+{
+	// Keep the watcher out of it, only the injected change should be seen
+	settings.set(IEnlightenSettings::WatcherPollRate, 60000);
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(3);
+	EXPECT_CALL(mockAwsRequest, removeObject(testing::_))
+		.Times(1);
+
+	std::string duplicatedDatabaseName = PreviewsSynchronizer_ValidPreviewFile;
+	size_t idx = duplicatedDatabaseName.find_last_of(File::pathSeperator());
+	duplicatedDatabaseName = duplicatedDatabaseName.substr(0, idx+1) +
+		"previewssynchronizer_followup.db";
+	{
+		File file(PreviewsSynchronizer_ValidPreviewFile);
+		file.duplicate(duplicatedDatabaseName.c_str());
+	}
+
+	EXPECT_TRUE(sync.beginSynchronizingFile(duplicatedDatabaseName, ""));
+
+	// The first pass has already read the database, so this is only picked
+	// up by the follow-up pass
+	removeUuidFromDatabaseTable(duplicatedDatabaseName.c_str(), "ImageCacheEntry",
+		"6A2B9912-3868-45E4-AE0D-7EA73F66FF63");
+	removeUuidFromDatabaseTable(duplicatedDatabaseName.c_str(), "Pyramid",
+		"6A2B9912-3868-45E4-AE0D-7EA73F66FF63");
+
+	File file(duplicatedDatabaseName);
+	EXPECT_TRUE(sync.fileHasChanged(nullptr, &file));
+	EXPECT_TRUE(sync.fileHasChanged(nullptr, &file));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+	EXPECT_TRUE(file.remove());
+}
+
+TEST_F(PreviewsSynchronizerTest, ShouldResumeJobsLeftByThePreviousRun)
+{
+	// A run which got as far as journalling one job and caching the rest
+	{
+		CachedPreviews previews(&settings);
+		ASSERT_TRUE(previews.loadOrCreateDatabase());
+
+		const std::string digest = "07cc63f155500a902b21fef7be6585b5";
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"), digest));
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"), digest));
+
+		std::map<enlighten::lib::uuid_t, SyncAction> jobs = {
+			{ enlighten::lib::uuid_t("6A2B9912-3868-45E4-AE0D-7EA73F66FF63"), SyncAction_Add }
+		};
+		EXPECT_TRUE(previews.journalJobs(jobs));
+	}
+
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	// Only the journalled job is left to do, and the diff after it finds nothing
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(1);
+	EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile, ""));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+
+	CachedPreviews previews(&settings);
+	ASSERT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_EQ(3, previews.numberOfCachedPreviews());
+
+	std::vector<SyncJob> unfinished;
+	EXPECT_TRUE(previews.unfinishedJobs(unfinished));
+	EXPECT_TRUE(unfinished.empty());
+}
+
+TEST_F(PreviewsSynchronizerTest, ShouldRequeueDeadLetteredJobsOnStart)
+{
+	// A run which gave up on one preview and cached the rest
+	{
+		CachedPreviews previews(&settings);
+		ASSERT_TRUE(previews.loadOrCreateDatabase());
+
+		const std::string digest = "07cc63f155500a902b21fef7be6585b5";
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"), digest));
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"), digest));
+
+		enlighten::lib::uuid_t failed("6A2B9912-3868-45E4-AE0D-7EA73F66FF63");
+		std::map<enlighten::lib::uuid_t, SyncAction> jobs = { { failed, SyncAction_Add } };
+		std::map<enlighten::lib::uuid_t, std::string> digests = { { failed, digest } };
+		EXPECT_TRUE(previews.journalJobs(jobs, digests));
+		EXPECT_TRUE(previews.markJobDeadLettered(failed));
+	}
+
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(1);
+	EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile, ""));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+
+	CachedPreviews previews(&settings);
+	ASSERT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_EQ(3, previews.numberOfCachedPreviews());
+
+	std::vector<SyncJob> deadLettered;
+	EXPECT_TRUE(previews.deadLetteredJobs(deadLettered));
+	EXPECT_TRUE(deadLettered.empty());
+}
+
+TEST_F(PreviewsSynchronizerTest, ShouldRetryFailedUploadsLater)
+{
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	// Each preview is tried once, then backs off for seconds
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(3)
+		.WillRepeatedly(testing::Return(false));
+
+	// A destination of its own, so its failures don't trip anyone else's breaker
+	int64_t started = RetryPolicy::currentTimeMs();
+	EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile,
+		"ShouldRetryFailedUploadsLater"));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+
+	CachedPreviews previews(&settings);
+	ASSERT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_EQ(0, previews.numberOfCachedPreviews());
+
+	std::vector<SyncJob> unfinished;
+	EXPECT_TRUE(previews.unfinishedJobs(unfinished));
+	ASSERT_EQ(3, unfinished.size());
+	for (const SyncJob& job : unfinished)
+	{
+		EXPECT_EQ(SyncJobState_Failed, job.state);
+		EXPECT_EQ(1, job.retries);
+		EXPECT_GT(job.retryAt, started);
+	}
+}
+
+TEST_F(PreviewsSynchronizerTest, ShouldKeepThePreviousPreviewWhenAnUpdateFails)
+{
+	// Every preview was uploaded before its photo was edited
+	const std::string previousDigest = "ffcc63f155500a902b21fef7be6585b5";
+	{
+		CachedPreviews previews(&settings);
+		ASSERT_TRUE(previews.loadOrCreateDatabase());
+
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"), previousDigest));
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"), previousDigest));
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("6A2B9912-3868-45E4-AE0D-7EA73F66FF63"), previousDigest));
+	}
+
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	// Without the new preview in place, the old one is all there is
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(3)
+		.WillRepeatedly(testing::Return(false));
+	EXPECT_CALL(mockAwsRequest, removeObject(testing::_))
+		.Times(0);
+
+	EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile,
+		"ShouldKeepThePreviousPreviewWhenAnUpdateFails"));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+
+	CachedPreviews previews(&settings);
+	ASSERT_TRUE(previews.loadOrCreateDatabase());
+
+	std::string digest;
+	EXPECT_TRUE(previews.digestForUuid(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"), digest));
+	EXPECT_EQ(previousDigest, digest);
+}
+
+TEST_F(PreviewsSynchronizerTest, ShouldDropLegacyPreviewsWhichAreGoneFromTheDatabase)
+{
+	// Cached before digests were recorded, and since deleted from previews.db
+	enlighten::lib::uuid_t legacy("C0FFEE00-0000-4000-8000-000000000001");
+	{
+		CachedPreviews previews(&settings);
+		ASSERT_TRUE(previews.loadOrCreateDatabase());
+
+		const std::string digest = "07cc63f155500a902b21fef7be6585b5";
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"), digest));
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"), digest));
+		EXPECT_TRUE(previews.markAsCached(enlighten::lib::uuid_t("6A2B9912-3868-45E4-AE0D-7EA73F66FF63"), digest));
+		EXPECT_TRUE(previews.markAsCached(legacy, ""));
+	}
+
+	PreviewsSynchronizer sync(&settings, &fakeAws);
+
+	// There's no key to remove it by, so nothing is asked of the destination
+	EXPECT_CALL(mockAwsRequest, putObject(testing::_, testing::_))
+		.Times(0);
+	EXPECT_CALL(mockAwsRequest, removeObject(testing::_))
+		.Times(0);
+
+	EXPECT_TRUE(sync.beginSynchronizingFile(PreviewsSynchronizer_ValidPreviewFile, ""));
+
+	// Wait around awhile
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	EXPECT_TRUE(sync.stopSynchronizingFile());
+
+	CachedPreviews previews(&settings);
+	ASSERT_TRUE(previews.loadOrCreateDatabase());
+	EXPECT_FALSE(previews.isInCache(legacy));
+	EXPECT_EQ(3, previews.numberOfCachedPreviews());
+
+	std::vector<SyncJob> unfinished;
+	EXPECT_TRUE(previews.unfinishedJobs(unfinished));
+	EXPECT_TRUE(unfinished.empty());
+
+	std::vector<SyncJob> deadLettered;
+	EXPECT_TRUE(previews.deadLetteredJobs(deadLettered));
+	EXPECT_TRUE(deadLettered.empty());
+}
+
 TEST_F(PreviewsSynchronizerTest, WillNotJoinWhenFileChangedDelegateCalledIfNotJoinable)
 {
 	PreviewsSynchronizer sync(&settings, &fakeAws);
@@ -0,0 +1,57 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "retrypolicy.h"
+
+#include <set>
+
+using namespace enlighten::lib;
+
+TEST(RetryPolicyTest, ShouldRetryUpToTheLimit)
+{
+	RetryPolicy policy = { 3, 1000, 60000 };
+
+	EXPECT_TRUE(policy.shouldRetry(0));
+	EXPECT_TRUE(policy.shouldRetry(2));
+	EXPECT_FALSE(policy.shouldRetry(3));
+	EXPECT_FALSE(policy.shouldRetry(4));
+}
+
+TEST(RetryPolicyTest, ShouldDoubleTheDelayWithEachRetry)
+{
+	RetryPolicy policy = { 10, 1000, 1000000 };
+
+	for (uint32_t retries = 0; retries < 5; ++retries)
+	{
+		uint32_t delay = 1000u << retries;
+		for (int i = 0; i < 100; ++i)
+		{
+			uint32_t jittered = policy.delayForRetry(retries);
+			EXPECT_GE(jittered, delay / 2);
+			EXPECT_LE(jittered, delay);
+		}
+	}
+}
+
+TEST(RetryPolicyTest, ShouldCapTheDelay)
+{
+	RetryPolicy policy = { 100, 1000, 5000 };
+
+	for (uint32_t retries : { 3u, 10u, 40u, 99u })
+	{
+		uint32_t jittered = policy.delayForRetry(retries);
+		EXPECT_GE(jittered, 2500u);
+		EXPECT_LE(jittered, 5000u);
+	}
+}
+
+TEST(RetryPolicyTest, ShouldSpreadOutDelays)
+{
+	RetryPolicy policy = { 10, 1000, 60000 };
+
+	std::set<uint32_t> delays;
+	for (int i = 0; i < 100; ++i)
+		delays.insert(policy.delayForRetry(4));
+
+	EXPECT_GT(delays.size(), 10u);
+}
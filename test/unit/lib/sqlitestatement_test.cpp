@@ -0,0 +1,142 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "sqlitestatement.h"
+
+#include "sqlite3.h"
+
+using namespace enlighten::lib;
+
+namespace
+{
+	class MockTimingDelegate : public AbstractSqliteTimingDelegate
+	{
+	public:
+		MOCK_METHOD3(statementExecuted, void(const char*, uint64_t, uint32_t));
+	};
+
+	class SqliteStatementTest : public testing::Test
+	{
+	public:
+		SqliteStatementTest() : database(nullptr)
+		{
+			sqlite3_open(":memory:", &database);
+			sqlite3_exec(database, "CREATE TABLE Test(uuid TEXT, value INTEGER);"
+				"INSERT INTO Test VALUES ('12345678-9ABC-4DEF-8123-456789ABCDEF', 1);"
+				"INSERT INTO Test VALUES ('not a uuid', 2)", NULL, NULL, NULL);
+		}
+
+		~SqliteStatementTest()
+		{
+			SqliteStatement::setTimingDelegate(nullptr);
+
+			// Fails if a statement was left behind
+			EXPECT_EQ(SQLITE_OK, sqlite3_close(database));
+		}
+
+		sqlite3* database;
+	};
+}
+
+TEST_F(SqliteStatementTest, ShouldFailToPrepareAnInvalidQuery)
+{
+	SqliteStatement statement;
+	EXPECT_FALSE(statement.prepare(database, "SELECT nothing FROM Nowhere"));
+	EXPECT_FALSE(statement.isValid());
+}
+
+TEST_F(SqliteStatementTest, ShouldStepThroughRows)
+{
+	SqliteStatement statement;
+	ASSERT_TRUE(statement.prepare(database, "SELECT uuid,value FROM Test ORDER BY value"));
+
+	enlighten::lib::uuid_t uuid;
+	ASSERT_EQ(SQLITE_ROW, statement.step());
+	EXPECT_TRUE(statement.columnUuid(0, uuid));
+	EXPECT_EQ(enlighten::lib::uuid_t("12345678-9ABC-4DEF-8123-456789ABCDEF"), uuid);
+	EXPECT_EQ(1, statement.columnInt(1));
+
+	ASSERT_EQ(SQLITE_ROW, statement.step());
+	EXPECT_FALSE(statement.columnUuid(0, uuid));
+	EXPECT_EQ("not a uuid", statement.columnString(0));
+	EXPECT_EQ(2, statement.columnInt64(1));
+
+	EXPECT_EQ(SQLITE_DONE, statement.step());
+}
+
+TEST_F(SqliteStatementTest, ShouldBeReusableOnceReset)
+{
+	SqliteStatement statement;
+	ASSERT_TRUE(statement.prepare(database, "SELECT value FROM Test WHERE uuid=?"));
+
+	statement.bindUuid(1, enlighten::lib::uuid_t("12345678-9ABC-4DEF-8123-456789ABCDEF"));
+	ASSERT_EQ(SQLITE_ROW, statement.step());
+	EXPECT_EQ(1, statement.columnInt(0));
+	statement.reset();
+
+	statement.bindText(1, "not a uuid");
+	ASSERT_EQ(SQLITE_ROW, statement.step());
+	EXPECT_EQ(2, statement.columnInt(0));
+	statement.reset();
+
+	// Bindings are cleared by a reset
+	EXPECT_EQ(SQLITE_DONE, statement.step());
+}
+
+TEST_F(SqliteStatementTest, ShouldReturnAnEmptyStringForNull)
+{
+	SqliteStatement statement;
+	ASSERT_TRUE(statement.prepare(database, "SELECT NULL"));
+	ASSERT_EQ(SQLITE_ROW, statement.step());
+
+	EXPECT_EQ(nullptr, statement.columnText(0));
+	EXPECT_EQ("", statement.columnString(0));
+}
+
+TEST_F(SqliteStatementTest, ShouldHandOverOwnershipWhenMoved)
+{
+	SqliteStatement statement;
+	ASSERT_TRUE(statement.prepare(database, "SELECT value FROM Test"));
+
+	SqliteStatement moved(std::move(statement));
+	EXPECT_FALSE(statement.isValid());
+	EXPECT_TRUE(moved.isValid());
+	EXPECT_EQ(SQLITE_ROW, moved.step());
+
+	SqliteStatement assigned;
+	assigned = std::move(moved);
+	EXPECT_FALSE(moved.isValid());
+	EXPECT_EQ(SQLITE_ROW, assigned.step());
+}
+
+TEST_F(SqliteStatementTest, ShouldReportEachExecutionToTheTimingDelegate)
+{
+	MockTimingDelegate delegate;
+	SqliteStatement::setTimingDelegate(&delegate);
+
+	EXPECT_CALL(delegate, statementExecuted(testing::StrEq("SELECT value FROM Test"),
+		testing::_, 3))
+			.Times(2);
+
+	SqliteStatement statement;
+	ASSERT_TRUE(statement.prepare(database, "SELECT value FROM Test"));
+
+	while (statement.step() == SQLITE_ROW) {}
+	statement.reset();
+
+	// Reported when finalized
+	while (statement.step() == SQLITE_ROW) {}
+}
+
+TEST_F(SqliteStatementTest, ShouldNotReportStatementsWhichNeverRan)
+{
+	MockTimingDelegate delegate;
+	SqliteStatement::setTimingDelegate(&delegate);
+
+	EXPECT_CALL(delegate, statementExecuted(testing::_, testing::_, testing::_))
+		.Times(0);
+
+	SqliteStatement statement;
+	ASSERT_TRUE(statement.prepare(database, "SELECT value FROM Test"));
+	statement.reset();
+}
@@ -0,0 +1,95 @@
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "uuid.h"
+
+#include <set>
+#include <unordered_set>
+
+using namespace enlighten::lib;
+
+TEST(Uuid, ShouldBeNilByDefault)
+{
+	Uuid uuid;
+	EXPECT_TRUE(uuid.isNil());
+	EXPECT_EQ("00000000-0000-0000-0000-000000000000", uuid.toString());
+}
+
+TEST(Uuid, ShouldRoundTripThroughAString)
+{
+	Uuid uuid;
+	ASSERT_TRUE(Uuid::fromString("3829E5FC-7F3F-4B22-94F3-FB5E2C796026", uuid));
+
+	EXPECT_FALSE(uuid.isNil());
+	EXPECT_EQ("3829E5FC-7F3F-4B22-94F3-FB5E2C796026", uuid.toString());
+}
+
+TEST(Uuid, ShouldParseLowerCaseHex)
+{
+	Uuid lower("3829e5fc-7f3f-4b22-94f3-fb5e2c796026");
+	Uuid upper("3829E5FC-7F3F-4B22-94F3-FB5E2C796026");
+
+	EXPECT_EQ(upper, lower);
+	EXPECT_EQ(upper.hash(), lower.hash());
+	EXPECT_EQ("3829E5FC-7F3F-4B22-94F3-FB5E2C796026", lower.toString());
+}
+
+TEST(Uuid, ShouldRejectMalformedStrings)
+{
+	const char* malformed[] =
+	{
+		"",
+		"3829E5FC",
+		"3829E5FC-7F3F-4B22-94F3-FB5E2C79602G",
+		"3829E5FC07F3F-4B22-94F3-FB5E2C796026",
+		"3829E5FC-7F3F-4B22-94F3-FB5E2C7960266",
+		"B089021B' OR '1'='1"
+	};
+
+	for (auto string : malformed)
+	{
+		Uuid uuid;
+		EXPECT_FALSE(Uuid::fromString(string, uuid)) << string;
+		EXPECT_TRUE(uuid.isNil());
+		EXPECT_TRUE(Uuid(string).isNil());
+	}
+}
+
+TEST(Uuid, ShouldOrderLikeItsString)
+{
+	const char* strings[] =
+	{
+		"B089021B-7ACE-4A62-BD32-85A6C6AD5B9C",
+		"3829E5FC-7F3F-4B22-94F3-FB5E2C796026",
+		"6A2B9912-3868-45E4-AE0D-7EA73F66FF63",
+		"6A2B9912-3868-45E4-AE0D-7EA73F66FF62"
+	};
+
+	std::set<std::string> sortedStrings;
+	std::set<Uuid> sortedUuids;
+	for (auto string : strings)
+	{
+		sortedStrings.insert(string);
+		sortedUuids.insert(Uuid(string));
+	}
+
+	ASSERT_EQ(sortedStrings.size(), sortedUuids.size());
+
+	auto uuidIt = sortedUuids.begin();
+	for (auto& string : sortedStrings)
+	{
+		EXPECT_EQ(string, uuidIt->toString());
+		++uuidIt;
+	}
+}
+
+TEST(Uuid, ShouldBeUsableAsAHashKey)
+{
+	std::unordered_set<Uuid> uuids;
+	uuids.insert(Uuid("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"));
+	uuids.insert(Uuid("3829E5FC-7F3F-4B22-94F3-FB5E2C796026"));
+	uuids.insert(Uuid("B089021B-7ACE-4A62-BD32-85A6C6AD5B9C"));
+
+	EXPECT_EQ(2, uuids.size());
+	EXPECT_EQ(1, uuids.count(Uuid("b089021b-7ace-4a62-bd32-85a6c6ad5b9c")));
+}